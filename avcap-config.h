@@ -45,6 +45,11 @@
 #define AVCAP_HAVE_LIMITS_H  1 
 #endif
 
+/* Define to 1 if you have the <linux/io_uring.h> header file. */
+#ifndef AVCAP_HAVE_LINUX_IO_URING_H 
+#define AVCAP_HAVE_LINUX_IO_URING_H  1 
+#endif
+
 /* Define to 1 if your system has a GNU libc compatible `malloc' function, and
    to 0 otherwise. */
 #ifndef AVCAP_HAVE_MALLOC 
@@ -0,0 +1,333 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+#ifndef _WIN32
+
+#include "CaptureGroup.h"
+#include "CaptureManager.h"
+#include "IOBuffer.h"
+
+using namespace avcap;
+
+// A camera of the group, registered as capture handler with its manager
+
+class CaptureGroup::Member : public CaptureHandler
+{
+public:
+	CaptureGroup*			group;
+	CaptureManager*			mgr;
+	std::deque<IOBuffer*>	pending;
+	
+	unsigned long			frameSets;
+	unsigned long			dropped;
+	long long				sumSkew;
+	long long				maxSkew;
+	
+	Member(CaptureGroup* g, CaptureManager* m):
+		group(g), mgr(m), frameSets(0), dropped(0), sumSkew(0), maxSkew(0)
+		{}
+	
+	void handleCaptureEvent(IOBuffer* io_buf)
+		{ group->handleFrame(this, io_buf); }
+};
+
+// Construction & Destruction
+
+CaptureGroup::CaptureGroup(long long tolerance_ns):
+	mHandler(0),
+	mTolerance(tolerance_ns),
+	mStopped(true)
+{
+	pthread_mutex_init(&mLock, 0);
+}
+
+CaptureGroup::~CaptureGroup()
+{
+	for(unsigned int i = 0; i < mMembers.size(); i++)
+		mMembers[i]->mgr->removeCaptureHandler(mMembers[i]);
+	
+	flush();
+	
+	for(unsigned int i = 0; i < mMembers.size(); i++)
+		delete mMembers[i];
+	
+	pthread_mutex_destroy(&mLock);
+}
+
+int CaptureGroup::add(CaptureManager* mgr)
+{
+	if(mgr == 0 || !mStopped || mMembers.size() >= MAX_CAMERAS)
+		return -1;
+	
+	Member* member = new Member(this, mgr);
+	
+	if(mgr->addCaptureHandler(member) == -1) {
+		delete member;
+		return -1;
+	}
+	
+	pthread_mutex_lock(&mLock);
+	mMembers.push_back(member);
+	int res = mMembers.size() - 1;
+	pthread_mutex_unlock(&mLock);
+	
+	return res;
+}
+
+int CaptureGroup::getNumCameras()
+{
+	return mMembers.size();
+}
+
+void CaptureGroup::setFrameSetHandler(FrameSetHandler* handler)
+{
+	pthread_mutex_lock(&mLock);
+	mHandler = handler;
+	pthread_mutex_unlock(&mLock);
+}
+
+void CaptureGroup::setTolerance(long long tolerance_ns)
+{
+	pthread_mutex_lock(&mLock);
+	mTolerance = tolerance_ns >= 0 ? tolerance_ns : 0;
+	pthread_mutex_unlock(&mLock);
+}
+
+long long CaptureGroup::getTolerance()
+{
+	return mTolerance;
+}
+
+int CaptureGroup::startCapture()
+{
+	pthread_mutex_lock(&mLock);
+	mStopped = false;
+	pthread_mutex_unlock(&mLock);
+	
+	// start the cameras back to back, everything else has been prepared before
+	for(unsigned int i = 0; i < mMembers.size(); i++) {
+		if(mMembers[i]->mgr->startCapture() == -1) {
+			while(i-- > 0)
+				mMembers[i]->mgr->stopCapture();
+			
+			pthread_mutex_lock(&mLock);
+			mStopped = true;
+			pthread_mutex_unlock(&mLock);
+			
+			flush();
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+int CaptureGroup::stopCapture()
+{
+	int res = 0;
+	
+	// the managers delete their buffers, so give the waiting frames back before
+	pthread_mutex_lock(&mLock);
+	mStopped = true;
+	pthread_mutex_unlock(&mLock);
+	
+	flush();
+	
+	for(unsigned int i = 0; i < mMembers.size(); i++)
+		if(mMembers[i]->mgr->stopCapture() == -1)
+			res = -1;
+	
+	return res;
+}
+
+int CaptureGroup::getSkewStats(int camera, SkewStats& stats)
+{
+	if(camera < 0 || camera >= (int) mMembers.size())
+		return -1;
+	
+	pthread_mutex_lock(&mLock);
+	Member* member = mMembers[camera];
+	
+	stats.frameSets = member->frameSets;
+	stats.dropped = member->dropped;
+	stats.meanSkew = member->frameSets ? member->sumSkew / (long long) member->frameSets : 0;
+	stats.maxSkew = member->maxSkew;
+	pthread_mutex_unlock(&mLock);
+	
+	return 0;
+}
+
+void CaptureGroup::resetStats()
+{
+	pthread_mutex_lock(&mLock);
+	
+	for(unsigned int i = 0; i < mMembers.size(); i++) {
+		mMembers[i]->frameSets = 0;
+		mMembers[i]->dropped = 0;
+		mMembers[i]->sumSkew = 0;
+		mMembers[i]->maxSkew = 0;
+	}
+	
+	pthread_mutex_unlock(&mLock);
+}
+
+void CaptureGroup::handleFrame(Member* member, IOBuffer* io_buf)
+{
+	// called from the capture threads of the cameras
+	IOBuffer* sets[MAX_PENDING + 1][MAX_CAMERAS];
+	IOBuffer* released[MAX_CAMERAS * (MAX_PENDING + 1)];
+	FrameSetHandler* handler = 0;
+	int num_sets = 0;
+	int num_released = 0;
+	int count = 0;
+	
+	pthread_mutex_lock(&mLock);
+	
+	if(mStopped) {
+		pthread_mutex_unlock(&mLock);
+		io_buf->release();
+		return;
+	}
+	
+	// keep only the latest frames of a camera
+	member->pending.push_back(io_buf);
+	
+	if(member->pending.size() > MAX_PENDING) {
+		released[num_released++] = member->pending.front();
+		member->pending.pop_front();
+		member->dropped++;
+	}
+	
+	int n = mMembers.size();
+	
+	while(num_sets <= MAX_PENDING) {
+		// all cameras need a frame
+		bool waiting = false;
+		long long newest = 0;
+		
+		for(int i = 0; i < n && !waiting; i++) {
+			if(mMembers[i]->pending.empty())
+				waiting = true;
+			else if(i == 0 || mMembers[i]->pending.front()->getTimestampNs() > newest)
+				newest = mMembers[i]->pending.front()->getTimestampNs();
+		}
+		
+		if(waiting)
+			break;
+		
+		// release the frames that are too old to match the newest one
+		bool pruned = false;
+		
+		for(int i = 0; i < n; i++) {
+			Member* m = mMembers[i];
+			
+			if(m->pending.front()->getTimestampNs() < newest - mTolerance) {
+				released[num_released++] = m->pending.front();
+				m->pending.pop_front();
+				m->dropped++;
+				pruned = true;
+			}
+		}
+		
+		if(pruned)
+			continue;
+		
+		// the camera with the newest first frame has nothing closer, the others contribute 
+		// the frame nearest to it, the frames before can't match a later set anymore
+		IOBuffer** set = sets[num_sets++];
+		
+		for(int i = 0; i < n; i++) {
+			Member* m = mMembers[i];
+			unsigned int nearest = 0;
+			
+			for(unsigned int k = 1; k < m->pending.size(); k++) {
+				long long d = m->pending[k]->getTimestampNs() - newest;
+				long long best = m->pending[nearest]->getTimestampNs() - newest;
+				
+				if((d < 0 ? -d : d) < (best < 0 ? -best : best))
+					nearest = k;
+			}
+			
+			for(unsigned int k = 0; k < nearest; k++) {
+				released[num_released++] = m->pending.front();
+				m->pending.pop_front();
+				m->dropped++;
+			}
+			
+			set[i] = m->pending.front();
+			m->pending.pop_front();
+			
+			long long skew = set[i]->getTimestampNs() - set[0]->getTimestampNs();
+			
+			m->frameSets++;
+			m->sumSkew += skew;
+			
+			if(skew < 0)
+				skew = -skew;
+			
+			if(skew > m->maxSkew)
+				m->maxSkew = skew;
+		}
+		
+		count = n;
+		handler = mHandler;
+	}
+	
+	pthread_mutex_unlock(&mLock);
+	
+	// release the dropped frames and deliver the sets without holding the lock
+	for(int i = 0; i < num_released; i++)
+		released[i]->release();
+	
+	for(int s = 0; s < num_sets; s++) {
+		if(handler) {
+			handler->handleFrameSet(sets[s], count);
+		} else {
+			for(int i = 0; i < count; i++)
+				sets[s][i]->release();
+		}
+	}
+}
+
+void CaptureGroup::flush()
+{
+	// release the frames waiting for a set, outside of the lock
+	std::vector<IOBuffer*> released;
+	
+	pthread_mutex_lock(&mLock);
+	
+	for(unsigned int i = 0; i < mMembers.size(); i++) {
+		Member* member = mMembers[i];
+		
+		released.insert(released.end(), member->pending.begin(), member->pending.end());
+		member->pending.clear();
+	}
+	
+	pthread_mutex_unlock(&mLock);
+	
+	for(unsigned int i = 0; i < released.size(); i++)
+		released[i]->release();
+}
+
+#endif // _WIN32
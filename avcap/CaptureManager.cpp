@@ -0,0 +1,526 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <sched.h>
+#endif
+
+#include <vector>
+
+#include "CaptureManager.h"
+#include "CaptureHandler.h"
+#include "FrameQueue.h"
+#include "DispatchPool.h"
+#include "IOBuffer.h"
+
+using namespace avcap;
+
+// atomically replace a handler slot, if it contains the expected value
+static bool swapHandler(CaptureHandler* volatile* slot, CaptureHandler* expected, CaptureHandler* handler)
+{
+#ifdef _WIN32
+	return InterlockedCompareExchangePointer((PVOID volatile*) slot, handler, expected) == expected;
+#else
+	return __sync_bool_compare_and_swap(slot, expected, handler);
+#endif
+}
+
+#ifndef _WIN32
+// calls the handlers with one or more frames on a thread of the dispatch pool
+class FrameTask : public DispatchTask
+{
+	CaptureHandler*			mHandlers[CaptureManager::MAX_HANDLERS];
+	int						mNumHandlers;
+	std::vector<IOBuffer*>	mBuffers;
+	bool					mBatch;
+	
+public:
+	FrameTask(CaptureHandler** handlers, int n, IOBuffer** io_bufs, int count, bool batch):
+		mNumHandlers(n), mBuffers(io_bufs, io_bufs + count), mBatch(batch)
+	{
+		for(int i = 0; i < n; i++)
+			mHandlers[i] = handlers[i];
+	}
+	
+	bool uses(const void* object) const
+	{
+		for(int i = 0; i < mNumHandlers; i++)
+			if(mHandlers[i] == object)
+				return true;
+		
+		return false;
+	}
+	
+	void run()
+	{
+		for(int i = 0; i < mNumHandlers; i++) {
+			if(mBatch)
+				mHandlers[i]->handleCaptureBatch(&mBuffers[0], mBuffers.size());
+			else
+				mHandlers[i]->handleCaptureEvent(mBuffers[0]);
+		}
+	}
+};
+
+// calls the handlers with an event of the device on a thread of the dispatch pool
+class EventTask : public DispatchTask
+{
+	CaptureHandler*			mHandlers[CaptureManager::MAX_HANDLERS];
+	int						mNumHandlers;
+	int						mEvent;
+	unsigned int			mValue;
+	
+public:
+	EventTask(CaptureHandler** handlers, int n, int event, unsigned int value):
+		mNumHandlers(n), mEvent(event), mValue(value)
+	{
+		for(int i = 0; i < n; i++)
+			mHandlers[i] = handlers[i];
+	}
+	
+	bool uses(const void* object) const
+	{
+		for(int i = 0; i < mNumHandlers; i++)
+			if(mHandlers[i] == object)
+				return true;
+		
+		return false;
+	}
+	
+	void run()
+	{
+		for(int i = 0; i < mNumHandlers; i++)
+			mHandlers[i]->handleDeviceEvent((CaptureHandler::DeviceEvent) mEvent, mValue);
+	}
+};
+#endif
+
+// Construction & Destruction
+
+CaptureManager::CaptureManager():
+	mFrameQueue(0),
+	mOverloadPolicy(OVERLOAD_KEEP_NEWEST),
+	mDeliveredFrames(0),
+	mDriverDrops(0),
+	mLastSequence(0),
+	mDispatchMode(DISPATCH_DIRECT),
+	mDispatchPool(0),
+	mDispatchStrand(0),
+	mPosting(0)
+{
+	for(int i = 0; i < MAX_HANDLERS; i++)
+		mCaptureHandlers[i] = 0;
+}
+
+CaptureManager::~CaptureManager()
+{
+#ifndef _WIN32
+	setDispatchMode(DISPATCH_DIRECT);
+	delete mFrameQueue;
+#endif
+}
+
+void CaptureManager::registerCaptureHandler(CaptureHandler *handler)
+{
+	removeCaptureHandler();
+	
+	if(handler)
+		addCaptureHandler(handler);
+}
+
+void CaptureManager::removeCaptureHandler()
+{
+	for(int i = 0; i < MAX_HANDLERS; i++) {
+		CaptureHandler* handler = mCaptureHandlers[i];
+		
+		if(handler && swapHandler(&mCaptureHandlers[i], handler, 0))
+			waitHandler(handler);
+	}
+}
+
+int CaptureManager::addCaptureHandler(CaptureHandler *handler)
+{
+	if(handler == 0)
+		return -1;
+	
+	for(int i = 0; i < MAX_HANDLERS; i++)
+		if(mCaptureHandlers[i] == handler)
+			return -1;
+	
+	// take the first free slot, the capture thread may read the slots at the same time
+	for(int i = 0; i < MAX_HANDLERS; i++)
+		if(mCaptureHandlers[i] == 0 && swapHandler(&mCaptureHandlers[i], 0, handler))
+			return 0;
+	
+	return -1;
+}
+
+int CaptureManager::removeCaptureHandler(CaptureHandler *handler)
+{
+	for(int i = 0; i < MAX_HANDLERS; i++) {
+		if(handler && swapHandler(&mCaptureHandlers[i], handler, 0)) {
+			waitHandler(handler);
+			return 0;
+		}
+	}
+	
+	return -1;
+}
+
+void CaptureManager::waitHandler(CaptureHandler* handler)
+{
+#ifndef _WIN32
+	if(mDispatchStrand == 0)
+		return;
+	
+	// the capture thread may have taken the handler from its slot, but not yet posted the task
+	__sync_synchronize();
+	while(mPosting > 0)
+		sched_yield();
+	
+	mDispatchStrand->wait(handler);
+#endif
+}
+
+int CaptureManager::getHandlers(CaptureHandler** handlers)
+{
+	// the registration changes in between, so take a copy of the slots
+	int n = 0;
+	
+#ifndef _WIN32
+	// until the task has been posted, see waitHandler()
+	if(mDispatchStrand) {
+		__sync_fetch_and_add(&mPosting, 1);
+		__sync_synchronize();
+	}
+#endif
+	
+	for(int i = 0; i < MAX_HANDLERS; i++) {
+		CaptureHandler* handler = mCaptureHandlers[i];
+		
+		if(handler)
+			handlers[n++] = handler;
+	}
+	
+	return n;
+}
+
+void CaptureManager::postedHandlers()
+{
+#ifndef _WIN32
+	if(mDispatchStrand)
+		__sync_fetch_and_sub(&mPosting, 1);
+#endif
+}
+
+CaptureHandler* CaptureManager::getCaptureHandler()
+{
+	for(int i = 0; i < MAX_HANDLERS; i++) {
+		CaptureHandler* handler = mCaptureHandlers[i];
+		
+		if(handler)
+			return handler;
+	}
+	
+	return 0;
+}
+
+int CaptureManager::getNumCaptureHandlers()
+{
+	int res = 0;
+	
+	for(int i = 0; i < MAX_HANDLERS; i++)
+		if(mCaptureHandlers[i])
+			res++;
+	
+	return res;
+}
+
+int CaptureManager::deliver(IOBuffer* io_buf)
+{
+	// take a snapshot of the handlers, so all of them get the buffer, even if 
+	CaptureHandler* handlers[MAX_HANDLERS];
+	
+	countFrame(io_buf);
+	
+	int n = getHandlers(handlers);
+	
+	if(n == 0) {
+		postedHandlers();
+		return 0;
+	}
+	
+	mDeliveredFrames++;
+	
+	// the buffer is given back after the last handler has released it
+	io_buf->setRefCount(n);
+	
+#ifndef _WIN32
+	if(mDispatchStrand) {
+		mDispatchStrand->post(new FrameTask(handlers, n, &io_buf, 1, false));
+		postedHandlers();
+		return n;
+	}
+#endif
+	
+	for(int i = 0; i < n; i++)
+		handlers[i]->handleCaptureEvent(io_buf);
+	
+	return n;
+}
+
+int CaptureManager::deliverBatch(IOBuffer** io_bufs, int count)
+{
+	// like deliver(), but each handler gets all buffers with a single call
+	CaptureHandler* handlers[MAX_HANDLERS];
+	
+	for(int i = 0; i < count; i++)
+		countFrame(io_bufs[i]);
+	
+	int n = getHandlers(handlers);
+	
+	if(n == 0 || count == 0) {
+		postedHandlers();
+		return 0;
+	}
+	
+	mDeliveredFrames += count;
+	
+	for(int i = 0; i < count; i++)
+		io_bufs[i]->setRefCount(n);
+	
+#ifndef _WIN32
+	if(mDispatchStrand) {
+		mDispatchStrand->post(new FrameTask(handlers, n, io_bufs, count, true));
+		postedHandlers();
+		return n;
+	}
+#endif
+	
+	for(int i = 0; i < n; i++)
+		handlers[i]->handleCaptureBatch(io_bufs, count);
+	
+	return n;
+}
+
+int CaptureManager::deliverEvent(int event, unsigned int value)
+{
+	CaptureHandler* handlers[MAX_HANDLERS];
+	int n = getHandlers(handlers);
+	
+#ifndef _WIN32
+	// keep the order of events and frames
+	if(mDispatchStrand) {
+		if(n > 0)
+			mDispatchStrand->post(new EventTask(handlers, n, event, value));
+		
+		postedHandlers();
+		return n;
+	}
+#endif
+	
+	for(int i = 0; i < n; i++)
+		handlers[i]->handleDeviceEvent((CaptureHandler::DeviceEvent) event, value);
+	
+	return n;
+}
+
+void CaptureManager::countFrame(IOBuffer* io_buf)
+{
+	// frames missing in the sequence have been dropped by the driver, 
+	// a smaller number means that capturing has been restarted
+	long sequence = io_buf->getSequence();
+	
+	if(sequence > mLastSequence + 1 && mLastSequence > 0)
+		mDriverDrops += sequence - mLastSequence - 1;
+	
+	mLastSequence = sequence;
+}
+
+IOBuffer* CaptureManager::nextFrame(int timeout_ms)
+{
+#ifndef _WIN32
+	if(mFrameQueue == 0) {
+		mFrameQueue = new FrameQueue();
+		mFrameQueue->setPolicy(mOverloadPolicy);
+	}
+	
+	// start queuing the frames on the first call or after the handlers have been removed
+	bool registered = false;
+	for(int i = 0; i < MAX_HANDLERS; i++)
+		if(mCaptureHandlers[i] == mFrameQueue)
+			registered = true;
+	
+	if(!registered && addCaptureHandler(mFrameQueue) == -1)
+		return 0;
+	
+	return mFrameQueue->pop(timeout_ms < 0 ? -1 : timeout_ms);
+#else
+	return 0;
+#endif
+}
+
+IOBuffer* CaptureManager::tryNextFrame()
+{
+	return nextFrame(0);
+}
+
+int CaptureManager::setFrameQueueLimits(int depth, int max_held)
+{
+#ifndef _WIN32
+	if(mFrameQueue == 0) {
+		mFrameQueue = new FrameQueue(depth, max_held);
+		mFrameQueue->setPolicy(mOverloadPolicy);
+	} else {
+		mFrameQueue->setLimits(depth, max_held);
+	}
+	
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+void CaptureManager::closeFrameQueue()
+{
+#ifndef _WIN32
+	if(mFrameQueue == 0)
+		return;
+	
+	removeCaptureHandler(mFrameQueue);
+	mFrameQueue->flush();
+#endif
+}
+
+int CaptureManager::setOverloadPolicy(OverloadPolicy policy)
+{
+#ifndef _WIN32
+	mOverloadPolicy = policy;
+	
+	if(mFrameQueue)
+		mFrameQueue->setPolicy(policy);
+	
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+int CaptureManager::setDispatchMode(DispatchMode mode, int threads)
+{
+#ifndef _WIN32
+	// let the handlers finish the frames passed to the old strand
+	if(mDispatchStrand) {
+		delete mDispatchStrand;
+		DispatchPool::release(mDispatchPool);
+		
+		mDispatchStrand = 0;
+		mDispatchPool = 0;
+	}
+	
+	mDispatchMode = DISPATCH_DIRECT;
+	
+	if(mode == DISPATCH_DIRECT)
+		return 0;
+	
+	mDispatchPool = DispatchPool::acquire(threads);
+	
+	if(mDispatchPool == 0)
+		return -1;
+	
+	mDispatchStrand = new DispatchStrand(mDispatchPool, mode == DISPATCH_ORDERED);
+	mDispatchMode = mode;
+	
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+unsigned long CaptureManager::getLibraryDrops()
+{
+#ifndef _WIN32
+	if(mFrameQueue)
+		return mFrameQueue->getDropped();
+#endif
+	
+	return 0;
+}
+
+void CaptureManager::resetFrameCounters()
+{
+	mDeliveredFrames = 0;
+	mDriverDrops = 0;
+	
+#ifndef _WIN32
+	if(mFrameQueue)
+		mFrameQueue->resetDropped();
+#endif
+}
+
+void CaptureManager::flushFrames()
+{
+#ifndef _WIN32
+	if(mFrameQueue)
+		mFrameQueue->close();
+	
+	waitDispatched();
+#endif
+}
+
+void CaptureManager::waitDispatched()
+{
+#ifndef _WIN32
+	if(mDispatchStrand)
+		mDispatchStrand->wait();
+#endif
+}
+
+void CaptureManager::openFrames()
+{
+	// the sequence numbers start again
+	mLastSequence = 0;
+	
+#ifndef _WIN32
+	if(mFrameQueue)
+		mFrameQueue->open();
+#endif
+}
+
+void CaptureManager::recycle(IOBuffer* io_buf)
+{
+#ifndef _WIN32
+	// the application doesn't hold the frame anymore
+	if(io_buf->isPulled()) {
+		io_buf->setPulled(false);
+		
+		if(mFrameQueue)
+			mFrameQueue->frameReleased();
+	}
+#endif
+	
+	enqueue(io_buf);
+}
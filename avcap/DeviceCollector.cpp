@@ -24,17 +24,38 @@
 
 #include <iostream>
 #include <sstream>
+#include <vector>
+#include <algorithm>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <unistd.h>
+#endif
+
 #if !defined(_MSC_VER) && !defined(USE_PREBUILD_LIBS)
 # include "avcap-config.h"
 #endif
 
 #include "DeviceCollector.h"
+#include "DeviceListener.h"
 #include "log.h"
 
 #ifdef AVCAP_LINUX
+# include <pthread.h>
+# include <sched.h>
+# include <dirent.h>
+# include <errno.h>
+# include <poll.h>
+# include <stdlib.h>
+# include <string.h>
+# include <time.h>
+# include <sys/socket.h>
+# include <sys/eventfd.h>
+# include <sys/inotify.h>
+# include <linux/netlink.h>
 # include "V4L1_Device.h"
 # include "V4L2_Device.h"
 # include "V4L1_DeviceDescriptor.h"
@@ -62,36 +83,101 @@
 
 using namespace avcap;
 
+DeviceFilter DeviceCollector::sDefaultFilter;
+
+// add to an integer atomically and return the new value
+static inline int atomicAdd(volatile int* value, int delta)
+{
+#ifdef _WIN32
+	return InterlockedExchangeAdd((volatile LONG*) value, delta) + delta;
+#else
+	return __sync_add_and_fetch(value, delta);
+#endif
+}
+
+// atomically replace a listener slot, if it contains the expected value
+static inline void memoryBarrier()
+{
+#ifdef _WIN32
+	MemoryBarrier();
+#else
+	__sync_synchronize();
+#endif
+}
+
+static bool swapListener(DeviceListener* volatile* slot, DeviceListener* expected, DeviceListener* listener)
+{
+#ifdef _WIN32
+	return InterlockedCompareExchangePointer((PVOID volatile*) slot, listener, expected) == expected;
+#else
+	return __sync_bool_compare_and_swap(slot, expected, listener);
+#endif
+}
+
+#ifdef AVCAP_LINUX
+static void abandonProbe(V4L2_Probe* probe);
+#endif
+
 // Construction & Destruction
-DeviceCollector::DeviceCollector()
+DeviceCollector::DeviceCollector():
+	mCurrent(new DeviceList), mEpoch(0), mNotified(0)
 {
+	mReaders[0] = mReaders[1] = 0;
+	
+	for(int i = 0; i < MAX_LISTENERS; i++)
+		mListeners[i] = 0;
+	
 	// query for available devices
 #ifdef AVCAP_LINUX
-	// prefer V4L2-driver over V4L1-driver, if both are available
-	query_V4L2_Devices();
-#ifndef AVCAP_HAVE_V4L2
-	query_V4L1_Devices();
-#endif
-	query_ieee1394_Devices();
+	pthread_mutex_init(&mUpdateLock, 0);
+	mMonitorThread = 0;
+	mMonitorFd = -1;
+	mMonitorInotify = false;
+	mStopFd = -1;
+	
+	if(!sDefaultFilter.lazy)
+		queryDevices(sDefaultFilter);
 #endif
 
 #ifdef AVCAP_OSX
 	query_QT_Devices();
+	publish();
 #endif
 
 #ifdef AVCAP_WINDOWS
 	// Init COM-library
 	CoInitialize(NULL);
 	query_DS_Devices();
+	publish();
 #endif
 }
 
 DeviceCollector::~DeviceCollector()
 {
+	stopMonitor();
+	
 	// delete all device descriptors
 	for( DeviceList::iterator it = mDeviceList.begin(); it != mDeviceList.end(); it++) {
 		delete *it;
 	}
+	
+	delete mCurrent;
+	
+	for(std::list<std::pair<int, const DeviceList*> >::iterator it = mOldLists.begin(); it != mOldLists.end(); it++)
+		delete it->second;
+
+#ifdef AVCAP_LINUX
+	// and those of removed devices, that were still open
+	for( DeviceList::iterator it = mRetired.begin(); it != mRetired.end(); it++) {
+		delete *it;
+	}
+	
+	// the threads still probing delete their probe, when they are done
+	for(std::list<V4L2_Probe*>::iterator it = mProbes.begin(); it != mProbes.end(); it++)
+		abandonProbe(*it);
+	
+	pthread_mutex_destroy(&mUpdateLock);
+#endif
 
 #ifdef AVCAP_OSX
 	// QT cleanup stuff
@@ -104,18 +190,467 @@ DeviceCollector::~DeviceCollector()
 #endif
 }
 
+void DeviceCollector::setDefaultFilter(const DeviceFilter& filter)
+{
+	sDefaultFilter = filter;
+}
+
+int DeviceCollector::queryDevices(const DeviceFilter& filter)
+{
+	int count = 0;
+	
+#ifdef AVCAP_LINUX
+	pthread_mutex_lock(&mUpdateLock);
+	
+	count = mDeviceList.size();
+	
+	// prefer V4L2-driver over V4L1-driver, if both are available
+	query_V4L2_Devices(filter);
+#ifndef AVCAP_HAVE_V4L2
+	query_V4L1_Devices();
+#endif
+	query_ieee1394_Devices();
+	
+	count = mDeviceList.size() - count;
+	
+	if(count > 0)
+		publish();
+	
+	pthread_mutex_unlock(&mUpdateLock);
+#endif
+
+	return count;
+}
+
+bool DeviceCollector::hasDevice(const std::string& name) const
+{
+	for(DeviceList::const_iterator i = mDeviceList.begin(); i != mDeviceList.end(); i++)
+		if((*i)->getName() == name)
+			return true;
+
+	return false;
+}
+
+int DeviceCollector::publish()
+{
+	// Replace the list seen by the readers with a copy of the current one. Called by one thread at a time.
+	// It doesn't wait for the readers, the caller may hold one itself.
+	mOldLists.push_back(std::make_pair((int) mEpoch, (const DeviceList*) mCurrent));
+	mCurrent = new DeviceList(mDeviceList);
+	
+	// readers entering from now on see the new list
+	int epoch = atomicAdd(&mEpoch, 1) - 1;
+	
+	freeOldLists();
+	
+	return epoch;
+}
+
+void DeviceCollector::freeOldLists()
+{
+	// A counter shared by several epochs is 0 only if the readers of all of them have left.
+	std::list<std::pair<int, const DeviceList*> >::iterator it = mOldLists.begin();
+	
+	while(it != mOldLists.end()) {
+		if(mReaders[it->first & 1] == 0) {
+			delete it->second;
+			it = mOldLists.erase(it);
+		} else {
+			it++;
+		}
+	}
+}
+
+DeviceCollector::Reader::Reader(const DeviceCollector& collector):
+	mCollector(collector)
+{
+	// enter the current epoch, again if the collector has started a new one meanwhile
+	while(true) {
+		mEpoch = collector.mEpoch;
+		atomicAdd(&collector.mReaders[mEpoch & 1], 1);
+		
+		if(collector.mEpoch == mEpoch)
+			break;
+		
+		atomicAdd(&collector.mReaders[mEpoch & 1], -1);
+	}
+	
+	mList = collector.mCurrent;
+}
+
+DeviceCollector::Reader::~Reader()
+{
+	atomicAdd(&mCollector.mReaders[mEpoch & 1], -1);
+}
+
+int DeviceCollector::addDeviceListener(DeviceListener* listener)
+{
+	for(int i = 0; i < MAX_LISTENERS; i++)
+		if(mListeners[i] == listener)
+			return -1;
+	
+	// take the first free slot
+	for(int i = 0; i < MAX_LISTENERS; i++)
+		if(swapListener(&mListeners[i], 0, listener))
+			return 0;
+	
+	return -1;
+}
+
+int DeviceCollector::removeDeviceListener(DeviceListener* listener)
+{
+	int i = 0;
+	
+	while(i < MAX_LISTENERS && !swapListener(&mListeners[i], listener, 0))
+		i++;
+	
+	if(i == MAX_LISTENERS)
+		return -1;
+	
+#ifdef AVCAP_LINUX
+	// wait for a call to the listener, that has started before it has been removed, unless 
+	// it is removed by itself
+	memoryBarrier();
+	
+	if(!mMonitorThread || !pthread_equal(pthread_self(), *mMonitorThread)) {
+		while(mNotified == listener)
+			sched_yield();
+	}
+#endif
+	
+	return 0;
+}
+
+void DeviceCollector::notifyListeners(DeviceDescriptor* dd, bool added)
+{
+	for(int i = 0; i < MAX_LISTENERS; i++) {
+		DeviceListener* listener = mListeners[i];
+		
+		if(!listener)
+			continue;
+		
+		// announce the call, removeDeviceListener() waits for it, if the listener is still registered
+		mNotified = listener;
+		memoryBarrier();
+		
+		if(mListeners[i] == listener) {
+			if(added)
+				listener->handleDeviceAdded(dd);
+			else
+				listener->handleDeviceRemoved(dd);
+		}
+		
+		mNotified = 0;
+	}
+}
+
 // Linux-specific tests
 
 #ifdef AVCAP_LINUX
 
-void DeviceCollector::query_V4L2_Devices()
+// The V4L2 device nodes are probed by a few threads, because opening a node can take seconds, 
+// e.g. if an USB camera has to be woken up. The probe is shared by the collector and the threads 
+// and deleted by the last one leaving it, so threads of devices, that didn't answer in time, 
+// can finish after the collector has given up on them.
+
+enum { MAX_PROBE_THREADS = 8 };
+
+struct avcap::V4L2_Probe
 {
-	// test all /dev/video* nodes, whether they are a valid V4L2 device.
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	
+	std::vector<std::string>				names;
+	std::vector<V4L2_DeviceDescriptor*>	results;
+	std::vector<bool>						done;
+	
+	size_t	next;		// the next node to probe
+	size_t	pending;	// nodes not probed yet
+	int		refs;		// the collector and the running threads
+	bool	abandoned;	// the collector doesn't wait anymore
+};
+
+static void releaseProbe(V4L2_Probe* probe)
+{
+	// called with the mutex locked, unlocks it
+	bool last = --probe->refs == 0;
+	pthread_mutex_unlock(&probe->mutex);
+	
+	if(!last)
+		return;
+	
+	// the results, nobody has taken
+	for(size_t i = 0; i < probe->results.size(); i++)
+		delete probe->results[i];
+	
+	pthread_mutex_destroy(&probe->mutex);
+	pthread_cond_destroy(&probe->cond);
+	delete probe;
+}
+
+static void abandonProbe(V4L2_Probe* probe)
+{
+	pthread_mutex_lock(&probe->mutex);
+	releaseProbe(probe);
+}
+
+static void* probeThread(void* arg)
+{
+	V4L2_Probe* probe = (V4L2_Probe*) arg;
+	
+	pthread_mutex_lock(&probe->mutex);
+	
+	while(!probe->abandoned && probe->next < probe->names.size()) {
+		size_t i = probe->next++;
+		std::string name = probe->names[i];
+		pthread_mutex_unlock(&probe->mutex);
+		
+		// open and query the node without holding the lock
+		V4L2_DeviceDescriptor* dd = new V4L2_DeviceDescriptor(name);
+		
+		pthread_mutex_lock(&probe->mutex);
+		probe->results[i] = dd;
+		probe->done[i] = true;
+		
+		if(--probe->pending == 0)
+			pthread_cond_signal(&probe->cond);
+	}
+	
+	releaseProbe(probe);
+	
+	return 0;
+}
+
+static std::string sysfsDriver(const std::string& node)
+{
+	// the name of the kernel driver bound to the device of a video4linux class node
+	char link[256];
+	std::string path = "/sys/class/video4linux/" + node + "/device/driver";
+	ssize_t len = readlink(path.c_str(), link, sizeof(link) - 1);
+	
+	if(len <= 0)
+		return "";
+	
+	link[len] = 0;
+	
+	const char* base = strrchr(link, '/');
+	
+	return base ? base + 1 : link;
+}
+
+static void listVideoNodes(const DeviceFilter& filter, std::vector<std::string>& names)
+{
+	// the nodes registered by the kernel, so nonexistent nodes aren't tested
+	DIR* dir = opendir("/sys/class/video4linux");
+	
+	if(dir) {
+		std::vector<int> numbers;
+		struct dirent* entry;
+		
+		while((entry = readdir(dir)) != 0) {
+			if(strncmp(entry->d_name, "video", 5) != 0)
+				continue;
+			
+			// skip the devices of other drivers without opening them
+			std::string driver = sysfsDriver(entry->d_name);
+			
+			if(!filter.driver.empty() && !driver.empty() && driver != filter.driver)
+				continue;
+			
+			numbers.push_back(atoi(entry->d_name + 5));
+		}
+		
+		closedir(dir);
+		
+		// keep the order of the node numbers
+		std::sort(numbers.begin(), numbers.end());
+		
+		for(size_t i = 0; i < numbers.size(); i++) {
+			std::ostringstream	ostr;
+			ostr<<"/dev/video"<<numbers[i];
+			names.push_back(ostr.str());
+		}
+		
+		return;
+	}
+	
+	// without sysfs all possible nodes are tested
 	for (int i = 0; i < 64; i++) {
 		std::ostringstream	ostr;
 		ostr<<"/dev/video"<<i;
-		test_V4L2_Device(ostr.str());
-   	}
+		
+		struct stat devstat;
+		
+		if(stat(ostr.str().c_str(), &devstat) == 0)
+			names.push_back(ostr.str());
+	}
+}
+
+static bool matchesFilter(const DeviceFilter& filter, const V4L2_DeviceDescriptor* dd)
+{
+	if(!dd->isAVDev())
+		return false;
+	
+	if(!filter.driver.empty() && dd->getDriver() != filter.driver)
+		return false;
+	
+	if(!filter.busInfo.empty() && dd->getInfo().compare(0, filter.busInfo.size(), filter.busInfo) != 0)
+		return false;
+	
+	if((dd->getCapabilities() & filter.capabilities) != filter.capabilities)
+		return false;
+	
+	if(filter.captureOnly && !dd->isVideoCaptureDev())
+		return false;
+	
+	return true;
+}
+
+void DeviceCollector::query_V4L2_Devices(const DeviceFilter& filter)
+{
+	std::vector<std::string> nodes;
+	listVideoNodes(filter, nodes);
+	
+	// a node, that hasn't answered an earlier query yet, would block another thread
+	std::vector<std::string> busy;
+	std::list<V4L2_Probe*>::iterator it = mProbes.begin();
+	
+	while(it != mProbes.end()) {
+		V4L2_Probe* old = *it;
+		size_t count = busy.size();
+		
+		pthread_mutex_lock(&old->mutex);
+		
+		for(size_t i = 0; i < old->next; i++)
+			if(!old->done[i])
+				busy.push_back(old->names[i]);
+		
+		if(busy.size() > count) {
+			pthread_mutex_unlock(&old->mutex);
+			it++;
+		} else {
+			// the late answers are taken, if they pass this filter
+			for(size_t i = 0; i < old->names.size(); i++) {
+				V4L2_DeviceDescriptor* dd = old->results[i];
+				
+				if(dd && std::find(nodes.begin(), nodes.end(), old->names[i]) != nodes.end() && 
+					!hasDevice(old->names[i]) && matchesFilter(filter, dd)) {
+					mDeviceList.push_back(dd);
+					old->results[i] = 0;
+				}
+			}
+			
+			releaseProbe(old);
+			it = mProbes.erase(it);
+		}
+	}
+	
+	// nodes from an earlier query or testDevice() aren't probed again
+	std::vector<std::string> names;
+	
+	for(size_t i = 0; i < nodes.size(); i++) {
+		if(std::find(busy.begin(), busy.end(), nodes[i]) != busy.end())
+			logDebug("DeviceCollector: " + nodes[i] + " is still being probed");
+		else if(!hasDevice(nodes[i]))
+			names.push_back(nodes[i]);
+	}
+	
+	if(names.empty())
+		return;
+	
+	V4L2_Probe* probe = new V4L2_Probe;
+	pthread_mutex_init(&probe->mutex, 0);
+	
+	// the deadline isn't moved by changes of the system time
+	pthread_condattr_t cond_attr;
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&probe->cond, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
+	probe->names = names;
+	probe->results.resize(names.size(), 0);
+	probe->done.resize(names.size(), false);
+	probe->next = 0;
+	probe->pending = names.size();
+	probe->refs = 1;
+	probe->abandoned = false;
+	
+	int threads = std::min((int) names.size(), (int) MAX_PROBE_THREADS);
+	
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	
+	pthread_mutex_lock(&probe->mutex);
+	
+	for(int i = 0; i < threads; i++) {
+		pthread_t thread;
+		probe->refs++;
+		
+		if(pthread_create(&thread, &attr, probeThread, probe) != 0) {
+			probe->refs--;
+			break;
+		}
+	}
+	
+	pthread_attr_destroy(&attr);
+	
+	// probe in the calling thread, if no thread could be created
+	if(probe->refs == 1) {
+		probe->refs++;
+		pthread_mutex_unlock(&probe->mutex);
+		probeThread(probe);
+		pthread_mutex_lock(&probe->mutex);
+	}
+	
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += filter.timeout / 1000;
+	deadline.tv_nsec += (filter.timeout % 1000) * 1000000L;
+	
+	if(deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	
+	// wait for the nodes to answer
+	while(probe->pending > 0) {
+		int res = filter.timeout > 0 ? 
+			pthread_cond_timedwait(&probe->cond, &probe->mutex, &deadline) :
+			pthread_cond_wait(&probe->cond, &probe->mutex);
+		
+		if(res == ETIMEDOUT)
+			break;
+	}
+	
+	probe->abandoned = true;
+	
+	// take the answers in the order of the nodes, the rest is deleted with the probe
+	bool hanging = false;
+	
+	for(size_t i = 0; i < probe->names.size(); i++) {
+		if(!probe->done[i]) {
+			logDebug("DeviceCollector: no answer in time from " + probe->names[i]);
+			hanging |= i < probe->next;
+			continue;
+		}
+		
+		V4L2_DeviceDescriptor* dd = probe->results[i];
+		
+		if(matchesFilter(filter, dd)) {
+			mDeviceList.push_back(dd);
+			probe->results[i] = 0;
+		}
+	}
+	
+	// remember the nodes still being probed for the next query
+	if(hanging) {
+		mProbes.push_back(probe);
+		pthread_mutex_unlock(&probe->mutex);
+		return;
+	}
+	
+	releaseProbe(probe);
 }
 
 void DeviceCollector::query_V4L1_Devices()
@@ -259,7 +794,12 @@ void DeviceCollector::query_ieee1394_Devices()
 				device = i;
 
 				AVC_DeviceDescriptor* dd = new AVC_DeviceDescriptor(guid);
-				mDeviceList.push_back(dd);
+				
+				// it may be known from an earlier query
+				if(hasDevice(dd->getName()))
+					delete dd;
+				else
+					mDeviceList.push_back(dd);
 			}
 		}
 
@@ -268,20 +808,371 @@ void DeviceCollector::query_ieee1394_Devices()
 #endif
 }
 
+// Linux hotplug monitor
+
+// the netlink groups of the kernel's and of udev's uevents
+enum { UEVENT_GROUP_KERNEL = 1, UEVENT_GROUP_UDEV = 2 };
+
+static bool isVideoNode(const char* name)
+{
+	// "video" followed by the node number, e.g. video0
+	if(strncmp(name, "video", 5) != 0 || !name[5])
+		return false;
+	
+	for(const char* p = name + 5; *p; p++)
+		if(*p < '0' || *p > '9')
+			return false;
+	
+	return true;
+}
+
+void DeviceCollector::monitor(void* collector)
+{
+	DeviceCollector* coll = (DeviceCollector*) collector;
+	
+	// devices plugged in or removed before the monitor has been started
+	coll->resyncDevices();
+	
+	struct pollfd fds[2];
+	fds[0].fd = coll->mMonitorFd;
+	fds[0].events = POLLIN;
+	fds[1].fd = coll->mStopFd;
+	fds[1].events = POLLIN;
+	
+	while(true) {
+		int res = poll(fds, 2, -1);
+		
+		if(res == -1 && errno == EINTR)
+			continue;
+		
+		if(res == -1 || fds[1].revents)
+			break;
+		
+		if(fds[0].revents & POLLIN)
+			coll->handleHotplugEvents();
+		else if(fds[0].revents)
+			break;
+	}
+}
+
+void DeviceCollector::handleHotplugEvents()
+{
+	char buf[8192];
+	
+	if(mMonitorInotify) {
+		ssize_t len = read(mMonitorFd, buf, sizeof(buf));
+		
+		for(ssize_t pos = 0; pos < len; ) {
+			struct inotify_event* ev = (struct inotify_event*) (buf + pos);
+			pos += sizeof(struct inotify_event) + ev->len;
+			
+			// events have been lost
+			if(ev->mask & IN_Q_OVERFLOW) {
+				resyncDevices();
+				continue;
+			}
+			
+			if(!ev->len || !isVideoNode(ev->name))
+				continue;
+			
+			// a node may become accessible only after udev has changed its attributes
+			if(ev->mask & IN_DELETE)
+				removeDevice(std::string("/dev/") + ev->name);
+			else
+				addDevice(std::string("/dev/") + ev->name);
+		}
+		
+		return;
+	}
+	
+	struct sockaddr_nl sender;
+	struct iovec iov;
+	struct msghdr msg;
+	char control[CMSG_SPACE(sizeof(struct ucred))];
+	
+	iov.iov_base = buf;
+	iov.iov_len = sizeof(buf) - 1;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &sender;
+	msg.msg_namelen = sizeof(sender);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	
+	ssize_t len = recvmsg(mMonitorFd, &msg, 0);
+	
+	if(len == -1) {
+		// the socket buffer has overflowed and events have been lost
+		if(errno == ENOBUFS)
+			resyncDevices();
+		
+		return;
+	}
+	
+	buf[len] = 0;
+	
+	const char* props = buf;
+	const char* end = buf + len;
+	
+	if(len >= 24 && memcmp(buf, "libudev", 8) == 0) {
+		// a message of udev, which is only trusted, if it has been sent by root
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		
+		if(!cmsg || cmsg->cmsg_type != SCM_CREDENTIALS || ((struct ucred*) CMSG_DATA(cmsg))->uid != 0)
+			return;
+		
+		// the header is followed by the properties at the given offset
+		unsigned int offset, length;
+		memcpy(&offset, buf + 16, sizeof(offset));
+		memcpy(&length, buf + 20, sizeof(length));
+		
+		if(offset > (size_t) len || length > (size_t) len - offset)
+			return;
+		
+		props = buf + offset;
+		end = props + length;
+	}
+	else if(sender.nl_pid != 0) {
+		// kernel messages have no sender process
+		return;
+	}
+	
+	// the properties are null terminated KEY=value strings
+	std::string action, subsystem, devname;
+	
+	for(const char* p = props; p < end; p += strlen(p) + 1) {
+		if(strncmp(p, "ACTION=", 7) == 0)
+			action = p + 7;
+		else if(strncmp(p, "SUBSYSTEM=", 10) == 0)
+			subsystem = p + 10;
+		else if(strncmp(p, "DEVNAME=", 8) == 0)
+			devname = p + 8;
+	}
+	
+	// the kernel names the node relative to /dev, udev with its path
+	if(devname.compare(0, 5, "/dev/") == 0)
+		devname.erase(0, 5);
+	
+	if(subsystem != "video4linux" || !isVideoNode(devname.c_str()))
+		return;
+	
+	if(action == "add")
+		addDevice("/dev/" + devname);
+	else if(action == "remove")
+		removeDevice("/dev/" + devname);
+}
+
+void DeviceCollector::addDevice(const std::string& name)
+{
+	pthread_mutex_lock(&mUpdateLock);
+	bool known = hasDevice(name);
+	pthread_mutex_unlock(&mUpdateLock);
+	
+	if(known)
+		return;
+	
+	// probe without holding the lock, opening the node may take a while
+	V4L2_DeviceDescriptor* dd = new V4L2_DeviceDescriptor(name);
+	
+	if(!matchesFilter(mMonitorFilter, dd)) {
+		delete dd;
+		return;
+	}
+	
+	pthread_mutex_lock(&mUpdateLock);
+	
+	// queryDevices() may have found it meanwhile
+	if(hasDevice(name)) {
+		pthread_mutex_unlock(&mUpdateLock);
+		delete dd;
+		return;
+	}
+	
+	mDeviceList.push_back(dd);
+	publish();
+	
+	pthread_mutex_unlock(&mUpdateLock);
+	
+	logDebug("DeviceCollector: device added: " + name);
+	notifyListeners(dd, true);
+}
+
+void DeviceCollector::removeDevice(const std::string& name)
+{
+	pthread_mutex_lock(&mUpdateLock);
+	
+	DeviceList::iterator it = mDeviceList.begin();
+	
+	while(it != mDeviceList.end() && (*it)->getName() != name)
+		it++;
+	
+	if(it == mDeviceList.end()) {
+		pthread_mutex_unlock(&mUpdateLock);
+		return;
+	}
+	
+	DeviceDescriptor* dd = *it;
+	mDeviceList.erase(it);
+	int epoch = publish();
+	
+	pthread_mutex_unlock(&mUpdateLock);
+	
+	// no reader sees the descriptor anymore, when those of the old list have left
+	waitForReaders(epoch);
+	
+	logDebug("DeviceCollector: device removed: " + name);
+	notifyListeners(dd, false);
+	
+	// a device in use is deleted with the collector
+	pthread_mutex_lock(&mUpdateLock);
+	
+	if(dd->getDevice())
+		mRetired.push_back(dd);
+	else
+		delete dd;
+	
+	pthread_mutex_unlock(&mUpdateLock);
+}
+
+void DeviceCollector::waitForReaders(int epoch)
+{
+	// called by the monitor without the update lock, so readers may call testDevice() or queryDevices().
+	// Readers are short-lived, so polling is cheaper than making each of them signal a condition.
+	while(mReaders[epoch & 1] > 0)
+		usleep(1000);
+}
+
+void DeviceCollector::resyncDevices()
+{
+	// Compare the device list with the nodes, if hotplug events may have been missed.
+	std::vector<std::string> gone;
+	
+	pthread_mutex_lock(&mUpdateLock);
+	
+	for(DeviceList::const_iterator i = mDeviceList.begin(); i != mDeviceList.end(); i++) {
+		const std::string& name = (*i)->getName();
+		
+		if(name.compare(0, 10, "/dev/video") == 0 && access(name.c_str(), F_OK) != 0)
+			gone.push_back(name);
+	}
+	
+	pthread_mutex_unlock(&mUpdateLock);
+	
+	for(size_t i = 0; i < gone.size(); i++)
+		removeDevice(gone[i]);
+	
+	std::vector<std::string> nodes;
+	listVideoNodes(mMonitorFilter, nodes);
+	
+	for(size_t i = 0; i < nodes.size(); i++)
+		addDevice(nodes[i]);
+}
+
 #endif
 
 bool DeviceCollector::testDevice(const std::string& name)
 {
 #ifdef AVCAP_LINUX
+	pthread_mutex_lock(&mUpdateLock);
+	
+	size_t count = mDeviceList.size();
+	
 	// prefer V4L2-driver
-	if(test_V4L2_Device(name) == 0)
-		return true;
+	bool found = test_V4L2_Device(name) == 0 || test_V4L1_Device(name) == 0;
+	
+	if(mDeviceList.size() != count)
+		publish();
+	
+	pthread_mutex_unlock(&mUpdateLock);
+	
+	return found;
+#else
+	return false;
+#endif
+}
 
-	if(test_V4L1_Device(name) == 0)
-		return true;
+int DeviceCollector::startMonitor(const DeviceFilter& filter)
+{
+#ifdef AVCAP_LINUX
+	if(mMonitorThread)
+		return -1;
+	
+	mMonitorFilter = filter;
+	mMonitorInotify = false;
+	
+	// listen to the uevents of the kernel and of udev, which are sent after the permissions of the node are set
+	mMonitorFd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	
+	if(mMonitorFd != -1) {
+		struct sockaddr_nl addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.nl_family = AF_NETLINK;
+		addr.nl_groups = UEVENT_GROUP_KERNEL | UEVENT_GROUP_UDEV;
+		
+		// the credentials tell udev's messages from those of other processes
+		int on = 1;
+		
+		if(setsockopt(mMonitorFd, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on)) == -1 || 
+				bind(mMonitorFd, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+			close(mMonitorFd);
+			mMonitorFd = -1;
+		}
+	}
+	
+	// without netlink, e.g. in a container, watch the device nodes in /dev
+	if(mMonitorFd == -1) {
+		mMonitorInotify = true;
+		mMonitorFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+		
+		if(mMonitorFd != -1 && inotify_add_watch(mMonitorFd, "/dev", IN_CREATE | IN_DELETE | IN_ATTRIB) == -1) {
+			close(mMonitorFd);
+			mMonitorFd = -1;
+		}
+	}
+	
+	mStopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	
+	if(mMonitorFd == -1 || mStopFd == -1) {
+		logDebug(std::string("DeviceCollector: creating the hotplug monitor failed: ") + strerror(errno));
+		stopMonitor();
+		return -1;
+	}
+	
+	// create and start the thread
+	mMonitorThread = new pthread_t;
+	if(pthread_create(mMonitorThread, 0, (void* (*)(void*)) &DeviceCollector::monitor, (void*) this) != 0) {
+		logDebug("DeviceCollector: creating the monitor thread failed");
+		delete mMonitorThread;
+		mMonitorThread = 0;
+		stopMonitor();
+		return -1;
+	}
+	
+	return 0;
+#else
+	return -1;
 #endif
+}
 
-	return false;
+void DeviceCollector::stopMonitor()
+{
+#ifdef AVCAP_LINUX
+	if(mMonitorThread) {
+		eventfd_write(mStopFd, 1);
+		pthread_join(*mMonitorThread, 0);
+		delete mMonitorThread;
+		mMonitorThread = 0;
+	}
+	
+	if(mMonitorFd != -1)
+		close(mMonitorFd);
+	
+	if(mStopFd != -1)
+		close(mStopFd);
+	
+	mMonitorFd = mStopFd = -1;
+#endif
 }
 
 // OS X specific tests
@@ -0,0 +1,350 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+#ifndef _WIN32
+
+#include <unistd.h>
+#include <algorithm>
+
+#include "DispatchPool.h"
+#include "log.h"
+
+using namespace avcap;
+
+DispatchPool* DispatchPool::sShared = 0;
+pthread_mutex_t DispatchPool::sSharedLock = PTHREAD_MUTEX_INITIALIZER;
+
+// the worker of the calling thread, if it belongs to a pool
+static pthread_key_t sWorkerKey;
+
+// the strand whose task the calling thread is running
+static pthread_key_t sStrandKey;
+
+static void createWorkerKey()
+{
+	pthread_key_create(&sWorkerKey, 0);
+	pthread_key_create(&sStrandKey, 0);
+}
+
+// Construction & Destruction
+
+DispatchPool::DispatchPool():
+	mQueued(0),
+	mFinish(0),
+	mNext(0),
+	mRefs(0)
+{
+	pthread_mutex_init(&mLock, 0);
+	pthread_cond_init(&mCond, 0);
+}
+
+DispatchPool::~DispatchPool()
+{
+	pthread_cond_destroy(&mCond);
+	pthread_mutex_destroy(&mLock);
+}
+
+DispatchPool* DispatchPool::acquire(int threads)
+{
+	pthread_mutex_lock(&sSharedLock);
+	
+	if(sShared == 0) {
+		DispatchPool* pool = new DispatchPool();
+		
+		if(pool->start(threads) == -1) {
+			pthread_mutex_unlock(&sSharedLock);
+			pool->stop();
+			delete pool;
+			return 0;
+		}
+		
+		sShared = pool;
+	} else if(threads > 0 && threads != sShared->getNumThreads()) {
+		// the running pool can't be resized
+		logDebug("DispatchPool: the shared pool has another number of threads");
+		pthread_mutex_unlock(&sSharedLock);
+		return 0;
+	}
+	
+	DispatchPool* res = sShared;
+	res->mRefs++;
+	
+	pthread_mutex_unlock(&sSharedLock);
+	
+	return res;
+}
+
+void DispatchPool::release(DispatchPool* pool)
+{
+	if(pool == 0)
+		return;
+	
+	pthread_mutex_lock(&sSharedLock);
+	
+	if(--pool->mRefs > 0) {
+		pthread_mutex_unlock(&sSharedLock);
+		return;
+	}
+	
+	sShared = 0;
+	pthread_mutex_unlock(&sSharedLock);
+	
+	pool->stop();
+	delete pool;
+}
+
+int DispatchPool::start(int threads)
+{
+	// one thread per CPU by default
+	if(threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	
+	if(threads <= 0)
+		threads = 1;
+	
+	// the key tells the threads of the pool their worker
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, &createWorkerKey);
+	
+	for(int i = 0; i < threads; i++) {
+		Worker* worker = new Worker;
+		worker->pool = this;
+		worker->index = i;
+		pthread_mutex_init(&worker->lock, 0);
+		
+		if(pthread_create(&worker->thread, 0, &DispatchPool::run, worker) != 0) {
+			logDebug("DispatchPool: creating a thread failed");
+			pthread_mutex_destroy(&worker->lock);
+			delete worker;
+			break;
+		}
+		
+		mWorkers.push_back(worker);
+	}
+	
+	return mWorkers.empty() ? -1 : 0;
+}
+
+void DispatchPool::stop()
+{
+	pthread_mutex_lock(&mLock);
+	mFinish = 1;
+	pthread_cond_broadcast(&mCond);
+	pthread_mutex_unlock(&mLock);
+	
+	for(unsigned int i = 0; i < mWorkers.size(); i++) {
+		pthread_join(mWorkers[i]->thread, 0);
+		pthread_mutex_destroy(&mWorkers[i]->lock);
+		delete mWorkers[i];
+	}
+	
+	mWorkers.clear();
+}
+
+int DispatchPool::getNumThreads()
+{
+	return mWorkers.size();
+}
+
+void DispatchPool::post(DispatchTask* task)
+{
+	// keep tasks posted from a thread of the pool local, distribute the others
+	Worker* worker = (Worker*) pthread_getspecific(sWorkerKey);
+	
+	if(worker == 0 || worker->pool != this)
+		worker = mWorkers[__sync_fetch_and_add(&mNext, 1) % mWorkers.size()];
+	
+	pthread_mutex_lock(&worker->lock);
+	worker->tasks.push_back(task);
+	pthread_mutex_unlock(&worker->lock);
+	
+	// and wake up an idle thread, take() decrements the counter without the lock
+	pthread_mutex_lock(&mLock);
+	__sync_fetch_and_add(&mQueued, 1);
+	pthread_cond_signal(&mCond);
+	pthread_mutex_unlock(&mLock);
+}
+
+DispatchTask* DispatchPool::take(Worker* worker)
+{
+	DispatchTask* task = 0;
+	
+	// the oldest task of the own queue
+	pthread_mutex_lock(&worker->lock);
+	if(!worker->tasks.empty()) {
+		task = worker->tasks.front();
+		worker->tasks.pop_front();
+	}
+	pthread_mutex_unlock(&worker->lock);
+	
+	// or steal the newest task of another thread
+	for(unsigned int i = 1; task == 0 && i < mWorkers.size(); i++) {
+		Worker* victim = mWorkers[(worker->index + i) % mWorkers.size()];
+		
+		pthread_mutex_lock(&victim->lock);
+		if(!victim->tasks.empty()) {
+			task = victim->tasks.back();
+			victim->tasks.pop_back();
+		}
+		pthread_mutex_unlock(&victim->lock);
+	}
+	
+	if(task)
+		__sync_fetch_and_sub(&mQueued, 1);
+	
+	return task;
+}
+
+void* DispatchPool::run(void* arg)
+{
+	Worker* worker = (Worker*) arg;
+	DispatchPool* pool = worker->pool;
+	
+	pthread_setspecific(sWorkerKey, worker);
+	
+	while(!pool->mFinish) {
+		DispatchTask* task = pool->take(worker);
+		
+		if(task) {
+			task->run();
+			continue;
+		}
+		
+		// sleep until something has been posted
+		pthread_mutex_lock(&pool->mLock);
+		while(pool->mQueued == 0 && !pool->mFinish)
+			pthread_cond_wait(&pool->mCond, &pool->mLock);
+		pthread_mutex_unlock(&pool->mLock);
+	}
+	
+	return 0;
+}
+
+// DispatchStrand
+
+DispatchStrand::DispatchStrand(DispatchPool* pool, bool ordered):
+	mPool(pool),
+	mOrdered(ordered),
+	mScheduled(false),
+	mPending(0),
+	mWaiters(0)
+{
+	pthread_mutex_init(&mLock, 0);
+	pthread_cond_init(&mIdleCond, 0);
+}
+
+DispatchStrand::~DispatchStrand()
+{
+	wait();
+	
+	pthread_cond_destroy(&mIdleCond);
+	pthread_mutex_destroy(&mLock);
+}
+
+void DispatchStrand::post(DispatchTask* task)
+{
+	pthread_mutex_lock(&mLock);
+	mTasks.push_back(task);
+	mPending++;
+	
+	// an ordered strand is in the pool at most once
+	bool schedule = !mOrdered || !mScheduled;
+	mScheduled = true;
+	pthread_mutex_unlock(&mLock);
+	
+	if(schedule)
+		mPool->post(this);
+}
+
+void DispatchStrand::wait()
+{
+	pthread_mutex_lock(&mLock);
+	while(mPending > 0)
+		pthread_cond_wait(&mIdleCond, &mLock);
+	pthread_mutex_unlock(&mLock);
+}
+
+void DispatchStrand::wait(const void* object)
+{
+	// the caller's own task would never finish
+	if(pthread_getspecific(sStrandKey) == this)
+		return;
+	
+	pthread_mutex_lock(&mLock);
+	mWaiters++;
+	
+	while(true) {
+		bool used = false;
+		
+		for(unsigned int i = 0; i < mTasks.size() && !used; i++)
+			used = mTasks[i]->uses(object);
+		
+		for(unsigned int i = 0; i < mRunning.size() && !used; i++)
+			used = mRunning[i]->uses(object);
+		
+		if(!used)
+			break;
+		
+		pthread_cond_wait(&mIdleCond, &mLock);
+	}
+	
+	mWaiters--;
+	pthread_mutex_unlock(&mLock);
+}
+
+void DispatchStrand::run()
+{
+	pthread_mutex_lock(&mLock);
+	DispatchTask* task = mTasks.front();
+	mTasks.pop_front();
+	mRunning.push_back(task);
+	pthread_mutex_unlock(&mLock);
+	
+	void* outer = pthread_getspecific(sStrandKey);
+	pthread_setspecific(sStrandKey, this);
+	
+	task->run();
+	
+	pthread_setspecific(sStrandKey, outer);
+	
+	pthread_mutex_lock(&mLock);
+	mRunning.erase(std::find(mRunning.begin(), mRunning.end(), task));
+	
+	if(--mPending == 0 || mWaiters > 0)
+		pthread_cond_broadcast(&mIdleCond);
+	
+	// continue with the next task of an ordered strand
+	bool again = mOrdered && !mTasks.empty();
+	if(mOrdered && !again)
+		mScheduled = false;
+	
+	pthread_mutex_unlock(&mLock);
+	
+	delete task;
+	
+	if(again)
+		mPool->post(this);
+}
+
+#endif // _WIN32
@@ -183,6 +183,21 @@ int FormatManager::getFramerate()
 	return -1;
 }
 
+int FormatManager::setRegionOfInterest(const ImageRect& roi)
+{
+	return -1;
+}
+
+int FormatManager::getRegionOfInterest(ImageRect& roi)
+{
+	return -1;
+}
+
+int FormatManager::getCropBounds(ImageRect& bounds)
+{
+	return -1;
+}
+
 Format::~Format()
 {
 	// delete the resolution objects
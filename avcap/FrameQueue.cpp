@@ -0,0 +1,241 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "FrameQueue.h"
+#include "IOBuffer.h"
+
+using namespace avcap;
+
+// Construction & Destruction
+
+FrameQueue::FrameQueue(int depth, int max_held):
+	mDepth(depth > 0 ? depth : 1),
+	mMaxHeld(max_held > 0 ? max_held : 1),
+	mHeld(0),
+	mClosed(false),
+	mPolicy(CaptureManager::OVERLOAD_KEEP_NEWEST),
+	mDropped(0)
+{
+	pthread_mutex_init(&mLock, 0);
+	
+	// the timeouts don't change with the wall-clock time
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+#ifdef AVCAP_LINUX
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+	pthread_cond_init(&mCond, &attr);
+	pthread_cond_init(&mSpaceCond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+FrameQueue::~FrameQueue()
+{
+	flush();
+	
+	pthread_cond_destroy(&mSpaceCond);
+	pthread_cond_destroy(&mCond);
+	pthread_mutex_destroy(&mLock);
+}
+
+void FrameQueue::setLimits(int depth, int max_held)
+{
+	pthread_mutex_lock(&mLock);
+	mDepth = depth > 0 ? depth : 1;
+	mMaxHeld = max_held > 0 ? max_held : 1;
+	pthread_cond_broadcast(&mCond);
+	pthread_cond_broadcast(&mSpaceCond);
+	pthread_mutex_unlock(&mLock);
+}
+
+void FrameQueue::setPolicy(CaptureManager::OverloadPolicy policy)
+{
+	pthread_mutex_lock(&mLock);
+	mPolicy = policy;
+	pthread_cond_broadcast(&mSpaceCond);
+	pthread_mutex_unlock(&mLock);
+}
+
+unsigned long FrameQueue::getDropped()
+{
+	pthread_mutex_lock(&mLock);
+	unsigned long res = mDropped;
+	pthread_mutex_unlock(&mLock);
+	
+	return res;
+}
+
+void FrameQueue::resetDropped()
+{
+	pthread_mutex_lock(&mLock);
+	mDropped = 0;
+	pthread_mutex_unlock(&mLock);
+}
+
+void FrameQueue::handleCaptureEvent(IOBuffer* io_buf)
+{
+	IOBuffer* stale = 0;
+	
+	pthread_mutex_lock(&mLock);
+	
+	// let the capture thread wait, until the application has taken a frame
+	while(mPolicy == CaptureManager::OVERLOAD_BLOCK && !mClosed && (int) mFrames.size() >= mDepth)
+		pthread_cond_wait(&mSpaceCond, &mLock);
+	
+	if(mClosed) {
+		// capturing is being stopped, nobody will take the frame
+		stale = io_buf;
+	} else if((int) mFrames.size() >= mDepth && mPolicy == CaptureManager::OVERLOAD_DROP_NEWEST) {
+		// keep the queued frames and drop the new one
+		stale = io_buf;
+		mDropped++;
+	} else {
+		// drop the oldest frame, if the queue is full
+		if((int) mFrames.size() >= mDepth) {
+			stale = mFrames.front();
+			mFrames.pop_front();
+			mDropped++;
+		}
+		
+		mFrames.push_back(io_buf);
+		pthread_cond_signal(&mCond);
+	}
+	
+	pthread_mutex_unlock(&mLock);
+	
+	// give the stale frame back without holding the lock
+	if(stale)
+		stale->release();
+}
+
+IOBuffer* FrameQueue::pop(int timeout_ms)
+{
+	struct timespec deadline;
+	
+	// compute the absolute time to wait for
+	if(timeout_ms > 0) {
+#ifdef AVCAP_LINUX
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+#else
+		// the condition variables use the realtime clock
+		struct timeval now;
+		gettimeofday(&now, 0);
+		deadline.tv_sec = now.tv_sec;
+		deadline.tv_nsec = now.tv_usec * 1000;
+#endif
+		
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+		
+		if(deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+	
+	pthread_mutex_lock(&mLock);
+	
+	// wait for a frame, if the application may take one more
+	while(mFrames.empty() || mHeld >= mMaxHeld) {
+		int res = 0;
+		
+		if(mClosed)
+			res = ETIMEDOUT;
+		else if(timeout_ms == 0)
+			res = ETIMEDOUT;
+		else if(timeout_ms < 0)
+			res = pthread_cond_wait(&mCond, &mLock);
+		else
+			res = pthread_cond_timedwait(&mCond, &mLock, &deadline);
+		
+		if(res == ETIMEDOUT) {
+			pthread_mutex_unlock(&mLock);
+			return 0;
+		}
+	}
+	
+	IOBuffer* io_buf = mFrames.front();
+	mFrames.pop_front();
+	mHeld++;
+	
+	// the frame counts as held until it is released
+	io_buf->setPulled(true);
+	
+	// a blocked capture thread may continue
+	pthread_cond_signal(&mSpaceCond);
+	
+	pthread_mutex_unlock(&mLock);
+	
+	return io_buf;
+}
+
+void FrameQueue::frameReleased()
+{
+	pthread_mutex_lock(&mLock);
+	
+	if(mHeld > 0)
+		mHeld--;
+	
+	pthread_cond_signal(&mCond);
+	pthread_mutex_unlock(&mLock);
+}
+
+void FrameQueue::flush()
+{
+	FrameList_t frames;
+	
+	pthread_mutex_lock(&mLock);
+	frames.swap(mFrames);
+	pthread_cond_broadcast(&mSpaceCond);
+	pthread_mutex_unlock(&mLock);
+	
+	// release the frames nobody has taken
+	for(FrameList_t::iterator it = frames.begin(); it != frames.end(); it++)
+		(*it)->release();
+}
+
+void FrameQueue::close()
+{
+	pthread_mutex_lock(&mLock);
+	mClosed = true;
+	pthread_cond_broadcast(&mCond);
+	pthread_mutex_unlock(&mLock);
+	
+	flush();
+}
+
+void FrameQueue::open()
+{
+	pthread_mutex_lock(&mLock);
+	mClosed = false;
+	pthread_mutex_unlock(&mLock);
+}
+
+#endif // _WIN32
@@ -26,14 +26,34 @@
 
 using namespace avcap;
 
+// add to an integer atomically and return the new value
+static inline int atomicAdd(volatile int* value, int delta)
+{
+#ifdef _WIN32
+	return InterlockedExchangeAdd((volatile LONG*) value, delta) + delta;
+#else
+	return __sync_add_and_fetch(value, delta);
+#endif
+}
+
 // Construction & Destruction
 
 IOBuffer::IOBuffer(CaptureManager* mgr, void *ptr, size_t size, int index)
-		: mMgr(mgr), mPtr(ptr), mSize(size), mIndex(index), mSequence(0), mValid(0)
+		: mMgr(mgr), mPtr(ptr), mSize(size), mIndex(index), mSequence(0), mValid(0), mTimestampNs(0), mClock(TIMESTAMP_UNKNOWN), mNumPlanes(1), mNext(0), mRefs(0), mPulled(false)
 {
 	mState = STATE_UNUSED;
-	mTimestamp.tv_sec = 0;
-	mTimestamp.tv_usec = 0;
+	
+	for(int i = 0; i < MAX_PLANES; i++) {
+		mPlanePtr[i] = 0;
+		mPlaneStride[i] = 0;
+		mPlaneSize[i] = 0;
+		mDmaBufFd[i] = -1;
+		mPlaneOffset[i] = 0;
+	}
+	
+	// by default the buffer is a single plane
+	mPlanePtr[0] = ptr;
+	mPlaneSize[0] = size;
 }
 
 IOBuffer::~IOBuffer()
@@ -44,24 +64,86 @@ void IOBuffer::setParams(const size_t v, State state, struct timeval &tv, int se
 {
 	mValid = v; 
 	mState = state;
-	mTimestamp.tv_sec = tv.tv_sec; 
-	mTimestamp.tv_usec = tv.tv_usec;
+	mTimestampNs = (long long) tv.tv_sec * 1000000000LL + (long long) tv.tv_usec * 1000LL;
+	mClock = TIMESTAMP_UNKNOWN;
+	mSequence = seq; 
+}
+
+void IOBuffer::setParams(const size_t v, State state, long long ns, TimestampClock clock, int seq)
+{
+	mValid = v; 
+	mState = state;
+	mTimestampNs = ns;
+	mClock = clock;
 	mSequence = seq; 
 }
 
+void IOBuffer::setTimestamp(long long ns, TimestampClock clock)
+{
+	mTimestampNs = ns;
+	mClock = clock;
+}
+
+void IOBuffer::setNumPlanes(int num)
+{
+	if(num < 1 || num > MAX_PLANES)
+		return;
+	
+	mNumPlanes = num;
+}
+
+void IOBuffer::setPlane(int plane, void* ptr, size_t stride, size_t size)
+{
+	if(plane < 0 || plane >= MAX_PLANES)
+		return;
+	
+	mPlanePtr[plane] = ptr;
+	mPlaneStride[plane] = stride;
+	mPlaneSize[plane] = size;
+}
+
+void IOBuffer::setDmaBuf(int plane, int fd, size_t offset)
+{
+	if(plane < 0 || plane >= MAX_PLANES)
+		return;
+	
+	mDmaBufFd[plane] = fd;
+	mPlaneOffset[plane] = offset;
+}
+
+bool IOBuffer::changeState(State from, State to)
+{
+#ifdef _WIN32
+	return InterlockedCompareExchange((volatile LONG*) &mState, to, from) == from;
+#else
+	return __sync_bool_compare_and_swap(&mState, (int) from, (int) to);
+#endif
+}
+
 void IOBuffer::release()
 {
+	// wait for the last consumer, surplus releases are ignored
+	if(atomicAdd(&mRefs, -1) != 0)
+		return;
+	
 	// enqueue the buffer in the capture-managers unused-buffer queue
 	if(mMgr)
-		mMgr->enqueue(this);
+		mMgr->recycle(this);
+}
+
+void IOBuffer::addRef()
+{
+	atomicAdd(&mRefs, 1);
+}
+
+void IOBuffer::setRefCount(int refs)
+{
+	mRefs = refs;
 }
 
 unsigned long IOBuffer::getTimestamp()
 { 
-	unsigned long res = (unsigned long)((double) mTimestamp.tv_sec*1000.0f);
-	res += (unsigned long) ((double) mTimestamp.tv_usec/1000.0f);
-
-	return res; 
+	return (unsigned long) (mTimestampNs / 1000000LL); 
 }
 
 
@@ -0,0 +1,160 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+
+#include <string.h>
+#include <stdint.h>
+
+#include "StreamCopy.h"
+
+// the intrinsics can be used in functions compiled for another target since gcc 4.9
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+# define USE_STREAM_LOADS
+# include <immintrin.h>
+#endif
+
+using namespace avcap;
+
+#ifdef USE_STREAM_LOADS
+
+__attribute__((target("sse4.1")))
+static void copySSE41(char* dst, const char* src, size_t size)
+{
+	// the streaming loads need an aligned source
+	size_t head = (16 - ((uintptr_t) src & 15)) & 15;
+	head = head < size ? head : size;
+	memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	size -= head;
+	
+	// order the loads after the writes of the device
+	_mm_mfence();
+	
+	// load a complete cache line before storing it, so the line buffer is reused
+	for(; size >= 64; size -= 64, src += 64, dst += 64) {
+		__m128i a = _mm_stream_load_si128((__m128i*) src);
+		__m128i b = _mm_stream_load_si128((__m128i*) (src + 16));
+		__m128i c = _mm_stream_load_si128((__m128i*) (src + 32));
+		__m128i d = _mm_stream_load_si128((__m128i*) (src + 48));
+		
+		_mm_storeu_si128((__m128i*) dst, a);
+		_mm_storeu_si128((__m128i*) (dst + 16), b);
+		_mm_storeu_si128((__m128i*) (dst + 32), c);
+		_mm_storeu_si128((__m128i*) (dst + 48), d);
+	}
+	
+	memcpy(dst, src, size);
+}
+
+__attribute__((target("avx2")))
+static void copyAVX2(char* dst, const char* src, size_t size)
+{
+	size_t head = (32 - ((uintptr_t) src & 31)) & 31;
+	head = head < size ? head : size;
+	memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	size -= head;
+	
+	_mm_mfence();
+	
+	for(; size >= 128; size -= 128, src += 128, dst += 128) {
+		__m256i a = _mm256_stream_load_si256((__m256i*) src);
+		__m256i b = _mm256_stream_load_si256((__m256i*) (src + 32));
+		__m256i c = _mm256_stream_load_si256((__m256i*) (src + 64));
+		__m256i d = _mm256_stream_load_si256((__m256i*) (src + 96));
+		
+		_mm256_storeu_si256((__m256i*) dst, a);
+		_mm256_storeu_si256((__m256i*) (dst + 32), b);
+		_mm256_storeu_si256((__m256i*) (dst + 64), c);
+		_mm256_storeu_si256((__m256i*) (dst + 96), d);
+	}
+	
+	// avoid the penalty of mixing AVX and SSE code in the caller
+	_mm256_zeroupper();
+	
+	memcpy(dst, src, size);
+}
+
+static StreamCopy::Method detectMethod()
+{
+	__builtin_cpu_init();
+	
+	if(__builtin_cpu_supports("avx2"))
+		return StreamCopy::METHOD_AVX2;
+	
+	if(__builtin_cpu_supports("sse4.1"))
+		return StreamCopy::METHOD_SSE41;
+	
+	return StreamCopy::METHOD_MEMCPY;
+}
+
+#else
+
+static StreamCopy::Method detectMethod()
+{
+	return StreamCopy::METHOD_MEMCPY;
+}
+
+#endif
+
+StreamCopy::Method StreamCopy::getMethod()
+{
+	// the detection is repeated by concurrent first calls, with the same result
+	static volatile int method = -1;
+	
+	if(method == -1)
+		method = detectMethod();
+	
+	return (Method) method;
+}
+
+const char* StreamCopy::getMethodName()
+{
+	static const char* names[] = { "memcpy", "SSE4.1", "AVX2" };
+	
+	return names[getMethod()];
+}
+
+void StreamCopy::copy(void* dst, const void* src, size_t size)
+{
+	switch(getMethod())
+	{
+#ifdef USE_STREAM_LOADS
+		case METHOD_AVX2:
+			copyAVX2((char*) dst, (const char*) src, size);
+		break;
+		
+		case METHOD_SSE41:
+			copySSE41((char*) dst, (const char*) src, size);
+		break;
+#endif
+		
+		default:
+			memcpy(dst, src, size);
+		break;
+	}
+}
@@ -40,37 +40,31 @@ AVC_Reader::AVC_Reader(AVC_VidCapManager* cap_mgr, AVC_FormatManager* fmt_mgr, i
 	iec61883Reader(port, channel),
 	mVidCapMgr(cap_mgr),
 	mFormatMgr(fmt_mgr),
-	mCaptureHandler(0),
 	mSequence(1),
 	mAvailableBuffers(num_bufs)
 {
+	pthread_mutex_init(&mLock, 0);
+	
 	// create the buffers
 	size_t size = mFormatMgr->getImageSize();
 	for(int i = 0; i < num_bufs; i++) {
 		char* ptr = new char[size];
 		IOBuffer* io_buf = new IOBuffer(mVidCapMgr, ptr, size, i);
-		mBuffers.push_back(io_buf);
+		mBuffers.insert(io_buf);
+		mBuffers.pushFree(io_buf);
 	}
 }
 
 AVC_Reader::~AVC_Reader()
 {
 	// delete the buffers
-	for(BufferList_t::iterator i = mBuffers.begin(); i != mBuffers.end(); i++) {
-		IOBuffer* io_buf = *i;
+	for(int i = 0; i < mBuffers.size(); i++) {
+		IOBuffer* io_buf = mBuffers.find(i);
 		delete[] (char*) io_buf->getPtr();
 		delete io_buf;
 	}
-}
-
-void AVC_Reader::registerCaptureHandler(CaptureHandler *handler)
-{
-	mCaptureHandler = handler;
-}
-
-void AVC_Reader::removeCaptureHandler()
-{
-	mCaptureHandler = 0;
+	
+	pthread_mutex_destroy(&mLock);
 }
 
 void AVC_Reader::TriggerAction()
@@ -87,16 +81,15 @@ void AVC_Reader::TriggerAction()
 		return;
 	}
 	
-	// find a free IOBuffer
-	IOBuffer* io_buf = 0;
-	for(BufferList_t::iterator i = mBuffers.begin(); i != mBuffers.end(); i++) {
-		IOBuffer* tmp_buf = *i;
-		
-		if(tmp_buf->getState() == IOBuffer::STATE_UNUSED)  {
-			io_buf = tmp_buf;
-			break;
-		}
+	// take a free IOBuffer, buffers are returned from other threads
+	pthread_mutex_lock(&mLock);
+	IOBuffer* io_buf = mBuffers.popFree();
+	
+	if(io_buf) {
+		io_buf->setState(IOBuffer::STATE_USED);
+		mAvailableBuffers--;
 	}
+	pthread_mutex_unlock(&mLock);
 	
 	// decode the frame according to the desired format
 	if(io_buf) {
@@ -107,15 +100,19 @@ void AVC_Reader::TriggerAction()
 			frame->ExtractRGB(io_buf->getPtr());
 		}
 
-		// add time-stamp and sequence
+		// add time-stamp and sequence, the frame is complete now
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		
 		timeval tv;
-		gettimeofday(&tv, 0);
+		tv.tv_sec = ts.tv_sec;
+		tv.tv_usec = ts.tv_nsec / 1000;
 		io_buf->setParams(mFormatMgr->getImageSize(), IOBuffer::STATE_USED, tv, mSequence++);
-		mAvailableBuffers--;
+		io_buf->setTimestamp((long long) ts.tv_sec * 1000000000LL + ts.tv_nsec, IOBuffer::TIMESTAMP_MONOTONIC);
 		
-		// call the capture-handler
-		if(mCaptureHandler)
-			mCaptureHandler->handleCaptureEvent(io_buf);
+		// call the capture-handlers or reuse the buffer, if there is none
+		if(mVidCapMgr->deliver(io_buf) == 0)
+			enqueue(io_buf);
 	}
 	
 	// and release the frame
@@ -125,8 +122,18 @@ void AVC_Reader::TriggerAction()
 void AVC_Reader::enqueue(IOBuffer* io_buf)
 {
 	// we got back a buffer, so mark it unused
+	pthread_mutex_lock(&mLock);
+	
+	// a buffer must not be put on the free-list twice
+	if(io_buf->getState() == IOBuffer::STATE_UNUSED) {
+		pthread_mutex_unlock(&mLock);
+		return;
+	}
+	
 	io_buf->setState(IOBuffer::STATE_UNUSED);
+	mBuffers.pushFree(io_buf);
 	mAvailableBuffers++;
+	pthread_mutex_unlock(&mLock);
 }
 
 #endif // HAS_AVC_SUPPORT
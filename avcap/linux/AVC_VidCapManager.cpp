@@ -77,6 +77,7 @@ int AVC_VidCapManager::init()
 		// and create the reader
 		int channel = mConnection->GetChannel();
 		mReader = new AVC_Reader( this, mFormatMgr, port, channel, mNumBufs);
+		mReader->SetThreadParams(mThreadParams);
 	}
 	
 	return 0;
@@ -99,6 +100,7 @@ int AVC_VidCapManager::startCapture()
 {
 	// Guess what it does.
 	mFormatMgr->flush();
+	openFrames();
 	mReader->StartThread();
 	
 	return 0;
@@ -106,7 +108,12 @@ int AVC_VidCapManager::startCapture()
 
 int AVC_VidCapManager::stopCapture()
 {
+	// give back the frames queued for nextFrame(), before waiting for the reader
+	flushFrames();
+	
 	mReader->StopThread();		
+	waitDispatched();
+	
 	return 0;
 }
 
@@ -124,22 +131,33 @@ IOBuffer* AVC_VidCapManager::dequeue()
 	return 0;
 }
 
-void AVC_VidCapManager::registerCaptureHandler(CaptureHandler *handler) 
+		
+int AVC_VidCapManager::getNumIOBuffers()
 {
-	// pass the registration to the reader
-	mReader->registerCaptureHandler(handler);
-	CaptureManager::registerCaptureHandler(handler);
+	return mReader->getNumIOBuffers();
 }
 
-void AVC_VidCapManager::removeCaptureHandler() 
+int AVC_VidCapManager::setCaptureThreadPriority(SchedPolicy policy, int priority)
 {
-	mReader->removeCaptureHandler(); 
-	CaptureManager::removeCaptureHandler();
+	if(mThreadParams.setPriority(policy, priority) == -1)
+		return -1;
+	
+	// the reader applies it to its thread
+	if(mReader && !mReader->SetThreadParams(mThreadParams))
+		return -1;
+	
+	return 0;
 }
-		
-int AVC_VidCapManager::getNumIOBuffers()
+
+int AVC_VidCapManager::setCaptureThreadAffinity(const int* cpus, int count)
 {
-	return mReader->getNumIOBuffers();
+	if(mThreadParams.setAffinity(cpus, count) == -1)
+		return -1;
+	
+	if(mReader && !mReader->SetThreadParams(mThreadParams))
+		return -1;
+	
+	return 0;
 }
 
 #endif // HAS_AVC_SUPPORT
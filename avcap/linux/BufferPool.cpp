@@ -0,0 +1,191 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "BufferPool.h"
+#include "CaptureManager.h"
+#include "log.h"
+
+using namespace avcap;
+
+// from <numaif.h>, which is part of libnuma
+#ifndef MPOL_BIND
+# define MPOL_BIND		2
+#endif
+
+#ifndef MPOL_MF_MOVE
+# define MPOL_MF_MOVE	(1 << 1)
+#endif
+
+// Construction & Destruction
+
+BufferPool::BufferPool():
+	mBase(0),
+	mLength(0),
+	mBufSize(0),
+	mCount(0),
+	mHugePages(false)
+{
+}
+
+BufferPool::~BufferPool()
+{
+	free();
+}
+
+int BufferPool::allocate(size_t size, int count, int flags, int node)
+{
+	// drop a previous allocation
+	free();
+	
+	if(size == 0 || count <= 0)
+		return -1;
+	
+	// every buffer starts at a page boundary
+	size_t page = sysconf(_SC_PAGESIZE);
+	mBufSize = (size + page - 1) & ~(page - 1);
+	size_t length = mBufSize * count;
+
+	if(flags & CaptureManager::ALLOC_HUGEPAGES) {
+		// the mapping must be a multiple of the hugepage size
+		size_t huge_len = (length + HUGEPAGE_SIZE - 1) & ~((size_t) HUGEPAGE_SIZE - 1);
+
+#ifdef MAP_HUGETLB
+		// try the reserved hugetlbfs-pool first
+		void *ptr = mmap(0, huge_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(ptr != MAP_FAILED) {
+			mBase = ptr;
+			mLength = huge_len;
+			mHugePages = true;
+		} else {
+			logDebug(std::string("BufferPool: no hugetlbfs-pages available: ") + strerror(errno));
+		}
+#endif
+		
+		if(!mBase) {
+			// fall back to transparent hugepages. Allocate one hugepage more than needed
+			// and trim the mapping, so that it starts at a hugepage boundary. 
+			void *ptr = mmap(0, huge_len + HUGEPAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if(ptr != MAP_FAILED) {
+				uintptr_t addr = (uintptr_t) ptr;
+				uintptr_t start = (addr + HUGEPAGE_SIZE - 1) & ~((uintptr_t) HUGEPAGE_SIZE - 1);
+				size_t head = start - addr;
+				
+				if(head)
+					munmap(ptr, head);
+				if(HUGEPAGE_SIZE - head)
+					munmap((void*) (start + huge_len), HUGEPAGE_SIZE - head);
+				
+				mBase = (void*) start;
+				mLength = huge_len;
+#ifdef MADV_HUGEPAGE
+				mHugePages = madvise(mBase, mLength, MADV_HUGEPAGE) == 0;
+#endif
+			}
+		}
+	}
+
+	// use normal pages
+	if(!mBase) {
+		void *ptr = mmap(0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(ptr == MAP_FAILED) {
+			logDebug(std::string("BufferPool: mmap failed: ") + strerror(errno));
+			mBufSize = 0;
+			return -1;
+		}
+		
+		mBase = ptr;
+		mLength = length;
+	}
+	
+	mCount = count;
+
+	// the pages are placed on the node, when they are touched the first time
+	if(node >= 0)
+		bind(node);
+
+	if(flags & CaptureManager::ALLOC_PREFAULT)
+		prefault();
+
+	return 0;
+}
+
+void BufferPool::free()
+{
+	if(mBase)
+		munmap(mBase, mLength);
+	
+	mBase = 0;
+	mLength = 0;
+	mBufSize = 0;
+	mCount = 0;
+	mHugePages = false;
+}
+
+void* BufferPool::getBuffer(int i) const
+{
+	if(i < 0 || i >= mCount)
+		return 0;
+	
+	return (char*) mBase + i*mBufSize;
+}
+
+void BufferPool::bind(int node)
+{
+	// use the system call directly, so we don't depend on libnuma
+#ifdef SYS_mbind
+	unsigned long mask[16];
+	const int bits = 8 * sizeof(unsigned long);
+	
+	if(node >= (int) (8 * sizeof(mask)) - 1) {
+		logDebug("BufferPool: invalid NUMA node");
+		return;
+	}
+	
+	memset(mask, 0, sizeof(mask));
+	mask[node / bits] = 1UL << (node % bits);
+	
+	if(syscall(SYS_mbind, mBase, mLength, MPOL_BIND, mask, 8 * sizeof(mask), MPOL_MF_MOVE) == -1)
+		logDebug(std::string("BufferPool: binding the memory to the NUMA node failed: ") + strerror(errno));
+#else
+	logDebug("BufferPool: NUMA binding not supported");
+#endif
+}
+
+void BufferPool::prefault()
+{
+	// touch every page once, so that the kernel backs the whole pool with memory
+	// before the first frame arrives
+	size_t page = sysconf(_SC_PAGESIZE);
+	volatile char *ptr = (volatile char*) mBase;
+	
+	for(size_t offset = 0; offset < mLength; offset += page)
+		ptr[offset] = 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+#include "BufferTable.h"
+#include "IOBuffer.h"
+
+using namespace avcap;
+
+// Construction & Destruction
+
+BufferTable::BufferTable()
+{
+}
+
+BufferTable::~BufferTable()
+{
+}
+
+void BufferTable::insert(IOBuffer* buf)
+{
+	int index = buf->getIndex();
+	
+	if(index < 0)
+		return;
+	
+	// grow the table, the slots in between stay empty
+	if(index >= (int) mBuffers.size())
+		mBuffers.resize(index + 1, 0);
+	
+	mBuffers[index] = buf;
+}
+
+void BufferTable::remove(int index)
+{
+	if(index >= 0 && index < (int) mBuffers.size())
+		mBuffers[index] = 0;
+}
+
+IOBuffer* BufferTable::popFree()
+{
+	// skip the indices of buffers that have been removed in between
+	while(!mFree.empty()) {
+		IOBuffer* buf = find(mFree.back());
+		mFree.pop_back();
+		
+		if(buf)
+			return buf;
+	}
+	
+	return 0;
+}
+
+void BufferTable::pushFree(IOBuffer* buf)
+{
+	mFree.push_back(buf->getIndex());
+}
+
+int BufferTable::getUsedCount() const
+{
+	int res = 0;
+	
+	for(std::vector<IOBuffer*>::const_iterator it = mBuffers.begin(); it != mBuffers.end(); it++)
+		if(*it && (*it)->getState() == IOBuffer::STATE_USED)
+			res++;
+	
+	return res;
+}
+
+void BufferTable::clear()
+{
+	mBuffers.clear();
+	mFree.clear();
+}
@@ -0,0 +1,394 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "CaptureReactor.h"
+#include "log.h"
+
+using namespace avcap;
+
+pthread_mutex_t CaptureReactor::sSharedLock = PTHREAD_MUTEX_INITIALIZER;
+CaptureReactor* CaptureReactor::sShared[MAX_SHARED] = { 0 };
+
+// Construction & Destruction
+
+CaptureReactor::CaptureReactor(int group):
+	mGroup(group),
+	mRefs(0),
+	mEpollFd(-1),
+	mStopFd(-1),
+	mThread(0),
+	mHaveStartCpus(false),
+	mFinish(0),
+	mDeleteOnExit(false)
+{
+	// the lock is held while the clients are dispatched, so clients can be detached
+	// from within their handlers
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&mLock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+CaptureReactor::~CaptureReactor()
+{
+	// delete the remaining entries
+	for(EntryList::iterator it = mEntries.begin(); it != mEntries.end(); it++)
+		delete *it;
+	
+	mEntries.clear();
+	
+	if(mEpollFd != -1)
+		close(mEpollFd);
+	
+	if(mStopFd != -1)
+		close(mStopFd);
+	
+	delete mThread;
+	
+	pthread_mutex_destroy(&mLock);
+}
+
+CaptureReactor* CaptureReactor::acquire(int group)
+{
+	CaptureReactor* reactor = 0;
+	
+	// a private reactor
+	if(group < 0) {
+		reactor = new CaptureReactor(-1);
+		
+		if(reactor->start() == -1) {
+			delete reactor;
+			return 0;
+		}
+		
+		reactor->mRefs = 1;
+		return reactor;
+	}
+	
+	// otherwise look for the shared one and create it on first use
+	if(group >= MAX_SHARED)
+		return 0;
+	
+	pthread_mutex_lock(&sSharedLock);
+	reactor = sShared[group];
+	
+	if(reactor == 0) {
+		reactor = new CaptureReactor(group);
+		
+		if(reactor->start() == -1) {
+			pthread_mutex_unlock(&sSharedLock);
+			delete reactor;
+			return 0;
+		}
+		
+		sShared[group] = reactor;
+	}
+	
+	reactor->mRefs++;
+	pthread_mutex_unlock(&sSharedLock);
+	
+	return reactor;
+}
+
+void CaptureReactor::release(CaptureReactor* reactor)
+{
+	if(reactor == 0)
+		return;
+	
+	// shared reactors keep running as long as they are used
+	if(reactor->mGroup >= 0) {
+		pthread_mutex_lock(&sSharedLock);
+		
+		if(--reactor->mRefs > 0) {
+			pthread_mutex_unlock(&sSharedLock);
+			return;
+		}
+		
+		sShared[reactor->mGroup] = 0;
+		pthread_mutex_unlock(&sSharedLock);
+	}
+	
+	// the reactor deletes itself, if it is released from its own thread 
+	if(reactor->stop())
+		delete reactor;
+}
+
+int CaptureReactor::start()
+{
+	// create the descriptors the reactor waits on
+	mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+	mStopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	
+	if(mEpollFd == -1 || mStopFd == -1) {
+		logDebug(std::string("CaptureReactor: creating poll descriptors failed: ") + strerror(errno));
+		return -1;
+	}
+	
+	// the internal wakeup handle is tagged with a null pointer
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = 0;
+	
+	if(epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mStopFd, &ev) == -1)
+		return -1;
+	
+	// create and start the thread
+	mThread = new pthread_t;
+	if(pthread_create(mThread, 0, (void* (*)(void*)) &CaptureReactor::run, (void*) this) != 0) {
+		logDebug("CaptureReactor: creating the reactor thread failed");
+		delete mThread;
+		mThread = 0;
+		return -1;
+	}
+	
+	// remember the affinity inherited by the thread, so it can be restored by configure()
+	mHaveStartCpus = pthread_getaffinity_np(*mThread, sizeof(mStartCpus), &mStartCpus) == 0;
+	
+	return 0;
+}
+
+bool CaptureReactor::stop()
+{
+	// stop the thread and return true, if the reactor can be deleted
+	if(mThread == 0)
+		return true;
+	
+	pthread_mutex_lock(&mLock);
+	mFinish = 1;
+	eventfd_write(mStopFd, 1);
+	pthread_mutex_unlock(&mLock);
+	
+	// we can't wait for ourself, so let the thread clean up when it leaves the loop
+	if(pthread_equal(pthread_self(), *mThread)) {
+		pthread_detach(*mThread);
+		mDeleteOnExit = true;
+		return false;
+	}
+	
+	pthread_join(*mThread, 0);
+	
+	return true;
+}
+
+int CaptureReactor::attach(ReactorClient* client)
+{
+	Entry* entry = new Entry;
+	
+	entry->client = client;
+	entry->deviceSource.entry = entry;
+	entry->deviceSource.device = true;
+	entry->wakeupSource.entry = entry;
+	entry->wakeupSource.device = false;
+	entry->watched = 0;
+	entry->error = false;
+	entry->dead = false;
+	
+	// the wakeup handle of the client is polled all the time
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &entry->wakeupSource;
+	
+	pthread_mutex_lock(&mLock);
+	
+	if(epoll_ctl(mEpollFd, EPOLL_CTL_ADD, client->getWakeupHandle(), &ev) == -1) {
+		pthread_mutex_unlock(&mLock);
+		logDebug(std::string("CaptureReactor: attaching client failed: ") + strerror(errno));
+		delete entry;
+		return -1;
+	}
+	
+	mEntries.push_back(entry);
+	pthread_mutex_unlock(&mLock);
+	
+	// let the reactor evaluate the new client
+	eventfd_write(mStopFd, 1);
+	
+	return 0;
+}
+
+void CaptureReactor::detach(ReactorClient* client)
+{
+	// the lock waits for a running dispatch, so the client isn't called anymore afterwards
+	pthread_mutex_lock(&mLock);
+	
+	for(EntryList::iterator it = mEntries.begin(); it != mEntries.end(); it++) {
+		Entry* entry = *it;
+		
+		if(entry->client != client || entry->dead)
+			continue;
+		
+		// remove the handles before the client closes them
+		watch(entry, 0);
+		epoll_ctl(mEpollFd, EPOLL_CTL_DEL, client->getWakeupHandle(), 0);
+		
+		// pending events may still refer to the entry, so the reactor thread deletes it later
+		entry->dead = true;
+	}
+	
+	pthread_mutex_unlock(&mLock);
+	
+	eventfd_write(mStopFd, 1);
+}
+
+int CaptureReactor::configure(const ThreadParams& params)
+{
+	if(params.isDefault() || mThread == 0)
+		return 0;
+	
+	return params.apply(*mThread, mHaveStartCpus ? &mStartCpus : 0);
+}
+
+void CaptureReactor::watch(Entry* entry, unsigned int events)
+{
+	// add, change or remove the device handle in the set of polled descriptors. The handle can't 
+	// be kept in the set all the time, because drivers signal an error while no buffer is queued.
+	if(events == entry->watched)
+		return;
+	
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = &entry->deviceSource;
+	
+	int op = EPOLL_CTL_MOD;
+	if(events == 0)
+		op = EPOLL_CTL_DEL;
+	else if(entry->watched == 0)
+		op = EPOLL_CTL_ADD;
+	
+	int fd = entry->client->getPollHandle();
+	if(epoll_ctl(mEpollFd, op, fd, &ev) == 0)
+		entry->watched = events;
+}
+
+void CaptureReactor::purge()
+{
+	// delete the entries of detached clients
+	EntryList::iterator it = mEntries.begin();
+	
+	while(it != mEntries.end()) {
+		if((*it)->dead) {
+			delete *it;
+			it = mEntries.erase(it);
+		} else {
+			it++;
+		}
+	}
+}
+
+void CaptureReactor::run(void* arg)
+{
+	// reactor main loop
+
+	CaptureReactor* reactor = (CaptureReactor*) arg;
+	struct epoll_event events[MAX_EVENTS];
+	
+	// run the loop until finish flag is set
+	while(!reactor->mFinish) {
+		pthread_mutex_lock(&reactor->mLock);
+		
+		// no events are pending, so the entries of detached clients can be deleted
+		reactor->purge();
+		
+		// watch the devices of clients which can receive data or events
+		for(EntryList::iterator it = reactor->mEntries.begin(); it != reactor->mEntries.end(); it++) {
+			Entry* entry = *it;
+			unsigned int events = 0;
+			
+			if(!entry->error) {
+				events |= entry->client->wantsPoll() ? EPOLLIN : 0;
+				events |= entry->client->wantsEvents() ? EPOLLPRI : 0;
+			}
+			
+			reactor->watch(entry, events);
+		}
+		
+		pthread_mutex_unlock(&reactor->mLock);
+
+		int n = epoll_wait(reactor->mEpollFd, events, MAX_EVENTS, -1);
+
+		// an error occured
+		if (-1 == n) {
+			if (EINTR == errno)
+				continue;
+			
+			logDebug(std::string("CaptureReactor: epoll_wait failed: ") + strerror(errno));
+			break;
+		}
+		
+		// dispatch the events
+		pthread_mutex_lock(&reactor->mLock);
+		
+		for(int i = 0; i < n && !reactor->mFinish; i++) {
+			Source* source = (Source*) events[i].data.ptr;
+			eventfd_t value;
+			
+			// the internal wakeup handle
+			if(source == 0) {
+				eventfd_read(reactor->mStopFd, &value);
+				continue;
+			}
+			
+			// skip clients that have been detached in between
+			Entry* entry = source->entry;
+			if(entry->dead)
+				continue;
+			
+			if(!source->device) {
+				// reset the wakeup counter and give the client the chance to do its work
+				eventfd_read(entry->client->getWakeupHandle(), &value);
+				entry->error = false;
+				entry->client->handleReady(false);
+			} else {
+				// the driver has queued events, the client may restart itself in between
+				if(events[i].events & EPOLLPRI) {
+					entry->client->handleEvents();
+					
+					if(entry->dead || !(events[i].events & ~EPOLLPRI))
+						continue;
+				}
+				
+				if(!entry->client->handleReady(true) && (events[i].events & (EPOLLERR | EPOLLHUP))) {
+					// the device reports an error but has no data, so don't poll it again 
+					// before the client wakes up the reactor
+					entry->error = true;
+				}
+			}
+		}
+		
+		pthread_mutex_unlock(&reactor->mLock);
+	}
+	
+	if(reactor->mDeleteOnExit)
+		delete reactor;
+}
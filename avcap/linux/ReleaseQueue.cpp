@@ -0,0 +1,74 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+#include "ReleaseQueue.h"
+#include "IOBuffer.h"
+
+using namespace avcap;
+
+// Construction & Destruction
+
+ReleaseQueue::ReleaseQueue():
+	mHead(0)
+{
+}
+
+ReleaseQueue::~ReleaseQueue()
+{
+}
+
+void ReleaseQueue::push(IOBuffer* buf)
+{
+	// put the buffer on top of the stack
+	IOBuffer* head;
+	
+	do {
+		head = mHead;
+		buf->setNext(head);
+	} while(!__sync_bool_compare_and_swap(&mHead, head, buf));
+}
+
+IOBuffer* ReleaseQueue::takeAll()
+{
+	// detach the whole stack at once, there is only one consumer, so no ABA-problem can occur
+	IOBuffer* head;
+	
+	do {
+		head = mHead;
+		if(head == 0)
+			return 0;
+	} while(!__sync_bool_compare_and_swap(&mHead, head, (IOBuffer*) 0));
+	
+	// and reverse it to get the buffers in the order they have been released
+	IOBuffer* first = 0;
+	
+	while(head) {
+		IOBuffer* next = head->getNext();
+		head->setNext(first);
+		first = head;
+		head = next;
+	}
+	
+	return first;
+}
@@ -0,0 +1,141 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+#include <string.h>
+#include <sched.h>
+
+#include "ThreadParams.h"
+#include "CaptureManager.h"
+#include "log.h"
+
+using namespace avcap;
+
+// Construction & Destruction
+
+ThreadParams::ThreadParams():
+	mPolicy(SCHED_OTHER),
+	mPriority(0),
+	mPolicySet(false),
+	mAffinitySet(false)
+{
+}
+
+ThreadParams::~ThreadParams()
+{
+}
+
+int ThreadParams::setPriority(int policy, int priority)
+{
+	int sched_policy = SCHED_OTHER;
+	
+	switch(policy)
+	{
+		case CaptureManager::SCHED_POLICY_OTHER:
+			priority = 0;
+		break;
+		
+		case CaptureManager::SCHED_POLICY_FIFO:
+			sched_policy = SCHED_FIFO;
+		break;
+		
+		case CaptureManager::SCHED_POLICY_RR:
+			sched_policy = SCHED_RR;
+		break;
+		
+		default:
+			return -1;
+	}
+	
+	// check the range of the priority
+	if(priority < sched_get_priority_min(sched_policy) || priority > sched_get_priority_max(sched_policy))
+		return -1;
+	
+	mPolicy = sched_policy;
+	mPriority = priority;
+	mPolicySet = true;
+	
+	return 0;
+}
+
+int ThreadParams::setAffinity(const int* cpus, int count)
+{
+	std::vector<int> set;
+	
+	for(int i = 0; cpus && i < count; i++) {
+		if(cpus[i] < 0 || cpus[i] >= CPU_SETSIZE)
+			return -1;
+		
+		set.push_back(cpus[i]);
+	}
+	
+	mCpus.swap(set);
+	
+	if(!mCpus.empty())
+		mAffinitySet = true;
+	
+	return 0;
+}
+
+bool ThreadParams::isDefault() const
+{
+	return !mPolicySet && !mAffinitySet;
+}
+
+int ThreadParams::apply(pthread_t thread, const cpu_set_t* start_cpus) const
+{
+	int res = 0;
+	int err = 0;
+	
+	if(mPolicySet) {
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = mPriority;
+		
+		if((err = pthread_setschedparam(thread, mPolicy, &param)) != 0) {
+			logDebug(std::string("ThreadParams: setting the scheduling policy failed: ") + strerror(err));
+			res = -1;
+		}
+	}
+	
+	// the affinity is left alone, unless CPUs are set or the one the thread has been started with 
+	// has to be restored
+	if(!mAffinitySet || (mCpus.empty() && start_cpus == 0))
+		return res;
+	
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+	
+	if(mCpus.empty()) {
+		cpu_set = *start_cpus;
+	} else {
+		for(unsigned int i = 0; i < mCpus.size(); i++)
+			CPU_SET(mCpus[i], &cpu_set);
+	}
+	
+	if((err = pthread_setaffinity_np(thread, sizeof(cpu_set), &cpu_set)) != 0) {
+		logDebug(std::string("ThreadParams: setting the CPU affinity failed: ") + strerror(err));
+		return -1;
+	}
+	
+	return res;
+}
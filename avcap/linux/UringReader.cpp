@@ -0,0 +1,388 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+
+#include "avcap-config.h"
+#include "UringReader.h"
+#include "log.h"
+
+#ifdef AVCAP_HAVE_LINUX_IO_URING_H
+# include <linux/io_uring.h>
+#endif
+
+// IORING_OP_READ and the feature flags appeared together in linux 5.6
+#if defined(AVCAP_HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup) && defined(IORING_FEAT_RW_CUR_POS)
+# define USE_IO_URING
+#endif
+
+using namespace avcap;
+
+// Construction & Destruction
+
+UringReader::UringReader():
+	mRingFd(-1),
+	mEventFd(-1),
+	mDeviceFd(-1),
+	mInflight(0),
+	mEntries(0),
+	mSqRing(MAP_FAILED),
+	mSqRingSize(0),
+	mCqRing(MAP_FAILED),
+	mCqRingSize(0),
+	mSqes(MAP_FAILED),
+	mSqesSize(0),
+	mSqHead(0),
+	mSqTail(0),
+	mSqMask(0),
+	mSqArray(0),
+	mCqHead(0),
+	mCqTail(0),
+	mCqMask(0),
+	mCqes(0)
+{
+}
+
+UringReader::~UringReader()
+{
+	close();
+}
+
+#ifdef USE_IO_URING
+
+int UringReader::open(int fd, int entries)
+{
+	close();
+	
+	if(fd == -1 || entries <= 0)
+		return -1;
+	
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	
+	// fails with ENOSYS on old kernels and EPERM if io_uring is disabled
+	mRingFd = syscall(__NR_io_uring_setup, entries, &params);
+	
+	if(mRingFd == -1) {
+		logDebug(std::string("UringReader: io_uring isn't available: ") + strerror(errno));
+		return -1;
+	}
+	
+	mEntries = params.sq_entries;
+	mDeviceFd = fd;
+	
+	// map the submission and completion rings, newer kernels share one mapping for both
+	mSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	mCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+		mSqRingSize = mCqRingSize = std::max(mSqRingSize, mCqRingSize);
+	
+	mSqRing = mmap(0, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQ_RING);
+	
+	if(mSqRing != MAP_FAILED) {
+		if(params.features & IORING_FEAT_SINGLE_MMAP)
+			mCqRing = mSqRing;
+		else
+			mCqRing = mmap(0, mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_CQ_RING);
+	}
+	
+	mSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	
+	if(mCqRing != MAP_FAILED)
+		mSqes = mmap(0, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQES);
+	
+	if(mSqes == MAP_FAILED) {
+		logDebug(std::string("UringReader: mapping the rings failed: ") + strerror(errno));
+		close();
+		return -1;
+	}
+	
+	char* sq = (char*) mSqRing;
+	mSqHead = (unsigned int*) (sq + params.sq_off.head);
+	mSqTail = (unsigned int*) (sq + params.sq_off.tail);
+	mSqMask = (unsigned int*) (sq + params.sq_off.ring_mask);
+	mSqArray = (unsigned int*) (sq + params.sq_off.array);
+	
+	char* cq = (char*) mCqRing;
+	mCqHead = (unsigned int*) (cq + params.cq_off.head);
+	mCqTail = (unsigned int*) (cq + params.cq_off.tail);
+	mCqMask = (unsigned int*) (cq + params.cq_off.ring_mask);
+	mCqes = cq + params.cq_off.cqes;
+	
+	// kernels before 5.6 have io_uring, but can't read into a plain buffer
+	if(!isReadSupported()) {
+		logDebug("UringReader: the kernel doesn't support IORING_OP_READ");
+		close();
+		return -1;
+	}
+	
+	// completions are signaled on an eventfd, which the reactor can poll
+	mEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	
+	if(mEventFd == -1 || syscall(__NR_io_uring_register, mRingFd, IORING_REGISTER_EVENTFD, &mEventFd, 1) == -1) {
+		logDebug(std::string("UringReader: registering the eventfd failed: ") + strerror(errno));
+		close();
+		return -1;
+	}
+	
+	return 0;
+}
+
+void UringReader::close()
+{
+	if(mRingFd == -1)
+		return;
+	
+	// the kernel may still write to the buffers of pending reads, so cancel them and wait
+	int tag, res;
+	
+	while(mInflight > 0) {
+		unsigned int cancels = 0;
+		
+		for(unsigned int i = 0; i < mPending.size(); i++) {
+			struct io_uring_sqe* sqe = (struct io_uring_sqe*) getSqe();
+			if(!sqe)
+				break;
+			
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = -1;
+			sqe->addr = (uint64_t) mPending[i];
+			sqe->user_data = (uint64_t) (int64_t) CANCEL_TAG;
+			cancels++;
+		}
+		
+		if(enter(cancels, 1) == -1 && errno != EINTR) {
+			logDebug(std::string("UringReader: waiting for pending reads failed: ") + strerror(errno));
+			break;
+		}
+		
+		while(complete(tag, res) == 1)
+			;
+	}
+	
+	unmap();
+	
+	if(mEventFd != -1)
+		::close(mEventFd);
+	
+	::close(mRingFd);
+	
+	mRingFd = -1;
+	mEventFd = -1;
+	mDeviceFd = -1;
+	mInflight = 0;
+	mPending.clear();
+}
+
+int UringReader::submit(void* ptr, size_t size, int tag)
+{
+	if(mRingFd == -1)
+		return -1;
+	
+	unsigned int tail = *mSqTail;
+	struct io_uring_sqe* sqe = (struct io_uring_sqe*) getSqe();
+	
+	if(!sqe)
+		return -1;
+	
+	// read at the current position like read(), the device delivers the next frame
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = mDeviceFd;
+	sqe->addr = (uint64_t) (uintptr_t) ptr;
+	sqe->len = size;
+	sqe->off = (uint64_t) -1;
+	sqe->user_data = (uint64_t) tag;
+	
+	if(enter(1, 0) == -1) {
+		logDebug(std::string("UringReader: submitting a read failed: ") + strerror(errno));
+		
+		// take the entry back, without SQPOLL the kernel only consumes entries in io_uring_enter()
+		*(volatile unsigned int*) mSqTail = tail;
+		return -1;
+	}
+	
+	mInflight++;
+	mPending.push_back(tag);
+	
+	return 0;
+}
+
+int UringReader::complete(int& tag, int& res)
+{
+	if(mRingFd == -1)
+		return 0;
+	
+	// the kernel publishes the tail after the entry has been written
+	unsigned int head = *mCqHead;
+	unsigned int tail = *(volatile unsigned int*) mCqTail;
+	__sync_synchronize();
+	
+	while(head != tail) {
+		struct io_uring_cqe* cqe = (struct io_uring_cqe*) mCqes + (head & *mCqMask);
+		int64_t user_data = (int64_t) cqe->user_data;
+		int result = cqe->res;
+		
+		// and the entry may be reused after the head has been moved
+		__sync_synchronize();
+		*(volatile unsigned int*) mCqHead = ++head;
+		
+		if(user_data == CANCEL_TAG)
+			continue;
+		
+		// ignore the completion of a read, that hasn't been submitted by us
+		std::vector<int>::iterator it = std::find(mPending.begin(), mPending.end(), (int) user_data);
+		
+		if(it == mPending.end())
+			continue;
+		
+		mInflight--;
+		mPending.erase(it);
+		
+		tag = (int) user_data;
+		res = result;
+		return 1;
+	}
+	
+	return 0;
+}
+
+void UringReader::clearEvent()
+{
+	eventfd_t value;
+	
+	if(mEventFd != -1)
+		eventfd_read(mEventFd, &value);
+}
+
+void* UringReader::getSqe()
+{
+	// the kernel consumes the entries in io_uring_enter(), so the ring is never full for long
+	unsigned int tail = *mSqTail;
+	unsigned int head = *(volatile unsigned int*) mSqHead;
+	
+	if(tail - head >= mEntries)
+		return 0;
+	
+	unsigned int index = tail & *mSqMask;
+	struct io_uring_sqe* sqe = (struct io_uring_sqe*) mSqes + index;
+	memset(sqe, 0, sizeof(*sqe));
+	mSqArray[index] = index;
+	
+	// publish the entry
+	__sync_synchronize();
+	*(volatile unsigned int*) mSqTail = tail + 1;
+	
+	return sqe;
+}
+
+int UringReader::enter(unsigned int to_submit, unsigned int min_complete)
+{
+	unsigned int flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+	
+	return syscall(__NR_io_uring_enter, mRingFd, to_submit, min_complete, flags, 0, 0) == -1 ? -1 : 0;
+}
+
+bool UringReader::isReadSupported()
+{
+	// ask the kernel for the supported opcodes
+	size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	std::vector<char> mem(size, 0);
+	struct io_uring_probe* probe = (struct io_uring_probe*) &mem[0];
+	
+	if(syscall(__NR_io_uring_register, mRingFd, IORING_REGISTER_PROBE, probe, 256) == -1)
+		return false;
+	
+	return IORING_OP_READ <= probe->last_op && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+}
+
+void UringReader::unmap()
+{
+	if(mSqes != MAP_FAILED)
+		munmap(mSqes, mSqesSize);
+	
+	if(mCqRing != MAP_FAILED && mCqRing != mSqRing)
+		munmap(mCqRing, mCqRingSize);
+	
+	if(mSqRing != MAP_FAILED)
+		munmap(mSqRing, mSqRingSize);
+	
+	mSqes = mCqRing = mSqRing = MAP_FAILED;
+}
+
+#else
+
+// io_uring isn't known to the build system, so the caller always falls back to read()
+
+int UringReader::open(int fd, int entries)
+{
+	return -1;
+}
+
+void UringReader::close()
+{
+}
+
+int UringReader::submit(void* ptr, size_t size, int tag)
+{
+	return -1;
+}
+
+int UringReader::complete(int& tag, int& res)
+{
+	return 0;
+}
+
+void UringReader::clearEvent()
+{
+}
+
+void* UringReader::getSqe()
+{
+	return 0;
+}
+
+int UringReader::enter(unsigned int to_submit, unsigned int min_complete)
+{
+	return -1;
+}
+
+bool UringReader::isReadSupported()
+{
+	return false;
+}
+
+void UringReader::unmap()
+{
+}
+
+#endif
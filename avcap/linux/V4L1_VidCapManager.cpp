@@ -29,9 +29,10 @@
 #include <errno.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
-#include <sys/select.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
 #include <linux/types.h>
+#include <unistd.h>
 
 #include "avcap-config.h"
 #ifndef AVCAP_HAVE_V4L2
@@ -52,7 +53,9 @@ V4L1_VidCapManager::V4L1_VidCapManager(V4L1_DeviceDescriptor* dd, V4L1_FormatMan
 	mDeviceDescriptor(dd), 
 	mFormatMgr(fmt_mgr), 
 	mMethod(IO_METHOD_NOCAP), 
-	mThread(0), 
+	mReactor(0), 
+	mReactorGroup(-1),
+	mWakeupFd(-1),
 	mSequence(0),
 	mAvailableBuffers(0)
 {
@@ -107,9 +110,13 @@ int V4L1_VidCapManager::start_read()
 	{
 		void *ptr = new char[size];
 		
-		IOBuffer *buf = new IOBuffer(this, ptr, size);
-		mBuffers.push_back(buf);
+		IOBuffer *buf = new IOBuffer(this, ptr, size, i);
+		mBuffers.insert(buf);
+		mBuffers.pushFree(buf);
 	}
+	
+	// all buffers can be filled
+	mAvailableBuffers = mNumBufs;
 
 	// store the current time to create a propper time stamp
 	gettimeofday(&mStartTime, 0);
@@ -148,7 +155,7 @@ int V4L1_VidCapManager::start_mmap()
 	// create and enqueue the buffers
 	for(int i = 0; i < mNumBufs; i++) {
 		IOBuffer* buf = new IOBuffer(this, mVideobuf + vb.offsets[i], mFormatMgr->getImageSize(), i);
-		mBuffers.push_back(buf);
+		mBuffers.insert(buf);
 		buf->setState(IOBuffer::STATE_USED);
 		enqueue(buf);
 	}
@@ -184,81 +191,117 @@ int res = 0;
 	return res;
 }
 
-void V4L1_VidCapManager::run(void* mgr)
+int V4L1_VidCapManager::setSharedCaptureThread(int group)
 {
-V4L1_VidCapManager* io_mgr = (V4L1_VidCapManager*) mgr;
+	if(mReactor != 0 || group >= CaptureReactor::MAX_SHARED)
+		return -1;
+	
+	// VIDIOCSYNC blocks the reactor thread until the frame is ready, which would stall the other devices
+	if(group >= 0 && mMethod == IO_METHOD_MMAP)
+		return -1;
+	
+	mReactorGroup = group;
+	
+	return 0;
+}
 
-	// capture main loop
+int V4L1_VidCapManager::setCaptureThreadPriority(SchedPolicy policy, int priority)
+{
+	if(mThreadParams.setPriority(policy, priority) == -1)
+		return -1;
+	
+	// a running thread is changed at once
+	return mReactor ? mReactor->configure(mThreadParams) : 0;
+}
 
-	// run the loop until finish flag is set
-	while(!io_mgr->mFinish)
-	{
-		fd_set fds;
-		struct timeval tv;
+int V4L1_VidCapManager::setCaptureThreadAffinity(const int* cpus, int count)
+{
+	if(mThreadParams.setAffinity(cpus, count) == -1)
+		return -1;
+	
+	return mReactor ? mReactor->configure(mThreadParams) : 0;
+}
+
+int V4L1_VidCapManager::getPollHandle()
+{
+	return mDeviceDescriptor->getHandle();
+}
 
-		FD_ZERO(&fds);
-		FD_SET (io_mgr->mDeviceDescriptor->getHandle(), &fds);
+int V4L1_VidCapManager::getWakeupHandle()
+{
+	return mWakeupFd;
+}
 
-		// Timeout 1 sec.
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
+bool V4L1_VidCapManager::wantsPoll()
+{
+	// VIDIOCSYNC can't be polled, so the mmap-method is driven by wakeups only
+	return mMethod == IO_METHOD_READ && mAvailableBuffers > 0 && !mFinish;
+}
 
-		// wait until data is available or time is running out		
-		int res = select (io_mgr->mDeviceDescriptor->getHandle() + 1, &fds, 0, 0, &tv);
+bool V4L1_VidCapManager::handleReady(bool device_ready)
+{
+	// called from the reactor thread to deliver the captured data
 
-		// an error occured
-		if (-1 == res)
-		{
-			if (EINTR == errno)
-				continue;
-		}
+	if(mFinish)
+		return true;
+	
+	// a wakeup is only of interest for the mmap-method, the device is polled otherwise
+	if(mMethod == IO_METHOD_READ && !device_ready)
+		return true;
 
-		// get the current data buffer
-		/*
-		timeval start, end;
-		gettimeofday(&start, 0);
-		*/
-		IOBuffer *io_buf = io_mgr->dequeue();
-		/*
-		gettimeofday(&end, 0);		
-		std::cerr<<"capturing took: "<<(end.tv_usec- start.tv_usec)/1000.0<<"   ms\n";
-		*/
-		
-		if(io_buf)
-		{
-			// test whether finish flag has been set in between
-			if (!io_mgr->mFinish)
-			{
-				// and call the capture handler if one is registered
-				if(io_mgr->getCaptureHandler()) {
-					// std::cout<<"Calling capture-handler for #"<<io_buf->getSequence()<<"\n";
-			 		io_mgr->getCaptureHandler()->handleCaptureEvent(io_buf);
-				}
-			 	else
-			 		io_mgr->enqueue(io_buf); // otherwise enqueue buffer directly
-			}
-			else
-				io_mgr->enqueue(io_buf);
-		}
-		
-		// wait 20 ms to give clients the chance to 
-		// free a buffer without polling on select.
-		usleep((int)(1000.0*20));
-	}	
+	// get the current data buffer
+	IOBuffer *io_buf = dequeue();
+	
+	// sync the next requested frame in the next round, so the reactor can be stopped in between
+	if(mMethod == IO_METHOD_MMAP) {
+		pthread_mutex_lock(&mLock);
+		if(mCaptureIndices.size() > 0)
+			wakeup();
+		pthread_mutex_unlock(&mLock);
+	}
+	
+	if(!io_buf)
+		return false;
+	
+	// test whether finish flag has been set in between
+	if (!mFinish) {
+		// and call the capture handlers if any are registered
+		if(deliver(io_buf) == 0)
+	 		enqueue(io_buf); // otherwise enqueue buffer directly
+	} else {
+		enqueue(io_buf);
+	}
+	
+	return true;
+}
+
+void V4L1_VidCapManager::wakeup()
+{
+	// let the reactor call handleReady()
+	if(mWakeupFd != -1)
+		eventfd_write(mWakeupFd, 1);
 }
 
 int V4L1_VidCapManager::startCapture()
 {
 int res = 0;
 	
-	// is the capture thread already running?
-	if(mThread != 0)
+	// are we already capturing?
+	if(mReactor != 0)
 		return -1;
 	
 	// reset values
 	mFinish = 0;	
 	mBuffers.clear();
+	mCaptureIndices.clear();
 	mSequence = 0;
+	mAvailableBuffers = 0;
+	openFrames();
+	
+	// create the descriptor to wake up the reactor
+	mWakeupFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if(mWakeupFd == -1)
+		return -1;
 		
 	// call the IO-method-specific start-method
 	switch(mMethod)
@@ -272,9 +315,19 @@ int res = 0;
 		break;
 	}
 
-	// create and start a new pthread
-	mThread = new pthread_t; 
-	pthread_create( mThread, 0,  (void* (*)(void*)) &V4L1_VidCapManager::run, (void*) this );
+	// let a reactor thread receive the data
+	mReactor = CaptureReactor::acquire(mReactorGroup);
+	
+	if(mReactor == 0 || mReactor->attach(this) == -1) {
+		CaptureReactor::release(mReactor);
+		mReactor = 0;
+		close(mWakeupFd);
+		mWakeupFd = -1;
+		return -1;
+	}
+	
+	// a failure is logged, but the thread keeps running with the default scheduling
+	mReactor->configure(mThreadParams);
 	
 	int start = 1;
 	res = ioctl(mDeviceDescriptor->getHandle(), VIDIOCCAPTURE, &start);
@@ -289,18 +342,26 @@ int stop = 0;
 	res = ioctl(mDeviceDescriptor->getHandle(), VIDIOCCAPTURE, &stop);
 
 	// not capturing 
-    if(!mThread)
+    if(!mReactor)
     	return -1;
     
 	pthread_mutex_lock(&mLock);
 	mFinish = 1;
 	pthread_mutex_unlock(&mLock);
+	
+	// the frames queued for nextFrame() are deleted with the others
+	flushFrames();
 
-	// and wait till thread has finished
-	pthread_join ( *mThread, 0);
-	// delete the thread
-	delete mThread;
-	mThread = 0;
+	// and wait till the reactor doesn't deliver data anymore
+	mReactor->detach(this);
+	CaptureReactor::release(mReactor);
+	mReactor = 0;
+	
+	// a frame may have been passed to the thread pool in between
+	waitDispatched();
+	
+	close(mWakeupFd);
+	mWakeupFd = -1;
 
 	// call the IO-method specific stop mehtod
 	switch(mMethod)
@@ -315,9 +376,9 @@ int stop = 0;
 	}
 
 	// iterate the buffer list and mark all buffers UNUSED
-	for(IOBufList_t::iterator it = mBuffers.begin(); it != mBuffers.end(); it++)
+	for(int i = 0; i < mBuffers.size(); i++)
 	{
-		IOBuffer *buf = *it;
+		IOBuffer *buf = mBuffers.find(i);
 		if(buf)
 			(buf->setState(IOBuffer::STATE_UNUSED));
 	}
@@ -354,7 +415,11 @@ int V4L1_VidCapManager::enqueue(IOBuffer *io_buf)
 			}
 
 			io_buf->setState(IOBuffer::STATE_UNUSED);
-			mAvailableBuffers++;
+			mBuffers.pushFree(io_buf);
+			
+			// wake up the reactor, if the device isn't polled
+			if(mAvailableBuffers++ == 0)
+				wakeup();
 			pthread_mutex_unlock(&mLock);
 		break;
 		
@@ -382,6 +447,10 @@ int V4L1_VidCapManager::enqueue(IOBuffer *io_buf)
 		    ret = ioctl(mDeviceDescriptor->getHandle(), VIDIOCMCAPTURE, &vmm);
 		    if(ret != -1) {
 			    mCaptureIndices.push_back(io_buf->getIndex());
+			    
+			    // wake up the reactor to sync the first requested frame
+			    if(mCaptureIndices.size() == 1)
+			    	wakeup();
 		    }
 			 
 			pthread_mutex_unlock(&mLock);
@@ -391,6 +460,20 @@ int V4L1_VidCapManager::enqueue(IOBuffer *io_buf)
 	return ret;
 }
 
+void V4L1_VidCapManager::setTimestamp(IOBuffer* io_buf, size_t valid, int seq)
+{
+	// V4L1 drivers don't provide timestamps, so take it when the data has arrived
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	struct timeval tv;
+	tv.tv_sec = ts.tv_sec;
+	tv.tv_usec = ts.tv_nsec / 1000;
+	
+	io_buf->setParams(valid, IOBuffer::STATE_USED, tv, seq);
+	io_buf->setTimestamp((long long) ts.tv_sec * 1000000000LL + ts.tv_nsec, IOBuffer::TIMESTAMP_MONOTONIC);
+}
+
 IOBuffer* V4L1_VidCapManager::dequeue()
 {
 IOBuffer *res = 0;
@@ -408,37 +491,28 @@ IOBuffer *res = 0;
 				return 0;
 			}
 
-        	// find an unused buffer
-        	for(IOBufList_t::iterator it = mBuffers.begin(); it != mBuffers.end(); it++)
-        	{
-        		res = *it;
-        		// first fit
-        		if(res->getState() == IOBuffer::STATE_UNUSED)
-        			break;
-        	}
+        	// take an unused buffer from the free-list
+        	res = mBuffers.popFree();
         	
         	// did we find a buffer
-        	if(res->getState() == IOBuffer::STATE_UNUSED)
+        	if(res != 0)
         	{
-        		// then compute the timestamp from the start-time, the framerate and the sequence number
-        		struct timeval	tv;
-				gettimeofday(&tv, 0);
-	        		
 	        	// read the captured data
 				int n = read(mDeviceDescriptor->getHandle(), res->getPtr(), res->getSize() );
 	
 				// and update the buffer parameter
 				if(n > 0) {
 					// std::cout<<"found empty buffer "<<res<<" State before: "<< res->getState();
-					res->setParams(n, IOBuffer::STATE_USED, tv, mSequence++ + 1);
+					setTimestamp(res, n, mSequence++ + 1);
 					mAvailableBuffers--;
 					// std::cout<<" and after: "<<res->getState()<<"\n";
 				}
-				else
+				else {
+					// give the buffer back
+					mBuffers.pushFree(res);
 					res = 0;
+				}
         	}
-        	else
-				res = 0;
 			pthread_mutex_unlock(&mLock);
 		break;
 		
@@ -463,11 +537,9 @@ IOBuffer *res = 0;
 				
 				if(ret != -1) {
 					mSequence++;
-					timeval tv;
-					gettimeofday(&tv, 0);
 		
 					// set the buffer parameters
-					res->setParams(res->getSize(), IOBuffer::STATE_USED, tv, mSequence + 1);
+					setTimestamp(res, res->getSize(), mSequence + 1);
 					mCaptureIndices.pop_front();
 					mAvailableBuffers--;
 					
@@ -485,34 +557,14 @@ IOBuffer *res = 0;
 
 IOBuffer* V4L1_VidCapManager::findBuffer(int index)
 {
-IOBuffer	*io_buf = 0;
-	
 	// Find a buffer by its unique index.
-	
-	// iterate the list and return the correct buffer object
-	for(IOBufList_t::iterator it = mBuffers.begin(); it != mBuffers.end(); it++)
-	{
-		io_buf = *it;
-		if(io_buf->getIndex() == index)
-			break;
-	}
-
-	return io_buf;
+	return mBuffers.find(index);
 }
 
 int V4L1_VidCapManager::getUsedBufferCount()
 {
-int res = 0;
-
 	// Return the number of currently used buffers.
-
-	// iterate the list and count the used buffers
-	for(IOBufList_t::iterator it = mBuffers.begin(); it != mBuffers.end(); it++)
-		if (*it)
-			if((*it)->getState() == IOBuffer::STATE_USED)
-				res++;
-	
-	return res;
+	return mBuffers.getUsedCount();
 }
 
 void V4L1_VidCapManager::clearBuffers()
@@ -524,9 +576,9 @@ void V4L1_VidCapManager::clearBuffers()
 	pthread_mutex_lock(&mLock);
 
 	// iterate the buffer list
-	for(IOBufList_t::iterator it = mBuffers.begin(); it != mBuffers.end(); it++)
+	for(int i = 0; i < mBuffers.size(); i++)
 	{
-		IOBuffer *buf = *it;
+		IOBuffer *buf = mBuffers.find(i);
 		if(buf)
 		{
 			if(buf->getState() == IOBuffer::STATE_UNUSED)
@@ -547,7 +599,7 @@ void V4L1_VidCapManager::clearBuffers()
 				
 				// and delete the buffer
 				delete buf;
-				*it = 0;
+				mBuffers.remove(i);
 			}
 		}
 	}
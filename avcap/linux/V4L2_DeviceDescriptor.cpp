@@ -125,6 +125,12 @@ bool V4L2_DeviceDescriptor::queryCapabilities()
 	mVersion= caps.version;
 	mCapabilities = caps.capabilities;
 
+#ifdef V4L2_CAP_DEVICE_CAPS
+	// the capabilities of this device node rather than of the whole device
+	if(caps.capabilities & V4L2_CAP_DEVICE_CAPS)
+		mCapabilities = caps.device_caps;
+#endif
+
 	std::ostringstream res;
 	res<<((mVersion >> 16) & 0xFF)<<"."<<((mVersion >> 8) & 0xFF)<<"."<<(mVersion & 0xFF);
 	mVersionString = res.str();
@@ -158,7 +164,31 @@ bool V4L2_DeviceDescriptor::isAVDev() const
 
 bool V4L2_DeviceDescriptor::isVideoCaptureDev() const
 {
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+	return mCapabilities & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE);
+#else
 	return mCapabilities & V4L2_CAP_VIDEO_CAPTURE;
+#endif
+}
+
+bool V4L2_DeviceDescriptor::isMultiplanarDev() const
+{
+	// the single-planar API is preferred, if the device supports both
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+	return (mCapabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE) && !(mCapabilities & V4L2_CAP_VIDEO_CAPTURE);
+#else
+	return false;
+#endif
+}
+
+unsigned int V4L2_DeviceDescriptor::getBufferType() const
+{
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+	if(isMultiplanarDev())
+		return V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+#endif
+
+	return V4L2_BUF_TYPE_VIDEO_CAPTURE;
 }
 
 bool V4L2_DeviceDescriptor::isTuner() const
@@ -27,7 +27,7 @@
 #include <sys/ioctl.h>
 
 #include "V4L2_FormatManager.h"
-#include "DeviceDescriptor.h"
+#include "V4L2_DeviceDescriptor.h"
 #include "uvc_compat.h"
 #include "pwc-ioctl.h"
 #include "log.h"
@@ -41,10 +41,66 @@
 
 using namespace avcap;
 
+// the single- and the multi-planar API describe the format in different structures
+
+static bool isMultiplanar(const struct v4l2_format& fmt)
+{
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+	return fmt.type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+#else
+	return false;
+#endif
+}
+
+static void setPixFormat(struct v4l2_format& fmt, unsigned int width, unsigned int height, unsigned int fourcc)
+{
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+	if(isMultiplanar(fmt)) {
+		fmt.fmt.pix_mp.width = width;
+		fmt.fmt.pix_mp.height = height;
+		fmt.fmt.pix_mp.pixelformat = fourcc;
+		fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
+		return;
+	}
+#endif
+	
+	fmt.fmt.pix.width = width;
+	fmt.fmt.pix.height = height;
+	fmt.fmt.pix.pixelformat = fourcc;
+	fmt.fmt.pix.field = V4L2_FIELD_ANY;
+}
+
+static void getPixFormat(const struct v4l2_format& fmt, unsigned int& width, unsigned int& height, 
+	unsigned int& fourcc, unsigned int& bpl, size_t& size)
+{
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+	if(isMultiplanar(fmt)) {
+		width = fmt.fmt.pix_mp.width;
+		height = fmt.fmt.pix_mp.height;
+		fourcc = fmt.fmt.pix_mp.pixelformat;
+		bpl = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+		
+		// the image consists of all planes
+		size = 0;
+		for(int i = 0; i < fmt.fmt.pix_mp.num_planes && i < VIDEO_MAX_PLANES; i++)
+			size += fmt.fmt.pix_mp.plane_fmt[i].sizeimage;
+		
+		return;
+	}
+#endif
+	
+	width = fmt.fmt.pix.width;
+	height = fmt.fmt.pix.height;
+	fourcc = fmt.fmt.pix.pixelformat;
+	bpl = fmt.fmt.pix.bytesperline;
+	size = fmt.fmt.pix.sizeimage;
+}
+
 // Construction & Destruction
 
 V4L2_FormatManager::V4L2_FormatManager(V4L2_DeviceDescriptor *dd):
-	FormatManager((DeviceDescriptor*)dd)
+	FormatManager((DeviceDescriptor*)dd),
+	mBufType(dd->getBufferType())
 {
 }
 
@@ -73,7 +129,7 @@ void V4L2_FormatManager::query()
 		{
 			struct v4l2_fmtdesc dsc;
 			memset(&dsc, 0, sizeof(v4l2_fmtdesc));
-			dsc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			dsc.type = mBufType;
 			dsc.index = i;
 			
 			// finish, if there are no more formats
@@ -192,16 +248,17 @@ void V4L2_FormatManager::queryResolutions(Format* f)
 			struct v4l2_format fmt;
 			memset(&fmt, 0, sizeof(struct v4l2_format));
 
-			fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-			fmt.fmt.pix.width = Resolutions[i][0];
-			fmt.fmt.pix.height = Resolutions[i][1];
-			fmt.fmt.pix.pixelformat = f->getFourcc();
+			fmt.type = mBufType;
+			setPixFormat(fmt, Resolutions[i][0], Resolutions[i][1], f->getFourcc());
 			
 			if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_TRY_FMT, &fmt) == -1)
 				continue;
 
-			if(fmt.fmt.pix.width == Resolutions[i][0] && fmt.fmt.pix.height == Resolutions[i][1]
-				&& fmt.fmt.pix.pixelformat == f->getFourcc())
+			unsigned int width, height, fourcc, bpl;
+			size_t size;
+			getPixFormat(fmt, width, height, fourcc, bpl, size);
+			
+			if(width == Resolutions[i][0] && height == Resolutions[i][1] && fourcc == f->getFourcc())
 				f->addResolution(Resolutions[i][0], Resolutions[i][1]);
 		}
 		
@@ -246,18 +303,22 @@ int V4L2_FormatManager::getParams()
 	struct v4l2_format	fmt;
 	// and ask the driver which format is currently set
 	memset(&fmt, 0, sizeof(struct v4l2_format));
-	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt.type = mBufType;
 			
 	int res = ioctl(mDeviceDescriptor->getHandle(), VIDIOC_G_FMT, &fmt);
 			
 	if(res == -1) 
 		return -1;
-		
-	mWidth			= fmt.fmt.pix.width;
-	mHeight			= fmt.fmt.pix.height;
-	mBytesPerLine 	= fmt.fmt.pix.bytesperline;
-	mCurrentFormat 	= fmt.fmt.pix.pixelformat;
-	mImageSize 		= fmt.fmt.pix.sizeimage;
+	
+	unsigned int width, height, fourcc, bpl;
+	size_t size;
+	getPixFormat(fmt, width, height, fourcc, bpl, size);
+	
+	mWidth			= width;
+	mHeight			= height;
+	mBytesPerLine 	= bpl;
+	mCurrentFormat 	= fourcc;
+	mImageSize 		= size;
 	
 	return 0;
 }
@@ -347,18 +408,15 @@ int V4L2_FormatManager::flush()
 		// then propagate the changes to the driver
 		struct v4l2_format fmt;
 		memset(&fmt, 0, sizeof(struct v4l2_format));
-		fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		fmt.type = mBufType;
 
 		int res = ioctl(mDeviceDescriptor->getHandle(), VIDIOC_G_FMT, &fmt);
 		if (res == -1) {
 		   return res;
 		}
 		
-		fmt.fmt.pix.width = mWidth;
-		fmt.fmt.pix.height = mHeight;
-		// fmt.fmt.pix.bytesperline = mBytesPerLine;
-		fmt.fmt.pix.pixelformat = mCurrentFormat;
-		fmt.fmt.pix.field        = V4L2_FIELD_ANY;
+		// the driver computes the bytes per line and the planes
+		setPixFormat(fmt, mWidth, mHeight, mCurrentFormat);
 
 		res = ioctl(mDeviceDescriptor->getHandle(), VIDIOC_S_FMT, &fmt);
 
@@ -366,6 +424,21 @@ int V4L2_FormatManager::flush()
 			mModified = false;
 		}  
 		
+#ifdef VIDIOC_S_SELECTION
+		// let a device with a scaler fill the whole image with the region of interest
+		if(res != -1 && mRoi.width > 0) {
+			struct v4l2_selection sel;
+			memset(&sel, 0, sizeof(sel));
+			sel.type = mBufType;
+			sel.target = V4L2_SEL_TGT_COMPOSE;
+			sel.r.width = mWidth;
+			sel.r.height = mHeight;
+			
+			// most devices can't compose, which is fine
+			ioctl(mDeviceDescriptor->getHandle(), VIDIOC_S_SELECTION, &sel);
+		}
+#endif
+		
 		getParams();
 	
 		return res;
@@ -384,12 +457,11 @@ int V4L2_FormatManager::tryFormat()
 		// then try to set the new parameters
 		struct v4l2_format fmt;
 		memset(&fmt, 0, sizeof(struct v4l2_format));
-		fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		fmt.type = mBufType;
 		
-		fmt.fmt.pix.width = mWidth;
-		fmt.fmt.pix.height = mHeight;
-		fmt.fmt.pix.bytesperline = mBytesPerLine;
-		fmt.fmt.pix.pixelformat = mCurrentFormat;
+		setPixFormat(fmt, mWidth, mHeight, mCurrentFormat);
+		if(!isMultiplanar(fmt))
+			fmt.fmt.pix.bytesperline = mBytesPerLine;
 		
 		// and return the success state
 		return ioctl(mDeviceDescriptor->getHandle(), VIDIOC_TRY_FMT, &fmt);
@@ -477,13 +549,176 @@ int V4L2_FormatManager::setFramerate(int fps)
 	struct v4l2_streamparm setfps;  
 	memset(&setfps, 0, sizeof(struct v4l2_streamparm));
 	
-	setfps.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	setfps.type = mBufType;
 	setfps.parm.capture.timeperframe.numerator = 1;
 	setfps.parm.capture.timeperframe.denominator = fps;
 	
 	return ioctl(mDeviceDescriptor->getHandle(), VIDIOC_S_PARM, &setfps); 
 }
 
+int V4L2_FormatManager::setRegionOfInterest(const ImageRect& roi)
+{
+	ImageRect rect = roi;
+	
+	if(setCrop(rect) == -1) {
+		logDebug(std::string("V4L2_FormatManager: cropping failed: ") + strerror(errno));
+		return -1;
+	}
+	
+	// the reset region is the default of the driver, which isn't set again on start
+	if(roi.width <= 0) {
+		mRoi = ImageRect();
+		return 0;
+	}
+	
+	// keep the region as adjusted by the driver and capture it unscaled
+	mRoi = rect;
+	
+	return setResolution(rect.width, rect.height);
+}
+
+int V4L2_FormatManager::getRegionOfInterest(ImageRect& roi)
+{
+	int fd = mDeviceDescriptor->getHandle();
+	
+#ifdef VIDIOC_G_SELECTION
+	struct v4l2_selection sel;
+	memset(&sel, 0, sizeof(sel));
+	sel.type = mBufType;
+	sel.target = V4L2_SEL_TGT_CROP;
+	
+	if(ioctl(fd, VIDIOC_G_SELECTION, &sel) == 0) {
+		roi = ImageRect(sel.r.left, sel.r.top, sel.r.width, sel.r.height);
+		return 0;
+	}
+#endif
+	
+	// older drivers only know the crop API
+	struct v4l2_crop crop;
+	memset(&crop, 0, sizeof(crop));
+	crop.type = mBufType;
+	
+	if(ioctl(fd, VIDIOC_G_CROP, &crop) == -1)
+		return -1;
+	
+	roi = ImageRect(crop.c.left, crop.c.top, crop.c.width, crop.c.height);
+	
+	return 0;
+}
+
+int V4L2_FormatManager::getCropBounds(ImageRect& bounds)
+{
+	int fd = mDeviceDescriptor->getHandle();
+	
+#ifdef VIDIOC_G_SELECTION
+	struct v4l2_selection sel;
+	memset(&sel, 0, sizeof(sel));
+	sel.type = mBufType;
+	sel.target = V4L2_SEL_TGT_CROP_BOUNDS;
+	
+	if(ioctl(fd, VIDIOC_G_SELECTION, &sel) == 0) {
+		bounds = ImageRect(sel.r.left, sel.r.top, sel.r.width, sel.r.height);
+		return 0;
+	}
+#endif
+	
+	struct v4l2_cropcap cropcap;
+	memset(&cropcap, 0, sizeof(cropcap));
+	cropcap.type = mBufType;
+	
+	if(ioctl(fd, VIDIOC_CROPCAP, &cropcap) == -1)
+		return -1;
+	
+	bounds = ImageRect(cropcap.bounds.left, cropcap.bounds.top, cropcap.bounds.width, cropcap.bounds.height);
+	
+	return 0;
+}
+
+int V4L2_FormatManager::applyCrop()
+{
+	// the crop of the driver is left alone, if the application hasn't chosen a region
+	if(mRoi.width <= 0)
+		return 0;
+	
+	ImageRect rect = mRoi;
+	
+	if(setCrop(rect) == -1) {
+		// a driver that can't crop anymore keeps the full image, like the reset of the crop on start
+		if(errno == EINVAL || errno == ENOTTY)
+			return 0;
+		
+		logDebug(std::string("V4L2_FormatManager: restoring the region of interest failed: ") + strerror(errno));
+		return -1;
+	}
+	
+	return 0;
+}
+
+int V4L2_FormatManager::setCrop(ImageRect& rect)
+{
+	// Set the crop rectangle of the driver, a width of 0 selects its default. 
+	// The rectangle is updated with the one the driver has chosen.
+	
+	int fd = mDeviceDescriptor->getHandle();
+	
+#ifdef VIDIOC_S_SELECTION
+	// the selection API of newer drivers
+	struct v4l2_selection sel;
+	memset(&sel, 0, sizeof(sel));
+	sel.type = mBufType;
+	sel.target = V4L2_SEL_TGT_CROP_DEFAULT;
+	
+	if(rect.width > 0 || ioctl(fd, VIDIOC_G_SELECTION, &sel) == 0) {
+		if(rect.width > 0) {
+			sel.r.left = rect.left;
+			sel.r.top = rect.top;
+			sel.r.width = rect.width;
+			sel.r.height = rect.height;
+		}
+		
+		sel.target = V4L2_SEL_TGT_CROP;
+		
+		if(ioctl(fd, VIDIOC_S_SELECTION, &sel) == 0) {
+			rect = ImageRect(sel.r.left, sel.r.top, sel.r.width, sel.r.height);
+			return 0;
+		}
+		
+		// the device is busy or the region is invalid, the crop API wouldn't do better
+		if(errno != EINVAL && errno != ENOTTY && errno != ENODATA)
+			return -1;
+	}
+#endif
+	
+	// the crop API of older drivers
+	struct v4l2_cropcap cropcap;
+	memset(&cropcap, 0, sizeof(cropcap));
+	cropcap.type = mBufType;
+	
+	if(ioctl(fd, VIDIOC_CROPCAP, &cropcap) == -1)
+		return -1;
+	
+	struct v4l2_crop crop;
+	memset(&crop, 0, sizeof(crop));
+	crop.type = mBufType;
+	crop.c = cropcap.defrect;
+	
+	if(rect.width > 0) {
+		crop.c.left = rect.left;
+		crop.c.top = rect.top;
+		crop.c.width = rect.width;
+		crop.c.height = rect.height;
+	}
+	
+	if(ioctl(fd, VIDIOC_S_CROP, &crop) == -1)
+		return -1;
+	
+	// S_CROP doesn't return the adjusted rectangle
+	if(ioctl(fd, VIDIOC_G_CROP, &crop) == 0)
+		rect = ImageRect(crop.c.left, crop.c.top, crop.c.width, crop.c.height);
+	
+	return 0;
+}
+
 int V4L2_FormatManager::getFramerate()
 {
 #ifndef AVCAP_HAVE_V4L2
@@ -501,6 +736,7 @@ int V4L2_FormatManager::getFramerate()
 	
 	struct v4l2_streamparm setfps;  
 	memset(&setfps, 0, sizeof(struct v4l2_streamparm));
+	setfps.type = mBufType;
 	
 	if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_G_PARM, &setfps) == -1)
 		return -1;
@@ -24,20 +24,23 @@
 #include <string.h>
 #include <iostream>
 #include <time.h>
-#include <math.h>
 #include <errno.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
-#include <sys/select.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
 #include <linux/types.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <algorithm>
 
 #include "V4L2_VidCapManager.h"
 #include "V4L2_DeviceDescriptor.h"
-#include "FormatManager.h"
+#include "V4L2_FormatManager.h"
 #include "IOBuffer.h"
 #include "CaptureHandler.h"
+#include "StreamCopy.h"
 #include "log.h"
 
 #ifdef AVCAP_HAVE_V4L2
@@ -48,17 +51,105 @@
 
 using namespace avcap;
 
+// map the timestamp flags of a v4l2_buffer to the clock of an IOBuffer
+static IOBuffer::TimestampClock getTimestampClock(unsigned int flags)
+{
+#ifdef V4L2_BUF_FLAG_TIMESTAMP_MASK
+	if((flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+		return IOBuffer::TIMESTAMP_MONOTONIC;
+#endif
+
+	// drivers older than Linux 3.9 don't tell
+	return IOBuffer::TIMESTAMP_UNKNOWN;
+}
+
+// the current time of the monotonic clock in nanoseconds
+static long long monotonicNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// compare the parts of two formats that determine the buffer layout
+static bool sameLayout(const struct v4l2_format& a, const struct v4l2_format& b)
+{
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+	if(a.type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+		if(a.fmt.pix_mp.width != b.fmt.pix_mp.width || a.fmt.pix_mp.height != b.fmt.pix_mp.height ||
+			a.fmt.pix_mp.pixelformat != b.fmt.pix_mp.pixelformat || a.fmt.pix_mp.num_planes != b.fmt.pix_mp.num_planes)
+			return false;
+		
+		for(int p = 0; p < a.fmt.pix_mp.num_planes && p < VIDEO_MAX_PLANES; p++)
+			if(a.fmt.pix_mp.plane_fmt[p].bytesperline != b.fmt.pix_mp.plane_fmt[p].bytesperline ||
+				a.fmt.pix_mp.plane_fmt[p].sizeimage != b.fmt.pix_mp.plane_fmt[p].sizeimage)
+				return false;
+		
+		return true;
+	}
+#endif
+	
+	return a.fmt.pix.width == b.fmt.pix.width && a.fmt.pix.height == b.fmt.pix.height &&
+		a.fmt.pix.pixelformat == b.fmt.pix.pixelformat && 
+		a.fmt.pix.bytesperline == b.fmt.pix.bytesperline && a.fmt.pix.sizeimage == b.fmt.pix.sizeimage;
+}
+
+// prepare a v4l2_buffer, the multi-planar API needs an array of planes
+static void initBuffer(struct v4l2_buffer& buf, struct v4l2_plane* planes, unsigned int type, int memory, int num_planes)
+{
+	memset(&buf, 0, sizeof(buf));
+	buf.type = type;
+	buf.memory = memory;
+	
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+	if(type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+		memset(planes, 0, VIDEO_MAX_PLANES * sizeof(struct v4l2_plane));
+		buf.m.planes = planes;
+		buf.length = num_planes;
+	}
+#endif
+}
+
 // Construction & Destruction
 
 V4L2_VidCapManager::V4L2_VidCapManager(V4L2_DeviceDescriptor* dd, FormatManager *fmt_mgr, int nbufs):
 	mDeviceDescriptor(dd), 
 	mFormatMgr(fmt_mgr), 
 	mMethod(IO_METHOD_NOCAP), 
-	mThread(0), 
+	mReactor(0), 
+	mReactorGroup(-1),
+	mBufType(dd->getBufferType()),
+	mMemPlanes(1),
 	mSequence(0),
-	mDTNumerator(0),
-	mDTDenominator(0),
-	mAvailableBuffers(0)
+	mAvailableBuffers(0),
+	mStarving(0),
+	mReleasing(0),
+	mReadFailed(false),
+	mAllocFlags(ALLOC_DEFAULT),
+	mNumaNode(-1),
+	mBatchSize(1),
+	mUserPtrSize(0),
+	mExportDmaBuf(false),
+	mWakeupFd(-1),
+	mFileFlags(-1),
+	mMinBufs(0),
+	mMaxBufs(0),
+	mHoldTime(0),
+	mFrameInterval(0),
+	mLastFrame(0),
+	mQueueEmpty(0),
+	mTuneFrames(0),
+	mShrinkVotes(0),
+	mMaxHold(-1),
+	mMinQueued(0),
+	mCopyOut(false),
+	mPaused(false),
+	mStartTime(0),
+	mTimeToFirstFrame(-1),
+	mEventMask(~(1 << CaptureHandler::EVENT_FRAME_SYNC)),
+	mSubscribed(false),
+	mRestartPending(false)
 {
 	mNumBufs = nbufs > 1 ? nbufs : 2;
 	mNumBufs = mNumBufs <= MAX_BUFFERS ? mNumBufs : MAX_BUFFERS;
@@ -67,6 +158,10 @@ V4L2_VidCapManager::V4L2_VidCapManager(V4L2_DeviceDescriptor* dd, FormatManager
 
 V4L2_VidCapManager::~V4L2_VidCapManager()
 {
+	// the copies of held frames can't be released anymore
+	for(unsigned int i = 0; i < mDetached.size(); i++)
+		mDetached[i]->setState(IOBuffer::STATE_UNUSED);
+	
 	clearBuffers();
 }
 
@@ -88,24 +183,11 @@ int V4L2_VidCapManager::init()
 
 		// device supports streaming IO with mmaped or user buffers
 		if(mDeviceDescriptor->isStreamingDev()) {
-			struct v4l2_requestbuffers req;
-			memset(&req, 0, sizeof(req));
-			
-			// try to allocate a kernel buffer for mmap to determine method
-			req.count	= 1;
-			req.type	= V4L2_BUF_TYPE_VIDEO_CAPTURE;
-			req.memory	= V4L2_MEMORY_MMAP;
-
-			// if successful we use mmap otherwise we use user pointer
-			if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_REQBUFS, &req) != -1) {
+			// if mmap is supported we use it, otherwise we use user pointer
+			if(isMemorySupported(V4L2_MEMORY_MMAP))
 			      mMethod = IO_METHOD_MMAP;
-			      // and free the buffer on success
-			      req.count	= 0;
-			      ioctl(mDeviceDescriptor->getHandle(), VIDIOC_REQBUFS, &req);
-			} else
+			else
 				mMethod = IO_METHOD_USERPTR;
-			
-			
 		}
 	}
 
@@ -130,57 +212,132 @@ int V4L2_VidCapManager::start_read()
 	// start capture if read() IO method is used.
 	int size = mFormatMgr->getImageSize();
 	
+	// read() can't fill separate planes
+	if(mMemPlanes > 1) {
+		logDebug("V4L2_VidCapManager: the read IO-method doesn't support multi-planar formats");
+		return -1;
+	}
+	
+	if(mPool.allocate(size, mNumBufs, mAllocFlags, mNumaNode) == -1)
+		return -1;
+	
 	// allocate IOBuffers for the images
 	for(int i = 0; i < mNumBufs; i++) {
-		void *ptr = new char[size];
+		IOBuffer *buf = new IOBuffer(this, mPool.getBuffer(i), size, i);
+		void* ptr = buf->getPtr();
+		size_t length = buf->getSize();
+		setLayout(buf, &ptr, &length);
 		
-		IOBuffer *buf = new IOBuffer(this, ptr, size);
-		mBuffers.push_back(buf);
+		mBuffers.insert(buf);
+		mBuffers.pushFree(buf);
+	}
+	
+	// all buffers can be filled
+	mAvailableBuffers = mNumBufs;
+	
+	// without io_uring the capture thread calls read() itself
+	if(openUring() == 0) {
+		pthread_mutex_lock(&mLock);
+		submitReads();
+		pthread_mutex_unlock(&mLock);
 	}
 
-	// store the current time to create a propper time stamp
-	gettimeofday(&mStartTime, 0);
+	return 0;
+}
 
-	// get streaming parameters for the timing	
-	struct v4l2_streamparm param;
-	memset(&param, 0, sizeof(v4l2_streamparm));
-	param.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+int V4L2_VidCapManager::stop_read()
+{
+	closeUring();
+	
+	return 0;
+}
 
-	if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_G_PARM, &param) != -1) {
-		mDTNumerator = param.parm.capture.timeperframe.numerator;
-		mDTDenominator = param.parm.capture.timeperframe.denominator*10000000;
-	} else {
-		// the VIDIOC_G_PARM isn't supported by the driver so use the framerate of the video standard
-		if(mFormatMgr->getVideoStandard() == 0) {
-			mDTNumerator = 1;
-			mDTDenominator = 25;
-		} else {
-			switch(mFormatMgr->getVideoStandard()->id)
-			{
-				case V4L2_STD_525_60:
-					mDTNumerator = 1001;
-					mDTDenominator = 30000;
-				break;
+int V4L2_VidCapManager::openUring()
+{
+	// let the kernel read into the buffers in the background, it polls the non-blocking device
+	if(mUring.open(mDeviceDescriptor->getHandle(), mNumBufs) == -1)
+		return -1;
+	
+	mReadFailed = false;
+	
+	return 0;
+}
+
+void V4L2_VidCapManager::closeUring()
+{
+	if(!mUring.isOpen())
+		return;
+	
+	// cancels the pending reads and waits till the kernel doesn't touch the buffers anymore
+	mUring.close();
+	
+	// the buffers of the cancelled reads can be filled again
+	pthread_mutex_lock(&mLock);
+	for(int i = 0; i < mBuffers.size() && i < MAX_BUFFERS; i++) {
+		if(mQueued[i] && mBuffers.find(i))
+			mBuffers.pushFree(mBuffers.find(i));
 		
-				case V4L2_STD_625_50:
-					mDTNumerator = 1;
-					mDTDenominator = 25;
-				break;
-				
-				default:
-					mDTNumerator = 1;
-					mDTDenominator = 25;
-				break;			
-			}
-		} 
+		mQueued[i] = false;
+	}
+	pthread_mutex_unlock(&mLock);
+}
+
+void V4L2_VidCapManager::submitReads()
+{
+	// start a read for each free buffer, called with the lock held. 
+	// If the ring is full, the buffer is submitted with the next one.
+	if(mReadFailed)
+		return;
+	
+	for(IOBuffer* io_buf = mBuffers.popFree(); io_buf != 0; io_buf = mBuffers.popFree()) {
+		if(mUring.submit(io_buf->getPtr(), io_buf->getSize(), io_buf->getIndex()) == -1) {
+			mBuffers.pushFree(io_buf);
+			break;
+		}
+		
+		mQueued[io_buf->getIndex()] = true;
+	}
+}
+
+IOBuffer* V4L2_VidCapManager::takeRead()
+{
+	// take the buffer of a finished read, called with the lock held
+	int index, n;
+	
+	while(mUring.complete(index, n) == 1) {
+		IOBuffer* io_buf = findBuffer(index);
+		
+		if(!io_buf)
+			continue;
+		
+		mQueued[index] = false;
+		
+		if(n > 0) {
+			setReadParams(io_buf, n);
+			return io_buf;
+		}
+		
+		// the read was interrupted, so try again, unless the device is gone or broken
+		if(n < 0 && n != -EAGAIN && n != -EINTR && !mReadFailed) {
+			logDebug(std::string("V4L2_VidCapManager: reading failed: ") + strerror(-n));
+			mReadFailed = true;
+		}
+		
+		mBuffers.pushFree(io_buf);
 	}
 	
 	return 0;
 }
 
-int V4L2_VidCapManager::stop_read()
+void V4L2_VidCapManager::setReadParams(IOBuffer* io_buf, int size)
 {
-	return 0;
+	// the driver doesn't provide a timestamp, so take it when the data has arrived
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	io_buf->setParams(size, IOBuffer::STATE_USED, (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec, 
+		IOBuffer::TIMESTAMP_MONOTONIC, mSequence++ + 1);
+	mAvailableBuffers--;
 }
 
 int V4L2_VidCapManager::start_mmap()
@@ -192,7 +349,7 @@ int V4L2_VidCapManager::start_mmap()
 	memset(&req, 0, sizeof(req));
 			
 	req.count	= mNumBufs;
-	req.type	= V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.type	= mBufType;
 	req.memory	= V4L2_MEMORY_MMAP;
 
 	if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_REQBUFS, &req) == -1)
@@ -204,43 +361,191 @@ int V4L2_VidCapManager::start_mmap()
 	mNumBufs = req.count;
 	
 	// enumerate the buffers
-	for(int i = 0; i < mNumBufs; i++) {
-		struct v4l2_buffer	buf;
-		memset(&buf, 0, sizeof(buf));
-		
-		buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		buf.memory      = V4L2_MEMORY_MMAP;
-		buf.index       = i;
-
-		if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_QUERYBUF, &buf) == -1) {
-			logDebug(std::string("V4L2_VidCapManager: QUERYBUF failed: ") + strerror(errno));
+	for(int i = 0; i < mNumBufs; i++)
+		if(mapBuffer(i) == 0)
 			return -1;
+	
+	// and allocate the cached memory for the copies of the frames
+	if(mCopyOut && createCopies() == -1)
+		return -1;
+
+	// enqueue the buffers into the incomming queue
+	for(int i = 0; i < mBuffers.size(); i++)
+		requeue(mBuffers.find(i));
+	
+	// and start capturing
+	int type = mBufType;
+	if (-1 == ioctl (mDeviceDescriptor->getHandle(), VIDIOC_STREAMON, &type)) {
+		logDebug(std::string("V4L2_VidCapManager: STREAMON failed: ") + strerror(errno));
+ 		return -1;
+ 	}
+ 	
+	return 0;
+}
+
+int V4L2_VidCapManager::stop_mmap()
+{
+int res = 0;
+
+	// mmap-specific stop capture method.	
+	int type = mBufType;
+	if (-1 == ioctl (mDeviceDescriptor->getHandle(), VIDIOC_STREAMOFF, &type))
+		return -1;
+
+	// and release all buffers
+	clearBuffers();
+
+	return res;
+}
+
+IOBuffer* V4L2_VidCapManager::mapBuffer(int index)
+{
+	// map a buffer of the driver and store it in the buffer list
+
+	struct v4l2_buffer	buf;
+	struct v4l2_plane	planes[VIDEO_MAX_PLANES];
+	
+	initBuffer(buf, planes, mBufType, V4L2_MEMORY_MMAP, mMemPlanes);
+	buf.index       = index;
+
+	if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_QUERYBUF, &buf) == -1) {
+		logDebug(std::string("V4L2_VidCapManager: QUERYBUF failed: ") + strerror(errno));
+		return 0;
+	}
+	
+	// mmap each plane to the userspace
+	void* ptrs[VIDEO_MAX_PLANES];
+	size_t lengths[VIDEO_MAX_PLANES];
+	
+	for(int p = 0; p < mMemPlanes; p++) {
+		off_t offset = buf.m.offset;
+		lengths[p] = buf.length;
+		
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+		if(mBufType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+			offset = planes[p].m.mem_offset;
+			lengths[p] = planes[p].length;
 		}
+#endif
 		
-		// and mmap them to the userspace
-		void *start = mmap (NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, 
-							mDeviceDescriptor->getHandle(), buf.m.offset);
-							
+		ptrs[p] = mmap (NULL, lengths[p], PROT_READ | PROT_WRITE, MAP_SHARED, 
+						mDeviceDescriptor->getHandle(), offset);
+						
 		// mmap failed
-		if(start == MAP_FAILED)	{
+		if(ptrs[p] == MAP_FAILED)	{
 			logDebug(std::string("V4L2_VidCapManager: mmap failed: ") + strerror(errno));
-			return -1;
+			
+			while(--p >= 0)
+				munmap(ptrs[p], lengths[p]);
+			
+			return 0;
 		}
+	}
+
+	// create an IOBuffer containing the mmaped buffer
+	IOBuffer *io_buf = new IOBuffer(this, ptrs[0], lengths[0], buf.index);
+	setLayout(io_buf, ptrs, lengths);
+	
+	// export it as dma-buf, if requested
+	if(mExportDmaBuf)
+		exportBuffer(io_buf);
+	
+	// the list may be read by other threads, when buffers are added while capturing
+	pthread_mutex_lock(&mLock);
+	mBuffers.insert(io_buf);
+	pthread_mutex_unlock(&mLock);
+	
+	return io_buf;
+}
 
-		// create an IOBuffer containing the mmaped buffer and store it in the buffer list
-		IOBuffer *io_buf = new IOBuffer(this, start, buf.length, buf.index);		
-		mBuffers.push_back(io_buf);
+void V4L2_VidCapManager::unmapBuffer(IOBuffer* io_buf)
+{
+	// close the exported dma-bufs and munmap the planes
+	if(mMemPlanes > 1) {
+		for(int p = 0; p < mMemPlanes; p++) {
+			if(io_buf->getDmaBufFd(p) != -1)
+				close(io_buf->getDmaBufFd(p));
+			
+			munmap(io_buf->getPlanePtr(p), io_buf->getPlaneSize(p));
+		}
+	} else {
+		if(io_buf->getDmaBufFd() != -1)
+			close(io_buf->getDmaBufFd());
+		
+		munmap(io_buf->getPtr(), io_buf->getSize());
 	}
+}
 
-	// enqueue the buffers into the incomming queue
-	for(IOBufList::iterator it = mBuffers.begin(); it != mBuffers.end(); it++) {
-		IOBuffer	*io_buf = *it;
-		io_buf->setState(IOBuffer::STATE_USED);
-		enqueue(io_buf);
+int V4L2_VidCapManager::start_userptr()
+{
+	// start capturing for the user pointer IO-method.
+
+	size_t size = mFormatMgr->getImageSize();
+	bool app_memory = mUserPtrs.size() > 0;
+	int count = app_memory ? mUserPtrs.size() : mNumBufs;
+	
+	// the buffers of the application must be able to hold a complete image
+	if(app_memory && mUserPtrSize < size) {
+		logDebug("V4L2_VidCapManager: user buffers too small for image size ", size);
+		return -1;
+	}
+	
+	// an application buffer is a single block of memory
+	if(app_memory && mMemPlanes > 1) {
+		logDebug("V4L2_VidCapManager: user buffers can't be used with multi-planar formats");
+		return -1;
+	}
+	
+	// otherwise each plane gets a buffer of the pool, which must hold the largest plane
+	if(mMemPlanes > 1) {
+		size = 0;
+		for(int p = 0; p < mMemPlanes; p++)
+			if(mPlaneSizes[p] > size)
+				size = mPlaneSizes[p];
+	}
+	
+	// tell the driver that we use user pointers
+	struct v4l2_requestbuffers req;
+	memset(&req, 0, sizeof(req));
+			
+	req.count	= count;
+	req.type	= mBufType;
+	req.memory	= V4L2_MEMORY_USERPTR;
+
+	if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_REQBUFS, &req) == -1) {
+		logDebug(std::string("V4L2_VidCapManager: REQBUFS for user pointers failed: ") + strerror(errno));
+		return -1;
 	}
+
+	// the driver may ask for a different number of buffers
+	if(req.count < (unsigned int) count)
+		count = req.count;
+	else if(!app_memory && req.count <= MAX_BUFFERS)
+		count = req.count;
+	
+	if(count < 2)
+		return -1;
+	
+	// get the memory from the pool if the application doesn't provide it. The pool has room 
+	// for the buffers that may be added later, their pages aren't touched until then.
+	int pool_count = count > mMaxBufs ? count : mMaxBufs;
+	
+	if(!app_memory && mPool.allocate(size, pool_count * mMemPlanes, mAllocFlags, mNumaNode) == -1)
+		return -1;
+	
+	mNumBufs = count;
+	
+	// create the IOBuffers
+	for(int i = 0; i < mNumBufs; i++)
+		if(createUserBuffer(i) == 0)
+			return -1;
+
+	// enqueue the buffers into the incomming queue
+	for(int i = 0; i < mBuffers.size(); i++)
+		requeue(mBuffers.find(i));
 	
 	// and start capturing
-	int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	int type = mBufType;
 	if (-1 == ioctl (mDeviceDescriptor->getHandle(), VIDIOC_STREAMON, &type)) {
 		logDebug(std::string("V4L2_VidCapManager: STREAMON failed: ") + strerror(errno));
  		return -1;
@@ -249,175 +554,1391 @@ int V4L2_VidCapManager::start_mmap()
 	return 0;
 }
 
-int V4L2_VidCapManager::stop_mmap()
+IOBuffer* V4L2_VidCapManager::createUserBuffer(int index)
 {
-int res = 0;
+	// create a buffer with the memory of the application or a slice of the pool
+	bool app_memory = mUserPtrs.size() > 0;
+	void* ptrs[VIDEO_MAX_PLANES];
+	size_t lengths[VIDEO_MAX_PLANES];
+	
+	if(app_memory ? index >= (int) mUserPtrs.size() : (index + 1) * mMemPlanes > mPool.getCount())
+		return 0;
+	
+	for(int p = 0; p < mMemPlanes; p++) {
+		ptrs[p] = app_memory ? mUserPtrs[index] : mPool.getBuffer(index * mMemPlanes + p);
+		lengths[p] = app_memory ? mUserPtrSize : mPool.getBufferSize();
+	}
+	
+	IOBuffer *io_buf = new IOBuffer(this, ptrs[0], lengths[0], index);
+	setLayout(io_buf, ptrs, lengths);
+	
+	pthread_mutex_lock(&mLock);
+	mBuffers.insert(io_buf);
+	pthread_mutex_unlock(&mLock);
+	
+	return io_buf;
+}
 
-	// mmap-specific stop capture method.	
-	int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+int V4L2_VidCapManager::stop_userptr()
+{
+	// user pointer specific stop capture method.
+	int type = mBufType;
 	if (-1 == ioctl (mDeviceDescriptor->getHandle(), VIDIOC_STREAMOFF, &type))
 		return -1;
-
-	// and release all buffers
-	clearBuffers();
-
-	return res;
-}
-
-int V4L2_VidCapManager::start_userptr()
-{
+
+	// let the driver unpin the user memory before it is released
+	struct v4l2_requestbuffers req;
+	memset(&req, 0, sizeof(req));
+	req.count	= 0;
+	req.type	= mBufType;
+	req.memory	= V4L2_MEMORY_USERPTR;
+	ioctl(mDeviceDescriptor->getHandle(), VIDIOC_REQBUFS, &req);
+
+	// and release all buffers
+	clearBuffers();
+
+	return 0;
+}
+
+bool V4L2_VidCapManager::isMemorySupported(int memory)
+{
+	// try to request a buffer of the given memory type to determine whether
+	// the driver supports it
+	struct v4l2_requestbuffers req;
+	memset(&req, 0, sizeof(req));
+	
+	req.count	= 1;
+	req.type	= mBufType;
+	req.memory	= memory;
+
+	if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_REQBUFS, &req) == -1)
+		return false;
+	
+	// and free the buffer on success
+	req.count	= 0;
+	ioctl(mDeviceDescriptor->getHandle(), VIDIOC_REQBUFS, &req);
+	
+	return true;
+}
+
+int V4L2_VidCapManager::exportBuffer(IOBuffer* io_buf)
+{
+	// get a dma-buf file descriptor for each plane of a mmaped driver buffer
+	for(int p = 0; p < mMemPlanes; p++) {
+		struct v4l2_exportbuffer exp;
+		memset(&exp, 0, sizeof(exp));
+		
+		exp.type	= mBufType;
+		exp.index	= io_buf->getIndex();
+		exp.plane	= p;
+		exp.flags	= O_RDWR | O_CLOEXEC;
+		
+		if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_EXPBUF, &exp) == -1) {
+			// the buffer is still usable through its mapping
+			logDebug(std::string("V4L2_VidCapManager: EXPBUF failed: ") + strerror(errno));
+			return -1;
+		}
+		
+		io_buf->setDmaBuf(p, exp.fd, 0);
+	}
+	
+	// the planes of a single buffer share its dma-buf
+	if(mMemPlanes == 1) {
+		for(int p = 1; p < io_buf->getNumPlanes(); p++)
+			io_buf->setDmaBuf(p, io_buf->getDmaBufFd(0), 
+				(char*) io_buf->getPlanePtr(p) - (char*) io_buf->getPlanePtr(0));
+	}
+	
+	return 0;
+}
+
+int V4L2_VidCapManager::queryLayout()
+{
+	// get the planes of the current format from the driver
+	struct v4l2_format fmt;
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = mBufType;
+	
+	if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_G_FMT, &fmt) == -1)
+		return -1;
+	
+	// resumeCapture() checks whether the buffers still fit
+	mStreamFormat = fmt;
+	
+	mPlaneStrides.clear();
+	mPlaneSizes.clear();
+	mMemPlanes = 1;
+	
+	unsigned int fourcc = fmt.fmt.pix.pixelformat;
+	unsigned int height = fmt.fmt.pix.height;
+	size_t bpl = fmt.fmt.pix.bytesperline;
+	size_t size = fmt.fmt.pix.sizeimage;
+	
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+	if(mBufType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+		mMemPlanes = fmt.fmt.pix_mp.num_planes;
+		
+		if(mMemPlanes < 1 || mMemPlanes > VIDEO_MAX_PLANES)
+			return -1;
+		
+		// each plane is a buffer of its own
+		if(mMemPlanes > 1) {
+			for(int p = 0; p < mMemPlanes; p++) {
+				mPlaneStrides.push_back(fmt.fmt.pix_mp.plane_fmt[p].bytesperline);
+				mPlaneSizes.push_back(fmt.fmt.pix_mp.plane_fmt[p].sizeimage);
+			}
+			
+			return 0;
+		}
+		
+		fourcc = fmt.fmt.pix_mp.pixelformat;
+		height = fmt.fmt.pix_mp.height;
+		bpl = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+		size = fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
+	}
+#endif
+	
+	// a single buffer may contain several planes one after another
+	size_t luma = bpl * height;
+	
+	switch(fourcc)
+	{
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV21:
+			mPlaneStrides.push_back(bpl);		mPlaneSizes.push_back(luma);
+			mPlaneStrides.push_back(bpl);		mPlaneSizes.push_back(luma / 2);
+		break;
+		
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_NV61:
+			mPlaneStrides.push_back(bpl);		mPlaneSizes.push_back(luma);
+			mPlaneStrides.push_back(bpl);		mPlaneSizes.push_back(luma);
+		break;
+		
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+			mPlaneStrides.push_back(bpl);		mPlaneSizes.push_back(luma);
+			mPlaneStrides.push_back(bpl / 2);	mPlaneSizes.push_back(luma / 4);
+			mPlaneStrides.push_back(bpl / 2);	mPlaneSizes.push_back(luma / 4);
+		break;
+		
+		case V4L2_PIX_FMT_YUV422P:
+			mPlaneStrides.push_back(bpl);		mPlaneSizes.push_back(luma);
+			mPlaneStrides.push_back(bpl / 2);	mPlaneSizes.push_back(luma / 2);
+			mPlaneStrides.push_back(bpl / 2);	mPlaneSizes.push_back(luma / 2);
+		break;
+	}
+	
+	// use a single plane for packed and compressed formats or if the layout doesn't fit
+	size_t total = 0;
+	for(unsigned int p = 0; p < mPlaneSizes.size(); p++)
+		total += mPlaneSizes[p];
+	
+	if(luma == 0 || total > size || mPlaneSizes.empty()) {
+		mPlaneStrides.assign(1, bpl);
+		mPlaneSizes.assign(1, size);
+	}
+	
+	return 0;
+}
+
+void V4L2_VidCapManager::setLayout(IOBuffer* io_buf, void* const* ptrs, const size_t* lengths)
+{
+	// describe the planes of a new buffer
+	io_buf->setNumPlanes(mPlaneSizes.size());
+	
+	if(mMemPlanes > 1) {
+		for(int p = 0; p < mMemPlanes; p++)
+			io_buf->setPlane(p, ptrs[p], mPlaneStrides[p], lengths[p]);
+		
+		return;
+	}
+	
+	// the planes follow each other, the last one gets the rest of the buffer
+	size_t offset = 0;
+	
+	for(unsigned int p = 0; p < mPlaneSizes.size(); p++) {
+		size_t size = p + 1 < mPlaneSizes.size() ? mPlaneSizes[p] : lengths[0] - offset;
+		io_buf->setPlane(p, (char*) ptrs[0] + offset, mPlaneStrides[p], size);
+		offset += mPlaneSizes[p];
+	}
+}
+
+int V4L2_VidCapManager::setDmaBufExport(bool enable)
+{
+	if(mReactor != 0 || mPaused)
+		return -1;
+	
+	// only buffers allocated by the driver can be exported
+	if(enable && mMethod != IO_METHOD_MMAP)
+		return -1;
+	
+	mExportDmaBuf = enable;
+	
+	return 0;
+}
+
+int V4L2_VidCapManager::setIOMethod(IOMethod method)
+{
+	// the method can't be changed while capturing
+	if(mReactor != 0 || mPaused)
+		return -1;
+
+	switch(method)
+	{
+		case IO_METHOD_READ:
+			if(!mDeviceDescriptor->isRWDev())
+				return -1;
+		break;
+		
+		case IO_METHOD_MMAP:
+			if(!mDeviceDescriptor->isStreamingDev() || !isMemorySupported(V4L2_MEMORY_MMAP))
+				return -1;
+		break;
+
+		case IO_METHOD_USERPTR:
+			if(!mDeviceDescriptor->isStreamingDev() || !isMemorySupported(V4L2_MEMORY_USERPTR))
+				return -1;
+		break;
+		
+		default:
+			return -1;
+	}
+	
+	mMethod = method;
+	
+	return 0;
+}
+
+int V4L2_VidCapManager::setAllocFlags(int flags)
+{
+	if(mReactor != 0 || mPaused)
+		return -1;
+	
+	mAllocFlags = flags;
+	
+	return 0;
+}
+
+int V4L2_VidCapManager::setUserBuffers(void* const* ptrs, size_t size, int count)
+{
+	if(mReactor != 0 || mPaused)
+		return -1;
+
+	// go back to buffers allocated by the library
+	if(ptrs == 0) {
+		mUserPtrs.clear();
+		mUserPtrSize = 0;
+		return 0;
+	}
+	
+	if(count < 2 || count > MAX_BUFFERS || size == 0)
+		return -1;
+	
+	// application memory can only be used with user pointers
+	if(mMethod != IO_METHOD_USERPTR && setIOMethod(IO_METHOD_USERPTR) == -1)
+		return -1;
+	
+	mUserPtrs.assign(ptrs, ptrs + count);
+	mUserPtrSize = size;
+	
+	return 0;
+}
+
+int V4L2_VidCapManager::destroy()
+{
+	// cleanup stuff
+	int res = 0;
+
+	switch(mMethod)
+	{
+		case IO_METHOD_READ:
+		break;
+		
+		case IO_METHOD_MMAP:
+		break;
+
+		case IO_METHOD_USERPTR:
+		break;
+	}
+
+	// destroy mutex
+	pthread_mutex_destroy(&mLock);
+		
+	return res;
+}
+
+int V4L2_VidCapManager::setSharedCaptureThread(int group)
+{
+	if(mReactor != 0 || group >= CaptureReactor::MAX_SHARED)
+		return -1;
+	
+	mReactorGroup = group;
+	
+	return 0;
+}
+
+int V4L2_VidCapManager::setCaptureThreadPriority(SchedPolicy policy, int priority)
+{
+	if(mThreadParams.setPriority(policy, priority) == -1)
+		return -1;
+	
+	// a running thread is changed at once
+	return mReactor ? mReactor->configure(mThreadParams) : 0;
+}
+
+int V4L2_VidCapManager::setCaptureThreadAffinity(const int* cpus, int count)
+{
+	if(mThreadParams.setAffinity(cpus, count) == -1)
+		return -1;
+	
+	return mReactor ? mReactor->configure(mThreadParams) : 0;
+}
+
+int V4L2_VidCapManager::setNumaNode(int node)
+{
+	if(mReactor != 0 || node < -1)
+		return -1;
+	
+	mNumaNode = node;
+	
+	return 0;
+}
+
+int V4L2_VidCapManager::setBatchSize(int max_frames)
+{
+	if(mReactor != 0 || max_frames < 1)
+		return -1;
+	
+	// a batch can't be larger than the number of buffers
+	mBatchSize = max_frames <= MAX_BUFFERS ? max_frames : MAX_BUFFERS;
+	
+	return 0;
+}
+
+int V4L2_VidCapManager::getBatchSize()
+{
+	return mBatchSize;
+}
+
+int V4L2_VidCapManager::setBufferRange(int min_bufs, int max_bufs)
+{
+	if(mReactor != 0 || mPaused)
+		return -1;
+	
+	// a fixed number of buffers
+	if(min_bufs == 0 && max_bufs == 0) {
+		mMinBufs = mMaxBufs = 0;
+		return 0;
+	}
+	
+	if(min_bufs < 2 || max_bufs < min_bufs || max_bufs > MAX_BUFFERS)
+		return -1;
+	
+	mMinBufs = min_bufs;
+	mMaxBufs = max_bufs;
+	
+	// start within the range
+	mNumBufs = mNumBufs < min_bufs ? min_bufs : (mNumBufs > max_bufs ? max_bufs : mNumBufs);
+	
+	return 0;
+}
+
+int V4L2_VidCapManager::getBufferCount()
+{
+	return mNumBufs;
+}
+
+int V4L2_VidCapManager::setCopyOnHold(long long max_hold, int min_queued)
+{
+	if(mReactor != 0 || mPaused || max_hold < -1 || min_queued < 0)
+		return -1;
+	
+	mMaxHold = max_hold;
+	mMinQueued = min_queued;
+	
+	return 0;
+}
+
+int V4L2_VidCapManager::setCopyOut(bool enable)
+{
+	if(mReactor != 0 || mPaused)
+		return -1;
+	
+	// only the buffers of the driver may be uncached
+	if(enable && mMethod != IO_METHOD_MMAP)
+		return -1;
+	
+	mCopyOut = enable;
+	
+	return 0;
+}
+
+int V4L2_VidCapManager::createCopies()
+{
+	// one copy for each driver buffer, each memory plane gets a chunk of the pool
+	IOBuffer* first = mBuffers.find(0);
+	
+	if(!first)
+		return -1;
+	
+	size_t size = first->getSize();
+	
+	if(mMemPlanes > 1) {
+		size = 0;
+		for(int p = 0; p < mMemPlanes; p++)
+			if(first->getPlaneSize(p) > size)
+				size = first->getPlaneSize(p);
+	}
+	
+	if(mCopyPool.allocate(size, mNumBufs * mMemPlanes, mAllocFlags, mNumaNode) == -1)
+		return -1;
+	
+	// the copies are told apart from the driver buffers by their index
+	for(int i = 0; i < mNumBufs; i++) {
+		void* ptrs[VIDEO_MAX_PLANES];
+		size_t lengths[VIDEO_MAX_PLANES];
+		
+		for(int p = 0; p < mMemPlanes; p++) {
+			ptrs[p] = mCopyPool.getBuffer(i * mMemPlanes + p);
+			lengths[p] = mMemPlanes > 1 ? first->getPlaneSize(p) : first->getSize();
+		}
+		
+		IOBuffer *copy = new IOBuffer(this, ptrs[0], lengths[0], MAX_BUFFERS + i);
+		setLayout(copy, ptrs, lengths);
+		mCopies.insert(copy);
+		mCopies.pushFree(copy);
+	}
+	
+	return 0;
+}
+
+IOBuffer* V4L2_VidCapManager::copyOut(IOBuffer* io_buf)
+{
+	pthread_mutex_lock(&mLock);
+	IOBuffer* copy = mCopies.popFree();
+	pthread_mutex_unlock(&mLock);
+	
+	// all copies are held by the application, so deliver the driver buffer itself
+	if(!copy)
+		return io_buf;
+	
+	if(mMemPlanes > 1) {
+		for(int p = 0; p < mMemPlanes; p++)
+			StreamCopy::copy(copy->getPlanePtr(p), io_buf->getPlanePtr(p), io_buf->getPlaneSize(p));
+	} else {
+		StreamCopy::copy(copy->getPtr(), io_buf->getPtr(), io_buf->getValidBytes());
+	}
+	
+	copy->setParams(io_buf->getValidBytes(), IOBuffer::STATE_USED, io_buf->getTimestampNs(), 
+		io_buf->getTimestampClock(), io_buf->getSequence());
+	
+	requeue(io_buf);
+	
+	return copy;
+}
+
+void V4L2_VidCapManager::copyHeldBuffers()
+{
+	// copy the frames held too long, called from the reactor thread. Only a mmaped 
+	// buffer can get new memory, without changing the address known by the application.
+	if(mMethod != IO_METHOD_MMAP || mExportDmaBuf)
+		return;
+	
+	long long now = monotonicNs();
+	
+	// a short queue only takes frames, that have been held for some frame intervals
+	long long min_hold = mFrameInterval ? HOLD_FRAMES * mFrameInterval : -1;
+	
+	for(;;) {
+		// the oldest frame still held by the application
+		IOBuffer* oldest = 0;
+		
+		for(int i = 0; i < mBuffers.size() && i < MAX_BUFFERS; i++) {
+			IOBuffer* io_buf = mBuffers.find(i);
+			
+			if(!io_buf || mQueued[i] || mRetired[i] || mDequeueTime[i] == 0 || 
+				io_buf->getState() != IOBuffer::STATE_USED)
+				continue;
+			
+			if(!oldest || mDequeueTime[i] < mDequeueTime[oldest->getIndex()])
+				oldest = io_buf;
+		}
+		
+		if(!oldest)
+			break;
+		
+		long long hold = now - mDequeueTime[oldest->getIndex()];
+		bool low = mAvailableBuffers < mMinQueued && min_hold >= 0 && hold >= min_hold;
+		bool expired = mMaxHold >= 0 && hold >= mMaxHold;
+		
+		// the younger frames have been held even shorter
+		if(!low && !expired)
+			break;
+		
+		if(detachBuffer(oldest) == -1)
+			break;
+	}
+}
+
+int V4L2_VidCapManager::detachBuffer(IOBuffer* io_buf)
+{
+	// map the driver buffer again, the new IOBuffer replaces the held one in the buffer list
+	int index = io_buf->getIndex();
+	IOBuffer* slot = mapBuffer(index);
+	
+	if(slot == 0)
+		return -1;
+	
+	int regions = mMemPlanes > 1 ? mMemPlanes : 1;
+	
+	for(int p = 0; p < regions; p++) {
+		void* ptr = mMemPlanes > 1 ? io_buf->getPlanePtr(p) : io_buf->getPtr();
+		size_t size = mMemPlanes > 1 ? io_buf->getPlaneSize(p) : io_buf->getSize();
+		
+		// take a copy buffer of an earlier frame or allocate a new one
+		void* copy = MAP_FAILED;
+		
+		pthread_mutex_lock(&mLock);
+		for(unsigned int s = 0; s < mSpares.size(); s++) {
+			if(mSpares[s].second == size) {
+				copy = mSpares[s].first;
+				mSpares.erase(mSpares.begin() + s);
+				break;
+			}
+		}
+		pthread_mutex_unlock(&mLock);
+		
+		if(copy == MAP_FAILED)
+			copy = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		
+		// and move it over the mapping of the driver buffer, so the pointers stay valid
+		if(copy != MAP_FAILED) {
+			memcpy(copy, ptr, size);
+			
+			if(mremap(copy, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, ptr) == MAP_FAILED) {
+				munmap(copy, size);
+				copy = MAP_FAILED;
+			}
+		}
+		
+		if(copy == MAP_FAILED) {
+			logDebug(std::string("V4L2_VidCapManager: copying a held frame failed: ") + strerror(errno));
+			
+			// move the planes copied so far back to the driver buffer, which stays held
+			for(int q = 0; q < p; q++) {
+				if(mremap(slot->getPlanePtr(q), slot->getPlaneSize(q), slot->getPlaneSize(q), 
+						MREMAP_MAYMOVE | MREMAP_FIXED, io_buf->getPlanePtr(q)) == MAP_FAILED)
+					logDebug(std::string("V4L2_VidCapManager: restoring a held plane failed: ") + strerror(errno));
+			}
+			
+			pthread_mutex_lock(&mLock);
+			mBuffers.insert(io_buf);
+			pthread_mutex_unlock(&mLock);
+			
+			// the planes moved back aren't mapped at the new buffer anymore
+			if(p == 0) {
+				unmapBuffer(slot);
+			} else {
+				for(int q = p; q < regions; q++)
+					munmap(slot->getPlanePtr(q), slot->getPlaneSize(q));
+			}
+			
+			delete slot;
+			return -1;
+		}
+	}
+	
+	pthread_mutex_lock(&mLock);
+	mDetached.push_back(io_buf);
+	mDequeueTime[index] = 0;
+	pthread_mutex_unlock(&mLock);
+	
+	// the driver can fill the buffer again
+	return requeue(slot);
+}
+
+void V4L2_VidCapManager::freeDetached(IOBuffer* io_buf)
+{
+	// release the copy of a frame, called with the lock held
+	int regions = mMemPlanes > 1 ? mMemPlanes : 1;
+	
+	for(int p = 0; p < regions; p++) {
+		void* ptr = mMemPlanes > 1 ? io_buf->getPlanePtr(p) : io_buf->getPtr();
+		size_t size = mMemPlanes > 1 ? io_buf->getPlaneSize(p) : io_buf->getSize();
+		
+		// keep some copy buffers for the next slow consumer
+		if(mSpares.size() < MAX_SPARES)
+			mSpares.push_back(std::make_pair(ptr, size));
+		else
+			munmap(ptr, size);
+	}
+	
+	std::vector<IOBuffer*>::iterator it = std::find(mDetached.begin(), mDetached.end(), io_buf);
+	if(it != mDetached.end())
+		mDetached.erase(it);
+	
+	delete io_buf;
+}
+
+void V4L2_VidCapManager::measureFrame(IOBuffer* io_buf)
+{
+	// remember when the buffer was passed to the application and how often frames arrive
+	long long now = monotonicNs();
+	
+	mDequeueTime[io_buf->getIndex()] = now;
+	
+	if(mLastFrame != 0) {
+		long long interval = now - mLastFrame;
+		mFrameInterval = mFrameInterval ? (7 * mFrameInterval + interval) / 8 : interval;
+	}
+	
+	mLastFrame = now;
+	
+	// the driver has no buffer left to fill
+	if(mAvailableBuffers == 0)
+		mQueueEmpty++;
+}
+
+void V4L2_VidCapManager::measureRelease(IOBuffer* io_buf)
+{
+	// the time the handlers and the application have held the buffer, called with the lock held
+	long long& dequeued = mDequeueTime[io_buf->getIndex()];
+	
+	if(dequeued == 0)
+		return;
+	
+	long long hold = monotonicNs() - dequeued;
+	mHoldTime = mHoldTime ? (7 * mHoldTime + hold) / 8 : hold;
+	dequeued = 0;
+}
+
+void V4L2_VidCapManager::tuneBuffers()
+{
+	// adapt the number of buffers from time to time, called from the reactor thread
+	if(++mTuneFrames < TUNE_FRAMES || mFrameInterval == 0)
+		return;
+	
+	mTuneFrames = 0;
+	
+	// the read()-pool and the memory of the application can't grow
+	if(mMethod == IO_METHOD_READ || mUserPtrs.size() > 0)
+		return;
+	
+	// enough buffers to cover the time they are held, and some for the driver
+	long long held = (mHoldTime + mFrameInterval - 1) / mFrameInterval;
+	int needed = (int) (held < MAX_BUFFERS ? held : MAX_BUFFERS) + MIN_QUEUED;
+	
+	// the driver has run dry, so grow faster than the average suggests
+	if(mQueueEmpty > 0) {
+		int step = mNumBufs / 4 > 2 ? mNumBufs / 4 : 2;
+		needed = needed > mNumBufs + step ? needed : mNumBufs + step;
+	}
+	
+	mQueueEmpty = 0;
+	needed = needed < mMinBufs ? mMinBufs : (needed > mMaxBufs ? mMaxBufs : needed);
+	
+	if(needed > mNumBufs) {
+		mShrinkVotes = 0;
+		growBuffers(needed);
+	} else if(needed < mNumBufs) {
+		// shrink slowly, one buffer after some agreeing measurements
+		if(++mShrinkVotes >= SHRINK_VOTES) {
+			mShrinkVotes = 0;
+			shrinkBuffers(mNumBufs - 1);
+		}
+	} else {
+		mShrinkVotes = 0;
+	}
+}
+
+int V4L2_VidCapManager::growBuffers(int count)
+{
+	// take retired buffers back first, they still have their memory
+	for(int i = 0; i < mBuffers.size() && mNumBufs < count; i++) {
+		if(!mRetired[i])
+			continue;
+		
+		pthread_mutex_lock(&mLock);
+		mRetired[i] = false;
+		IOBuffer* io_buf = mBuffers.find(i);
+		bool parked = io_buf && mParked[i];
+		mParked[i] = false;
+		pthread_mutex_unlock(&mLock);
+		
+		mNumBufs++;
+		
+		// a buffer, that hasn't come back yet, is queued when it is released
+		if(parked)
+			requeue(io_buf);
+	}
+	
+#ifdef VIDIOC_CREATE_BUFS
+	if(mNumBufs >= count || mBuffers.size() >= MAX_BUFFERS)
+		return 0;
+	
+	// and let the driver allocate new buffers for the current format
+	struct v4l2_create_buffers create;
+	memset(&create, 0, sizeof(create));
+	
+	create.count = count - mNumBufs;
+	create.memory = mMethod == IO_METHOD_MMAP ? V4L2_MEMORY_MMAP : V4L2_MEMORY_USERPTR;
+	create.format = mStreamFormat;
+	
+	if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_CREATE_BUFS, &create) == -1) {
+		logDebug(std::string("V4L2_VidCapManager: CREATE_BUFS failed: ") + strerror(errno));
+		return -1;
+	}
+	
+	// the driver may create fewer buffers
+	for(unsigned int i = 0; i < create.count; i++) {
+		int index = create.index + i;
+		
+		if(index >= MAX_BUFFERS)
+			break;
+		
+		IOBuffer* io_buf = mMethod == IO_METHOD_MMAP ? mapBuffer(index) : createUserBuffer(index);
+		
+		if(io_buf == 0)
+			break;
+		
+		mNumBufs++;
+		requeue(io_buf);
+	}
+	
+	return 0;
+#else
+	return mNumBufs >= count ? 0 : -1;
+#endif
+}
+
+void V4L2_VidCapManager::shrinkBuffers(int count)
+{
+	// Retire the buffers with the highest indices, requeue() parks them when they come back. 
+	// A buffer isn't parked here, it may just have been released and wait in mReleased.
+	pthread_mutex_lock(&mLock);
+	
+	for(int i = mBuffers.size() - 1; i >= 0 && mNumBufs > count && mNumBufs > 2; i--) {
+		IOBuffer* io_buf = mBuffers.find(i);
+		
+		if(!io_buf || mRetired[i])
+			continue;
+		
+		mRetired[i] = true;
+		mNumBufs--;
+	}
+	
+	pthread_mutex_unlock(&mLock);
+}
+
+void V4L2_VidCapManager::parkBuffer(IOBuffer* io_buf)
+{
+	// give the memory of a retired buffer back, called by requeue() with the lock held
+	int index = io_buf->getIndex();
+	
+	// growBuffers() may queue it again
+	mParked[index] = true;
+	
+	if(mMethod == IO_METHOD_USERPTR && mUserPtrs.size() == 0) {
+		// the pages of the pool are faulted in again, if the buffer is taken back
+		for(int p = 0; p < mMemPlanes; p++)
+			madvise(mPool.getBuffer(index * mMemPlanes + p), mPool.getBufferSize(), MADV_DONTNEED);
+	}
+	
+#ifdef VIDIOC_REMOVE_BUFS
+	if(mMethod == IO_METHOD_MMAP) {
+		// the driver frees the memory when the buffer isn't mapped anymore
+		struct v4l2_remove_buffers remove;
+		memset(&remove, 0, sizeof(remove));
+		remove.index = index;
+		remove.count = 1;
+		remove.type = mBufType;
+		
+		unmapBuffer(io_buf);
+		
+		if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_REMOVE_BUFS, &remove) == -1)
+			logDebug(std::string("V4L2_VidCapManager: REMOVE_BUFS failed: ") + strerror(errno));
+		
+		// the index may be used by CREATE_BUFS again
+		mBuffers.remove(index);
+		mRetired[index] = false;
+		mParked[index] = false;
+		delete io_buf;
+	}
+#endif
+}
+
+int V4L2_VidCapManager::getPollHandle()
+{
+	// finished reads of the io_uring are signaled on its eventfd
+	return mUring.isOpen() ? mUring.getEventHandle() : mDeviceDescriptor->getHandle();
+}
+
+int V4L2_VidCapManager::getWakeupHandle()
+{
+	return mWakeupFd;
+}
+
+bool V4L2_VidCapManager::wantsPoll()
+{
+	// poll the device only if the driver can fill a buffer, no frames are taken before a restart
+	return mAvailableBuffers > 0 && !mFinish && !mRestartPending;
+}
+
+bool V4L2_VidCapManager::handleReady(bool device_ready)
+{
+	// called from the reactor thread to deliver the captured data
+
+	if(mFinish)
+		return true;
+
+	// on a wakeup just give the released buffers back to the driver
+	if(!device_ready) {
+		reclaimBuffers();
+		
+		if(mRestartPending)
+			checkRestart();
+		
+		return true;
+	}
+
+	if(mBatchSize > 1)
+		return handleBatch();
+	
+	// get the current data buffer
+	IOBuffer *io_buf = dequeue();
+	
+	if(!io_buf)
+		return false;
+	
+	// test whether finish flag has been set in between
+	if (!mFinish) {
+		// and call the capture handlers if any are registered
+		if(deliver(io_buf) == 0)
+	 		requeue(io_buf); // otherwise enqueue buffer directly
+	} else {
+		requeue(io_buf);
+	}
+	
+	// a handler may have stopped capturing and the buffers are gone
+	if(mFinish)
+		return true;
+	
+	// requeue the buffers released in between, including those released by the handler
+	reclaimBuffers();
+	
+	if(mMaxHold >= 0 || mMinQueued > 0)
+		copyHeldBuffers();
+	
+	if(mMaxBufs > 0)
+		tuneBuffers();
+	
+	return true;
+}
+
+bool V4L2_VidCapManager::handleBatch()
+{
+	// the device is non-blocking while capturing, so take all filled 
+	// buffers until the driver reports EAGAIN
+	IOBuffer* batch[MAX_BUFFERS];
+	int count = 0;
+	
+	while(count < mBatchSize) {
+		IOBuffer *io_buf = dequeue();
+		
+		if(!io_buf)
+			break;
+		
+		batch[count++] = io_buf;
+	}
+	
+	if(count == 0)
+		return false;
+	
+	// and deliver them with a single call of each handler
+	if(mFinish || deliverBatch(batch, count) == 0) {
+		for(int i = 0; i < count; i++)
+			requeue(batch[i]);
+	}
+	
+	if(mFinish)
+		return true;
+	
+	reclaimBuffers();
+	
+	if(mMaxHold >= 0 || mMinQueued > 0)
+		copyHeldBuffers();
+	
+	if(mMaxBufs > 0)
+		tuneBuffers();
+	
+	return true;
+}
+
+void V4L2_VidCapManager::reclaimBuffers()
+{
+	// requeue the buffers the application has released, called from the reactor thread only
+	for(IOBuffer* io_buf = mReleased.takeAll(); io_buf != 0; ) {
+		IOBuffer* next = io_buf->getNext();
+		requeue(io_buf);
+		io_buf = next;
+	}
+	
+	if(mAvailableBuffers > 0) {
+		mStarving = 0;
+		return;
+	}
+	
+	// the driver has no buffer left, so ask the releasing threads to wake us up. A buffer
+	// may have been released before they could see the flag, so look at the queue again.
+	__sync_lock_test_and_set(&mStarving, 1);
+	__sync_synchronize();
+	
+	for(IOBuffer* io_buf = mReleased.takeAll(); io_buf != 0; ) {
+		IOBuffer* next = io_buf->getNext();
+		requeue(io_buf);
+		io_buf = next;
+	}
+	
+	if(mAvailableBuffers > 0)
+		mStarving = 0;
+}
+
+void V4L2_VidCapManager::wakeup()
+{
+	// let the reactor poll the device again
+	if(mWakeupFd != -1)
+		eventfd_write(mWakeupFd, 1);
+}
+
+int V4L2_VidCapManager::createWakeup()
+{
+	// create the descriptor to wake up the reactor
+	mWakeupFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	
+	if(mWakeupFd == -1) {
+		logDebug(std::string("V4L2_VidCapManager: creating eventfd failed: ") + strerror(errno));
+		return -1;
+	}
+	
+	// the reactor must never block on the device
+	mFileFlags = fcntl(mDeviceDescriptor->getHandle(), F_GETFL);
+	if(mFileFlags != -1)
+		fcntl(mDeviceDescriptor->getHandle(), F_SETFL, mFileFlags | O_NONBLOCK);
+	
+	return 0;
+}
+
+void V4L2_VidCapManager::destroyWakeup()
+{
+	if(mWakeupFd != -1)
+		close(mWakeupFd);
+	
+	mWakeupFd = -1;
+	
+	// restore the blocking mode of the device
+	if(mFileFlags != -1)
+		fcntl(mDeviceDescriptor->getHandle(), F_SETFL, mFileFlags);
+	
+	mFileFlags = -1;
+}
+
+int V4L2_VidCapManager::startCapture()
+{
+int res = 0;
+
+	// hack for Logitech QuickCam Pro 5000
+	if(mDeviceDescriptor->getDriver() == "uvcvideo" && 
+		mFormatMgr->getFormat() && mFormatMgr->getFormat()->getName() == "YUYV")
+		mFormatMgr->setFramerate(30);
+		
+	// are we already capturing?
+	if(mReactor != 0 || mPaused)
+		return -1;
+	
+	// crop to the region of interest again, the driver may have reset it for a new source. 
+	// It is set before the format, which may depend on the size of the region.
+	if(((V4L2_FormatManager*) mFormatMgr)->applyCrop() == -1)
+		return -1;
+	
+	mFormatMgr->flush();
+	
+	// reset values
+	mFinish = 0;	
+	mRestartPending = false;
+	mBuffers.clear();
+	mSequence = 0;
+	mAvailableBuffers = 0;
+	memset(mQueued, 0, sizeof(mQueued));
+	memset(mRetired, 0, sizeof(mRetired));
+	memset(mParked, 0, sizeof(mParked));
+	memset(mDequeueTime, 0, sizeof(mDequeueTime));
+	mHoldTime = mFrameInterval = mLastFrame = 0;
+	mQueueEmpty = mTuneFrames = mShrinkVotes = 0;
+	mStartTime = monotonicNs();
+	mTimeToFirstFrame = -1;
+	openFrames();
+	
+	// get the planes of the captured images
+	if(queryLayout() == -1) {
+		logDebug("V4L2_VidCapManager: querying the format failed");
+		return -1;
+	}
+	
+	// create the wakeup descriptor
+	if(createWakeup() == -1)
+		return -1;
+	
+	subscribeEvents();
+
+	// call the IO-method-specific start-method
+	switch(mMethod)
+	{
+		case IO_METHOD_READ:
+			res = start_read();
+		break;
+		
+		case IO_METHOD_MMAP:
+			res = start_mmap();
+		break;
+
+		case IO_METHOD_USERPTR:
+			res = start_userptr();
+		break;
+	}
+
+	// and let a reactor thread receive the data
+	if(startReactor() == -1) {
+		unsubscribeEvents();
+		destroyWakeup();
+		return -1;
+	}
+
+	return res;
+}
+
+int V4L2_VidCapManager::startReactor()
+{
+	mReactor = CaptureReactor::acquire(mReactorGroup);
+	
+	if(mReactor == 0 || mReactor->attach(this) == -1) {
+		logDebug("V4L2_VidCapManager: starting the capture thread failed");
+		CaptureReactor::release(mReactor);
+		mReactor = 0;
+		return -1;
+	}
+	
+	// a failure is logged, but the thread keeps running with the default scheduling
+	mReactor->configure(mThreadParams);
+	
+	return 0;
+}
+
+void V4L2_VidCapManager::stopReactor()
+{
+    pthread_mutex_lock(&mLock);
+	mFinish = 1;
+	pthread_mutex_unlock(&mLock);
+	
+	// give back the frames queued for nextFrame(), this wakes up a blocked reactor
+	flushFrames();
+
+	// and wait till the reactor doesn't deliver data anymore
+	mReactor->detach(this);
+	CaptureReactor::release(mReactor);
+	mReactor = 0;
+	
+	// a frame may have been passed to the thread pool in between
+	waitDispatched();
+}
+
+int V4L2_VidCapManager::pauseCapture()
+{
+	if(mReactor == 0 || mPaused)
+		return -1;
+	
+	// keep the buffers released by the application in the meantime
+	mPaused = true;
+	stopReactor();
+	
+	// the driver gives back all buffers, they stay mapped and are queued again by resumeCapture()
+	if(mMethod != IO_METHOD_READ) {
+		int type = mBufType;
+		if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_STREAMOFF, &type) == -1)
+			logDebug(std::string("V4L2_VidCapManager: STREAMOFF failed: ") + strerror(errno));
+		
+		mAvailableBuffers = 0;
+	} else {
+		// don't read frames, that are delivered after resuming
+		closeUring();
+	}
+	
+	return 0;
+}
+
+int V4L2_VidCapManager::resumeCapture()
+{
+	if(!mPaused)
+		return -1;
+	
+	mStartTime = monotonicNs();
+	
+	// the format may have been changed while paused, then the buffers must be reallocated
+	struct v4l2_format fmt;
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = mBufType;
+	
+	if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_G_FMT, &fmt) == -1 || !sameLayout(fmt, mStreamFormat)) {
+		stopCapture();
+		return startCapture();
+	}
+	
+	mTimeToFirstFrame = -1;
+	openFrames();
+	
+	pthread_mutex_lock(&mLock);
+	mFinish = 0;
+	mPaused = false;
+	pthread_mutex_unlock(&mLock);
+	
+	if(mMethod != IO_METHOD_READ) {
+		// queue the buffers the driver has owned when capturing was paused
+		for(int i = 0; i < mBuffers.size() && i < MAX_BUFFERS; i++)
+			if(mQueued[i] && mBuffers.find(i))
+				requeue(mBuffers.find(i));
+	}
+	
+	if(mMethod == IO_METHOD_READ && openUring() == 0) {
+		pthread_mutex_lock(&mLock);
+		submitReads();
+		pthread_mutex_unlock(&mLock);
+	}
+	
+	// and those released by the application
+	reclaimBuffers();
+	
+	if(mMethod != IO_METHOD_READ) {
+		int type = mBufType;
+		if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_STREAMON, &type) == -1) {
+			logDebug(std::string("V4L2_VidCapManager: STREAMON failed: ") + strerror(errno));
+			stopCapture();
+			return -1;
+		}
+	}
+	
+	if(startReactor() == -1) {
+		stopCapture();
+		return -1;
+	}
 	
 	return 0;
 }
 
-int V4L2_VidCapManager::stop_userptr()
+int V4L2_VidCapManager::setDeviceEvents(int mask)
 {
+	if(mReactor != 0 || mPaused)
+		return -1;
+	
+	mEventMask = mask;
+	
 	return 0;
 }
 
-int V4L2_VidCapManager::destroy()
+void V4L2_VidCapManager::subscribeEvents()
 {
-	// cleanup stuff
-	int res = 0;
-
-	switch(mMethod)
-	{
-		case IO_METHOD_READ:
-		break;
+	// subscribe the events the application is interested in, drivers reject unsupported ones
+	mSubscribed = false;
+	
+#ifdef VIDIOC_SUBSCRIBE_EVENT
+	int fd = mDeviceDescriptor->getHandle();
+	struct v4l2_event_subscription sub;
+	
+	static const struct { int event; unsigned int type; } types[] = {
+#ifdef V4L2_EVENT_SOURCE_CHANGE
+		{ CaptureHandler::EVENT_SOURCE_CHANGE, V4L2_EVENT_SOURCE_CHANGE },
+#endif
+#ifdef V4L2_EVENT_EOS
+		{ CaptureHandler::EVENT_EOS, V4L2_EVENT_EOS },
+#endif
+#ifdef V4L2_EVENT_FRAME_SYNC
+		{ CaptureHandler::EVENT_FRAME_SYNC, V4L2_EVENT_FRAME_SYNC },
+#endif
+		{ -1, 0 }
+	};
+	
+	for(int i = 0; types[i].event != -1; i++) {
+		if(!(mEventMask & (1 << types[i].event)))
+			continue;
 		
-		case IO_METHOD_MMAP:
-		break;
-
-		case IO_METHOD_USERPTR:
-		break;
+		memset(&sub, 0, sizeof(sub));
+		sub.type = types[i].type;
+		
+		if(ioctl(fd, VIDIOC_SUBSCRIBE_EVENT, &sub) == 0)
+			mSubscribed = true;
 	}
-
-	// destroy mutex
-	pthread_mutex_destroy(&mLock);
+	
+#ifdef V4L2_EVENT_CTRL
+	// control events are subscribed for each control
+	if(mEventMask & (1 << CaptureHandler::EVENT_CONTROL)) {
+		struct v4l2_queryctrl qc;
+		memset(&qc, 0, sizeof(qc));
+		qc.id = V4L2_CTRL_FLAG_NEXT_CTRL;
 		
-	return res;
+		while(ioctl(fd, VIDIOC_QUERYCTRL, &qc) == 0) {
+			if(!(qc.flags & V4L2_CTRL_FLAG_DISABLED) && qc.type != V4L2_CTRL_TYPE_CTRL_CLASS) {
+				memset(&sub, 0, sizeof(sub));
+				sub.type = V4L2_EVENT_CTRL;
+				sub.id = qc.id;
+				
+				if(ioctl(fd, VIDIOC_SUBSCRIBE_EVENT, &sub) == 0)
+					mSubscribed = true;
+			}
+			
+			qc.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
+		}
+	}
+#endif
+#endif
 }
 
-void V4L2_VidCapManager::run(void* mgr)
+void V4L2_VidCapManager::unsubscribeEvents()
 {
-	// capture main loop
-
-	V4L2_VidCapManager* io_mgr = (V4L2_VidCapManager*) mgr;
-
-	// run the loop until finish flag is set
-	while(!io_mgr->mFinish) {
-		fd_set fds;
-		struct timeval tv;
-
-		FD_ZERO(&fds);
-		FD_SET (io_mgr->mDeviceDescriptor->getHandle(), &fds);
-
-		// Timeout 1 sec.
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
-
-		// wait until data is available or time is running out		
-		int res = select (io_mgr->mDeviceDescriptor->getHandle() + 1, &fds, 0, 0, &tv);
+#ifdef VIDIOC_UNSUBSCRIBE_EVENT
+	if(mSubscribed) {
+		struct v4l2_event_subscription sub;
+		memset(&sub, 0, sizeof(sub));
+		sub.type = V4L2_EVENT_ALL;
+		
+		ioctl(mDeviceDescriptor->getHandle(), VIDIOC_UNSUBSCRIBE_EVENT, &sub);
+	}
+#endif
+	
+	mSubscribed = false;
+}
 
-		// an error occured
-		if (-1 == res) {
-			if (EINTR == errno)
-				continue;
-		}
+bool V4L2_VidCapManager::wantsEvents()
+{
+	return mSubscribed && !mFinish;
+}
 
-		// get the current data buffer
-		/*
-		timeval start, end;
-		gettimeofday(&start, 0);
-		*/
-		
-		IOBuffer *io_buf = io_mgr->dequeue();
-
-		/*
-		gettimeofday(&end, 0);		
-		std::cerr<<"capturing took: "<<(end.tv_usec- start.tv_usec)/1000.0<<"   ms\n";
-		*/
-		
-		if(io_buf) {
-			// test whether finish flag has been set in between
-			if (!io_mgr->mFinish) {
-				// and call the capture handler if one is registered
-				if(io_mgr->getCaptureHandler()) {
-					// std::cout<<"Calling capture-handler for #"<<io_buf->getSequence()<<"\n";
-			 		io_mgr->getCaptureHandler()->handleCaptureEvent(io_buf);
-				} else {
-			 		io_mgr->enqueue(io_buf); // otherwise enqueue buffer directly
-				}
-			} else {
-				io_mgr->enqueue(io_buf);
-			}
-		} else {
-			// wait 5 ms to give clients the chance to free a buffer without polling on select
-			usleep((int)(1000.0*5));
+void V4L2_VidCapManager::handleEvents()
+{
+	// called from the reactor thread, if the driver has queued events
+	bool restart = false;
+	
+#ifdef VIDIOC_DQEVENT
+	struct v4l2_event ev;
+	
+	while(!mFinish) {
+		memset(&ev, 0, sizeof(ev));
+		
+		if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_DQEVENT, &ev) == -1)
+			break;
+		
+		switch(ev.type)
+		{
+#ifdef V4L2_EVENT_SOURCE_CHANGE
+			case V4L2_EVENT_SOURCE_CHANGE:
+				// the buffers don't fit anymore, if the resolution has changed
+				if(ev.u.src_change.changes & V4L2_EVENT_SRC_CH_RESOLUTION)
+					restart = true;
+				
+				deliverEvent(CaptureHandler::EVENT_SOURCE_CHANGE, ev.u.src_change.changes);
+			break;
+#endif
+#ifdef V4L2_EVENT_EOS
+			case V4L2_EVENT_EOS:
+				deliverEvent(CaptureHandler::EVENT_EOS, 0);
+			break;
+#endif
+#ifdef V4L2_EVENT_FRAME_SYNC
+			case V4L2_EVENT_FRAME_SYNC:
+				deliverEvent(CaptureHandler::EVENT_FRAME_SYNC, ev.u.frame_sync.frame_sequence);
+			break;
+#endif
+#ifdef V4L2_EVENT_CTRL
+			case V4L2_EVENT_CTRL:
+				deliverEvent(CaptureHandler::EVENT_CONTROL, ev.id);
+			break;
+#endif
 		}
+		
+		if(ev.pending == 0)
+			break;
+	}
+#endif
+	
+	if(restart && !mFinish) {
+		mRestartPending = true;
+		checkRestart();
 	}
 }
 
-int V4L2_VidCapManager::startCapture()
+void V4L2_VidCapManager::checkRestart()
 {
-int res = 0;
-
-	// hack for Logitech QuickCam Pro 5000
-	if(mDeviceDescriptor->getDriver() == "uvcvideo" && 
-		mFormatMgr->getFormat() && mFormatMgr->getFormat()->getName() == "YUYV")
-		mFormatMgr->setFramerate(30);
-		
-	mFormatMgr->flush();
+	// restart the capture once the application has released all frames, since stopCapture() 
+	// frees their buffers. Called from the reactor thread.
+	reclaimBuffers();
 	
-	// is the capture thread already running?
-	if(mThread != 0)
-		return -1;
+	// every release has to wake us up from now on
+	__sync_lock_test_and_set(&mStarving, 1);
+	__sync_synchronize();
 	
-	// reset values
-	mFinish = 0;	
-	mBuffers.clear();
-	mSequence = 0;
+	for(IOBuffer* io_buf = mReleased.takeAll(); io_buf != 0; ) {
+		IOBuffer* next = io_buf->getNext();
+		requeue(io_buf);
+		io_buf = next;
+	}
 	
-	// reset cropping params
-	struct v4l2_cropcap cropcap;
-	struct v4l2_crop crop;
+	pthread_mutex_lock(&mLock);
 	
-	memset (&cropcap, 0, sizeof (cropcap));
-	cropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	bool held = false;
 	
-	// drivers should implement this ioctl, but not all do so
-	if (-1 != ioctl (mDeviceDescriptor->getHandle(), VIDIOC_CROPCAP, &cropcap)) {
-		// reset cropping only if it is supported
-		memset (&crop, 0, sizeof (crop));
-		crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		crop.c = cropcap.defrect; 
-		
-		// Ignore if cropping is not supported (EINVAL)
-		if (-1 == ioctl (mDeviceDescriptor->getHandle(), VIDIOC_S_CROP, &crop) && errno != EINVAL) 
-			return -1;
+	for(int i = 0; i < mBuffers.size() && i < MAX_BUFFERS && !held; i++) {
+		IOBuffer* io_buf = mBuffers.find(i);
+		held = io_buf && !mQueued[i] && io_buf->getState() == IOBuffer::STATE_USED;
 	}
 	
-	// call the IO-method-specific start-method
-	switch(mMethod)
-	{
-		case IO_METHOD_READ:
-			res = start_read();
-		break;
-		
-		case IO_METHOD_MMAP:
-			res = start_mmap();
-		break;
-
-		case IO_METHOD_USERPTR:
-			res = start_userptr();
-		break;
+	for(int i = 0; i < mCopies.size() && !held; i++) {
+		IOBuffer* copy = mCopies.find(i);
+		held = copy && copy->getState() == IOBuffer::STATE_USED;
 	}
+	
+	pthread_mutex_unlock(&mLock);
+	
+	if(!held)
+		restartCapture();
+}
+
+void V4L2_VidCapManager::restartCapture()
+{
+	// reallocate the buffers for the new format of the source. Called from the reactor 
+	// thread, which leaves when this method returns and a new one is started.
+	logDebug("V4L2_VidCapManager: the source has changed, restarting the capture");
+	
+	stopCapture();
+	
+#ifdef VIDIOC_QUERY_DV_TIMINGS
+	// receivers report the new format after the detected timings have been set
+	struct v4l2_dv_timings timings;
+	memset(&timings, 0, sizeof(timings));
+	
+	if(ioctl(mDeviceDescriptor->getHandle(), VIDIOC_QUERY_DV_TIMINGS, &timings) == 0)
+		ioctl(mDeviceDescriptor->getHandle(), VIDIOC_S_DV_TIMINGS, &timings);
+#endif
+	
+	if(startCapture() == -1)
+		logDebug("V4L2_VidCapManager: restarting the capture failed");
+}
 
-	// create and start a new pthread
-	mThread = new pthread_t; 
-	pthread_create( mThread, 0,  (void* (*)(void*)) &V4L2_VidCapManager::run, (void*) this );
+bool V4L2_VidCapManager::isPaused()
+{
+	return mPaused;
+}
 
-	return res;
+long long V4L2_VidCapManager::getTimeToFirstFrame()
+{
+	return mTimeToFirstFrame;
 }
 
 int V4L2_VidCapManager::stopCapture()
@@ -427,18 +1948,28 @@ int res = 0;
 	// Stops capturing
 
 	// not capturing 
-    if(!mThread)
-    	return -1;
+	if(!mReactor && !mPaused)
+		return -1;
 
-    pthread_mutex_lock(&mLock);
-	mFinish = 1;
+	// stop the reactor, it isn't running while paused
+	if(mReactor)
+		stopReactor();
+	
+	pthread_mutex_lock(&mLock);
+	mPaused = false;
 	pthread_mutex_unlock(&mLock);
-
-	// and wait till thread has finished
-	pthread_join ( *mThread, 0);
-	// delete the thread
-	delete mThread;
-	mThread = 0;
+	
+	// wait for threads that are just releasing a buffer
+	__sync_synchronize();
+	while(mReleasing > 0)
+		sched_yield();
+	
+	// the released buffers are deleted with the others
+	mReleased.takeAll();
+	mStarving = 0;
+	
+	unsubscribeEvents();
+	destroyWakeup();
 
 	// call the IO-method specific stop mehtod
 	switch(mMethod)
@@ -457,12 +1988,16 @@ int res = 0;
 	}
 
 	// iterate the buffer list and mark all buffers UNUSED
-	for(IOBufList::iterator it = mBuffers.begin(); it != mBuffers.end(); it++)
+	for(int i = 0; i < mBuffers.size(); i++)
 	{
-		IOBuffer *buf = *it;
+		IOBuffer *buf = mBuffers.find(i);
 		if(buf)
 			(buf->setState(IOBuffer::STATE_UNUSED));
 	}
+	
+	for(int i = 0; i < mCopies.size(); i++)
+		if(mCopies.find(i))
+			mCopies.find(i)->setState(IOBuffer::STATE_UNUSED);
 
 	// and kick the buffers
 	clearBuffers();
@@ -472,70 +2007,142 @@ int res = 0;
 
 
 int V4L2_VidCapManager::enqueue(IOBuffer *io_buf)
+{
+	// called by IOBuffer::release() from any thread. The buffer is passed to the 
+	// reactor thread, which requeues it, so the caller neither blocks nor enters the kernel, 
+	// unless the driver has run out of buffers.
+
+	int res = 0;
+	
+	if(io_buf == 0)
+		return 0;
+	
+	// don't do anything, if already stopped. While paused the 
+	// buffers are collected and requeued by resumeCapture()
+	if(mFinish && !mPaused) {
+		// but the copies of held frames outlive stopCapture() until they are released
+		pthread_mutex_lock(&mLock);
+		if(std::find(mDetached.begin(), mDetached.end(), io_buf) != mDetached.end() && 
+			io_buf->changeState(IOBuffer::STATE_USED, IOBuffer::STATE_UNUSED))
+			freeDetached(io_buf);
+		pthread_mutex_unlock(&mLock);
+		
+		return 0;
+	}
+	
+	// stopCapture() waits for us before it deletes the buffers
+	__sync_fetch_and_add(&mReleasing, 1);
+	
+	if(!mFinish || mPaused) {
+		// a buffer must not be queued twice
+		if(io_buf->changeState(IOBuffer::STATE_USED, IOBuffer::STATE_UNUSED)) {
+			mReleased.push(io_buf);
+			
+			// wake up the reactor, if the device isn't polled
+			if(mStarving)
+				wakeup();
+		} else {
+			res = -1;
+		}
+	}
+	
+	__sync_fetch_and_sub(&mReleasing, 1);
+	
+	return res;
+}
+
+int V4L2_VidCapManager::requeue(IOBuffer *io_buf)
 {
 	// enqueues an IOBuffer into the queue of incomming buffers, 
-	// enables the driver to reuse the buffer
+	// enables the driver to reuse the buffer. Called from the reactor thread
+	// or before it has been started.
 
 	struct v4l2_buffer buf;
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
 	int res = 0;
 	
-	// don't do anything, if already stopped
-	if(mFinish)
+	pthread_mutex_lock(&mLock);
+	if(mFinish) {
+		pthread_mutex_unlock(&mLock);
+		return -1;
+	}
+	
+	// a copy of a frame is used for the next one
+	if(mCopies.find(io_buf->getIndex()) == io_buf) {
+		io_buf->setState(IOBuffer::STATE_UNUSED);
+		mCopies.pushFree(io_buf);
+		pthread_mutex_unlock(&mLock);
 		return 0;
+	}
 	
-	if(io_buf == 0 || io_buf->getState() == IOBuffer::STATE_UNUSED) 
+	if(io_buf->getIndex() >= MAX_BUFFERS) {
+		pthread_mutex_unlock(&mLock);
 		return -1;
+	}
+	
+	// the driver has got another buffer for the slot of a copied frame
+	if(mBuffers.find(io_buf->getIndex()) != io_buf) {
+		io_buf->setState(IOBuffer::STATE_UNUSED);
+		freeDetached(io_buf);
+		pthread_mutex_unlock(&mLock);
+		return 0;
+	}
+	
+	measureRelease(io_buf);
+	io_buf->setState(IOBuffer::STATE_UNUSED);
+	
+	// a retired buffer isn't given to the driver anymore
+	if(mRetired[io_buf->getIndex()]) {
+		parkBuffer(io_buf);
+		pthread_mutex_unlock(&mLock);
+		return 0;
+	}
 	
 	switch(mMethod)
 	{        
         case IO_METHOD_READ:
-        	// set the buffer state to unused 
-			pthread_mutex_lock(&mLock);
-			if(mFinish) {
-				pthread_mutex_unlock(&mLock);
-				// if the thread has already finished in between clear the buffer
-				clearBuffers();	
-				return -1;
-			}
-			
-			io_buf->setState(IOBuffer::STATE_UNUSED);
+			mBuffers.pushFree(io_buf);
 			mAvailableBuffers++;
-			pthread_mutex_unlock(&mLock);
+			
+			if(mUring.isOpen())
+				submitReads();
 		break;
 		
 		case IO_METHOD_MMAP:
-        	// set the buffer state to unused 	
-			pthread_mutex_lock(&mLock);
-			if(mFinish) {
-				pthread_mutex_unlock(&mLock);
-				// if the thread has already finished in between clear the buffer
-				clearBuffers();	
-				return -1;
-			}
-			
-			io_buf->setState(IOBuffer::STATE_UNUSED);
-			mAvailableBuffers++;
-				
-			// otherwise enqueue the buffer in the drivers incomming buffer queue
-			memset(&buf, 0, sizeof(v4l2_buffer));
-			buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-			buf.memory = V4L2_MEMORY_MMAP;
+		case IO_METHOD_USERPTR:
+			// enqueue the buffer in the drivers incomming buffer queue
+			initBuffer(buf, planes, mBufType, 
+				mMethod == IO_METHOD_MMAP ? V4L2_MEMORY_MMAP : V4L2_MEMORY_USERPTR, mMemPlanes);
 			buf.index = io_buf->getIndex();
 			
-			res = ioctl (mDeviceDescriptor->getHandle(), VIDIOC_QBUF, &buf);
+			// pass the memory of the buffer to the driver
+			if(mMethod == IO_METHOD_USERPTR) {
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+				if(mBufType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+					for(int p = 0; p < mMemPlanes; p++) {
+						planes[p].m.userptr = (unsigned long) io_buf->getPlanePtr(p);
+						planes[p].length = mMemPlanes > 1 ? io_buf->getPlaneSize(p) : io_buf->getSize();
+					}
+				} else
+#endif
+				{
+					buf.m.userptr = (unsigned long) io_buf->getPtr();
+					buf.length = io_buf->getSize();
+				}
+			}
 			
-			pthread_mutex_unlock(&mLock);
+			res = ioctl (mDeviceDescriptor->getHandle(), VIDIOC_QBUF, &buf);
 			
-			if(res)
-				return -1;
-		break;
-
-		// not implemented yet
-		case IO_METHOD_USERPTR:
+			if(res == 0) {
+				mAvailableBuffers++;
+				mQueued[io_buf->getIndex()] = true;
+			}
 		break;
 	}
 	
-	return 0;
+	pthread_mutex_unlock(&mLock);
+	
+	return res ? -1 : 0;
 }
 
 // get the current IOBuffer
@@ -543,6 +2150,7 @@ int V4L2_VidCapManager::enqueue(IOBuffer *io_buf)
 IOBuffer* V4L2_VidCapManager::dequeue()
 {
 struct v4l2_buffer buf;
+struct v4l2_plane planes[VIDEO_MAX_PLANES];
 IOBuffer *res = 0;
 	
 	switch(mMethod)
@@ -556,56 +2164,46 @@ IOBuffer *res = 0;
 				return 0;
 			}
 
-        	// find an unused buffer
-        	for(IOBufList::iterator it = mBuffers.begin(); it != mBuffers.end(); it++) {
-        		res = *it;
-        		// first fit
-        		if(res->getState() == IOBuffer::STATE_UNUSED)
-        			break;
-        	}
-        	
-        	// did we find a buffer
-        	if(res->getState() == IOBuffer::STATE_UNUSED) {
-        		// then compute the timestamp from the start-time, the framerate and the sequence number
-        		struct timeval	tv;
-
-        		// the time between 2 frames is given as rational number
-        		// so compute the elapsed time so far
-        		double elapsed = ((double) mSequence) * ((double)mDTNumerator)/((double)mDTDenominator);
-        		tv.tv_sec	= (int) trunc(elapsed);
-        		tv.tv_usec	= (int) ((elapsed - trunc(elapsed)) * 1000000);
+        	if(mUring.isOpen()) {
+        		// the kernel has already read the data, take a finished read
+        		res = takeRead();
         		
-        		// and add the start time
-        		tv.tv_sec += mStartTime.tv_sec;
-        		// did we have an overflow
-        		if( tv.tv_usec + mStartTime.tv_usec >= 1000000) {
-        			// then increase the seconds
-        			tv.tv_sec++;
-        			tv.tv_usec += mStartTime.tv_usec - 1000000;
-        		} else {
-	        		tv.tv_usec += mStartTime.tv_usec;
+        		if(res == 0) {
+        			// wait for the next completion, but don't miss one finished in between
+        			mUring.clearEvent();
+        			res = takeRead();
         		}
         		
+        		// and start reading into the buffers of failed reads again
+        		submitReads();
+        		
+        		pthread_mutex_unlock(&mLock);
+        		break;
+        	}
+        	
+        	// take an unused buffer from the free-list
+        	res = mBuffers.popFree();
+        	
+        	// did we find a buffer
+        	if(res != 0) {
 	        	// read the captured data
 				int n = read(mDeviceDescriptor->getHandle(), res->getPtr(), res->getSize());
 
 				// and update the buffer parameter
 				if(n > 0) {
-					// std::cout<<"found empty buffer "<<res<<" State before: "<< res->getState();
-					res->setParams(n, IOBuffer::STATE_USED, tv, mSequence++ + 1);
-					mAvailableBuffers--;
-					// std::cout<<" and after: "<<res->getState()<<"\n";
+					setReadParams(res, n);
 				} else {
+					// give the buffer back
+					mBuffers.pushFree(res);
 					res = 0;
 				}
-        	} else {
-				res = 0;
         	}
         	
         	pthread_mutex_unlock(&mLock);
 		break;
 		
 		case IO_METHOD_MMAP:
+		case IO_METHOD_USERPTR:
 			pthread_mutex_lock(&mLock);
 			if(mFinish) {
 				pthread_mutex_unlock(&mLock);
@@ -615,9 +2213,8 @@ IOBuffer *res = 0;
 			}
 
 			// just get the index of the current buffer from the driver
-			memset(&buf, 0, sizeof(v4l2_buffer));
-			buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-			buf.memory = V4L2_MEMORY_MMAP;
+			initBuffer(buf, planes, mBufType, 
+				mMethod == IO_METHOD_MMAP ? V4L2_MEMORY_MMAP : V4L2_MEMORY_USERPTR, mMemPlanes);
 			
 			if (-1 == ioctl (mDeviceDescriptor->getHandle(), VIDIOC_DQBUF, &buf)) {
 				pthread_mutex_unlock(&mLock);
@@ -626,56 +2223,57 @@ IOBuffer *res = 0;
 			
 			// and find the corresponding buffer object
 			res = findBuffer(buf.index);			
+			mQueued[buf.index] = false;
 			
 			if(buf.sequence == 0)
 				buf.sequence = mSequence++;
 			
 			// set the buffer parameters
 			if(res != 0) {
-				res->setParams(buf.bytesused, IOBuffer::STATE_USED, buf.timestamp, buf.sequence + 1);
+				size_t valid = buf.bytesused;
+				
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+				// the data of all planes is valid
+				if(mBufType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+					valid = 0;
+					for(int p = 0; p < mMemPlanes; p++)
+						valid += planes[p].bytesused;
+				}
+#endif
+				
+				res->setParams(valid, IOBuffer::STATE_USED, buf.timestamp, buf.sequence + 1);
+				res->setTimestamp(res->getTimestampNs(), getTimestampClock(buf.flags));
 				mAvailableBuffers--;
 			}
 			pthread_mutex_unlock(&mLock);
 			
 		break;
-
-		// not implemented yet
-		case IO_METHOD_USERPTR:
-		break;
 	}
 	
+	// measure how long it took to get the first frame after starting or resuming
+	if(res != 0 && mTimeToFirstFrame < 0)
+		mTimeToFirstFrame = monotonicNs() - mStartTime;
+	
+	if(res != 0 && (mMaxBufs > 0 || mMaxHold >= 0 || mMinQueued > 0))
+		measureFrame(res);
+	
+	// move the frame to cached memory and give the driver buffer back at once
+	if(res != 0 && mCopyOut && mMethod == IO_METHOD_MMAP)
+		res = copyOut(res);
+	
 	return res;
 }
 
 IOBuffer* V4L2_VidCapManager::findBuffer(int index)
 {
 	// Find a buffer by its unique index
-
-	IOBuffer	*io_buf = 0;
-	
-	// iterate the list and return the correct buffer object
-	for(IOBufList::iterator it = mBuffers.begin(); it != mBuffers.end(); it++) {
-		io_buf = *it;
-		if(io_buf->getIndex() == index)
-			break;
-	}
-
-	return io_buf;
+	return mBuffers.find(index);
 }
 
 int V4L2_VidCapManager::getUsedBufferCount()
 {
 	// Return the number of currently used buffers.
-
-	int res = 0;
-
-	// iterate the list and count the used buffers
-	for(IOBufList::iterator it = mBuffers.begin(); it != mBuffers.end(); it++)
-		if (*it)
-			if((*it)->getState() == IOBuffer::STATE_USED)
-				res++;
-	
-	return res;
+	return mBuffers.getUsedCount();
 }
 
 void V4L2_VidCapManager::clearBuffers()
@@ -687,34 +2285,65 @@ void V4L2_VidCapManager::clearBuffers()
 	pthread_mutex_lock(&mLock);
 
 	// iterate the buffer list
-	for(IOBufList::iterator it = mBuffers.begin(); it != mBuffers.end(); it++) {
-		IOBuffer *buf = *it;
+	for(int i = 0; i < mBuffers.size(); i++) {
+		IOBuffer *buf = mBuffers.find(i);
 		if(buf) {
 			if(buf->getState() == IOBuffer::STATE_UNUSED) {
 				// the buffer isn't needed anymore
 				switch(mMethod)
 				{
 					case IO_METHOD_READ:
-						// so delete
-						delete[] ((char*) buf->getPtr());
+						// the memory belongs to the pool
 					break;
 					
 					case IO_METHOD_MMAP:
-						// or munmap it
-						munmap(buf->getPtr(), buf->getSize());
+						unmapBuffer(buf);
+					break;
+					
+					case IO_METHOD_USERPTR:
+						// the memory belongs to the pool or to the application
 					break;
 				}
 				
 				// and delete the buffer
 				delete buf;
-				*it = 0;
+				mBuffers.remove(i);
 			}
 		}
 	}
 
-	// if no buffer is there anymore clear the list
-	if(getUsedBufferCount() == 0)
+	// the copied frames, that have been released
+	for(int i = 0; i < mCopies.size(); i++) {
+		IOBuffer* copy = mCopies.find(i);
+		if(copy && copy->getState() == IOBuffer::STATE_UNUSED) {
+			delete copy;
+			mCopies.remove(i);
+		}
+	}
+	
+	if(mCopies.getUsedCount() == 0) {
+		mCopies.clear();
+		mCopyPool.free();
+	}
+	
+	// the copies of frames, that have been held too long
+	for(unsigned int i = mDetached.size(); i > 0; i--)
+		if(mDetached[i - 1]->getState() == IOBuffer::STATE_UNUSED)
+			freeDetached(mDetached[i - 1]);
+
+	// if no buffer is there anymore clear the list and release the pool
+	if(getUsedBufferCount() == 0) {
 		mBuffers.clear();	
+		mPool.free();
+	}
+	
+	// and the copy buffers
+	if(mDetached.empty()) {
+		for(unsigned int i = 0; i < mSpares.size(); i++)
+			munmap(mSpares[i].first, mSpares[i].second);
+		
+		mSpares.clear();
+	}
 	
 	// and unlock
 	pthread_mutex_unlock(&mLock);
@@ -310,7 +310,8 @@ iec61883Reader::iec61883Reader( int p, int c, int bufSize,
 		IEEE1394Reader( c, bufSize ), m_port( p ), m_iec61883dv(0), 
 		m_resetHandler( resetHandler),
 		m_resetHandlerData( data ),
-		m_captureHandler(0)
+		m_captureHandler(0),
+		m_haveStartCpus(false)
 {
 	m_handle = NULL;
 }
@@ -340,6 +341,9 @@ bool iec61883Reader::StartThread()
 	{
 		isRunning = true;
 		pthread_create( &thread, NULL, ThreadProxy, this );
+		m_haveStartCpus = pthread_getaffinity_np( thread, sizeof( m_startCpus ), &m_startCpus ) == 0;
+		if ( !m_threadParams.isDefault() )
+			m_threadParams.apply( thread, m_haveStartCpus ? &m_startCpus : NULL );
 		pthread_mutex_unlock( &mutex );
 		return true;
 	}
@@ -376,6 +380,28 @@ void iec61883Reader::StopThread()
 }
 
 
+/** Set the scheduling policy, priority and CPU affinity of the receiver thread.
+ 
+    The parameters are applied to a running thread at once, otherwise
+    when the thread is started.
+ 
+    \return false, if the parameters couldn't be applied
+*/
+
+bool iec61883Reader::SetThreadParams( const ThreadParams& params )
+{
+	bool success = true;
+	
+	pthread_mutex_lock( &mutex );
+	m_threadParams = params;
+	if ( isRunning )
+		success = m_threadParams.apply( thread, m_haveStartCpus ? &m_startCpus : NULL ) == 0;
+	pthread_mutex_unlock( &mutex );
+	
+	return success;
+}
+
+
 void iec61883Reader::ResetHandler( void )
 {
 	if ( m_resetHandler )
@@ -78,6 +78,7 @@ int QT_VidCapManager::startCapture()
 	}
 
 	mFinish = false;
+	openFrames();
 	mThread = new pthread_t; 
 	pthread_create( mThread, 0,  (void* (*)(void*)) &QT_VidCapManager::threadFunc, (void*) this );
 
@@ -136,6 +137,9 @@ int QT_VidCapManager::stopCapture()
 	if(mThread) {
 		stopCaptureImpl();
 		
+		// give back the frames queued for nextFrame()
+		flushFrames();
+		
 		// wait for the right moment to set the flag
 		pthread_mutex_lock(&mLock);
 		mFinish = true;
@@ -261,6 +265,7 @@ int QT_VidCapManager::enqueue(IOBuffer *io_buf)
 		// delete the buffer if capture has already finished
 		delete[] ((uint8_t*) io_buf->getPtr());
 		delete io_buf;
+		pthread_mutex_unlock(&mLock);
 	} else {
 		io_buf->setState(IOBuffer::STATE_UNUSED);
 		mAvailableBuffers++;
@@ -470,11 +475,12 @@ void QT_VidCapManager::notifyCaptureHandler(void* data, size_t length, size_t by
 	tv.tv_usec = (msec - tv.tv_sec * 1000) * 1000;
 		
 	io_buf->setParams(std::min(length, io_buf->getSize()), IOBuffer::STATE_USED, tv, mSequence);
+	if(mTimeScale)
+		io_buf->setTimestamp((long long) time * 1000000000LL / mTimeScale, IOBuffer::TIMESTAMP_STREAM);
 	
-	// and finaly call the capture-handler
-	if(!mFinish && getCaptureHandler()) {
-		getCaptureHandler()->handleCaptureEvent(io_buf);
-	}
+	// and finaly call the capture-handlers or reuse the buffer, if there is none
+	if(!mFinish && deliver(io_buf) == 0)
+		enqueue(io_buf);
 }
 
 
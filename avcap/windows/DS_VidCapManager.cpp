@@ -70,6 +70,7 @@ int DS_VidCapManager::startCapture()
 	// Start capturing
 	
 	mSequence=0;
+	openFrames();
 
 	// Get the IGraphBuilder COM-Interface from capture filter
 	QzCComPtr<IGraphBuilder> FilterGraph;
@@ -128,6 +129,9 @@ int DS_VidCapManager::stopCapture()
 		mGrabberCallback->SetVideoCaptureManager(0);
 	}
 	
+	// delete the frames queued for nextFrame()
+	flushFrames();
+	
 	// Get the IGraphBuilder COM-Interface from capture filter
 	QzCComPtr<IGraphBuilder> FilterGraph;
 	QzCComPtr<ICaptureGraphBuilder2> CaptureGraphBuilder;
@@ -92,7 +92,7 @@ STDMETHODIMP SampleGrabberCallback::SampleCB(double Time, IMediaSample *pSample)
 	MutexGuard guard(mLock);
 	
 	// Call the capture handler if one is registered
-	if (mVidCapMngr->getCaptureHandler() != 0) {
+	if (mVidCapMngr->getNumCaptureHandlers() > 0) {
 		BYTE *SampleBuffer=0;
 	
 		if (FAILED(pSample->GetPointer(&SampleBuffer))) {
@@ -116,6 +116,9 @@ STDMETHODIMP SampleGrabberCallback::SampleCB(double Time, IMediaSample *pSample)
 
 		Buffer->setParams(pSample->GetActualDataLength(), IOBuffer::STATE_USED,
 				SampleStartTime, mVidCapMngr->mSequence);
+		
+		// the stream time is given in units of 100 ns
+		Buffer->setTimestamp(SampleStart.m_time * 100, IOBuffer::TIMESTAMP_STREAM);
 
 		if (mSampleGrabberFilter==0) {
 			return E_FAIL;
@@ -129,7 +132,11 @@ STDMETHODIMP SampleGrabberCallback::SampleCB(double Time, IMediaSample *pSample)
 			return E_FAIL;
 		}
 
-		mVidCapMngr->getCaptureHandler()->handleCaptureEvent(Buffer);
+		// the buffer is deleted when the last handler releases it
+		if (mVidCapMngr->deliver(Buffer) == 0) {
+			delete[] buf;
+			delete Buffer;
+		}
 		FreeMediaType(MediaType);
 	}
 
@@ -0,0 +1,157 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+#ifndef CAPTUREGROUP_H_
+#define CAPTUREGROUP_H_
+
+#ifndef _WIN32
+
+#include <pthread.h>
+#include <deque>
+#include <vector>
+
+#include "CaptureHandler.h"
+#include "avcap-export.h"
+
+namespace avcap
+{
+	class IOBuffer;
+	class CaptureManager;
+	
+	//! Abstract base class for handlers of aligned frames of a CaptureGroup.
+	
+	class AVCAP_Export FrameSetHandler
+	{
+	public:
+		//! Destructor
+		virtual inline ~FrameSetHandler()
+			{}
+		
+		//! This method is called, if each camera of the group has captured a frame within the tolerance.
+		/*! It is called from the capture thread of the camera that completed the set. 
+		 * Each frame must be released by IOBuffer::release(), when it isn't used anymore.
+		 * \param frames : one frame per camera, in the order the cameras have been added
+		 * \param count : the number of cameras */
+		virtual void handleFrameSet(IOBuffer** frames, int count) = 0;
+	};
+	
+	//! Captures with several devices and pairs their frames by timestamp.
+	
+	/*! Each camera is added by its CaptureManager. The group registers a capture handler with 
+	 * each manager and keeps the latest frames of every camera. As soon as each camera has a frame 
+	 * within the tolerance, a set is passed to the FrameSetHandler: it starts with the oldest waiting 
+	 * frame of the camera that is furthest ahead, each other camera contributes its waiting frame 
+	 * nearest to that timestamp. Older frames, which can't be part of a set anymore, are released. 
+	 * The frames aren't copied, only the pointers are passed. The timestamps of all cameras must refer 
+	 * to the same clock, e.g. the monotonic clock used by V4L2 drivers (see IOBuffer::getTimestampClock()).
+	 * The group isn't available on Windows. */
+	
+	class AVCAP_Export CaptureGroup
+	{
+	public:
+		enum
+		{
+			MAX_CAMERAS = 16,	//!< The maximum number of cameras in a group.
+			MAX_PENDING = 4		//!< The maximum number of frames kept per camera while waiting for the others.
+		};
+		
+		//! Statistics about the timing of a camera relative to the first camera of the group.
+		struct SkewStats
+		{
+			unsigned long	frameSets;	//!< The number of frame sets the camera contributed to.
+			unsigned long	dropped;	//!< The number of frames released without a matching set.
+			long long		meanSkew;	//!< The mean timestamp difference in nanoseconds.
+			long long		maxSkew;	//!< The largest absolute timestamp difference in nanoseconds.
+		};
+		
+	private:
+		class Member;
+		typedef std::vector<Member*> MemberList_t;
+		
+		pthread_mutex_t		mLock;
+		MemberList_t		mMembers;
+		FrameSetHandler*	mHandler;
+		long long			mTolerance;
+		bool				mStopped;
+		
+	public:
+		//! Constructor
+		/*! \param tolerance_ns : the maximum timestamp difference of the frames of a set in nanoseconds */
+		CaptureGroup(long long tolerance_ns = 5000000);
+		
+		//! Destructor
+		/*! Capturing must have been stopped before. */
+		virtual ~CaptureGroup();
+		
+		//! Add a camera to the group.
+		/*! Must be called while the group doesn't capture.
+		 * \param mgr : the capture manager of the camera
+		 * \return the index of the camera in the frame sets or -1 on failure */
+		int add(CaptureManager* mgr);
+		
+		//! Get the number of cameras.
+		int getNumCameras();
+		
+		//! Set the handler that receives the frame sets.
+		/*! The ownership of the handler remains at the caller.
+		 * \param handler : the handler or 0 to release the frame sets immediately */
+		void setFrameSetHandler(FrameSetHandler* handler);
+		
+		//! Set the maximum timestamp difference of the frames of a set.
+		/*! \param tolerance_ns : the tolerance in nanoseconds */
+		void setTolerance(long long tolerance_ns);
+		
+		//! Get the maximum timestamp difference of the frames of a set.
+		/*! \return the tolerance in nanoseconds */
+		long long getTolerance();
+		
+		//! Start capturing with all cameras.
+		/*! The cameras are started one after another with as little delay as possible. If a camera
+		 * fails, the cameras started before are stopped again.
+		 * \return 0 if successful, -1 on failure */
+		int startCapture();
+		
+		//! Stop capturing with all cameras.
+		/*! The frames waiting for a set are released before.
+		 * \return 0 if successful, -1 if a camera couldn't be stopped */
+		int stopCapture();
+		
+		//! Get the skew statistics of a camera.
+		/*! \param camera : the index of the camera
+		 * \param stats : receives the statistics
+		 * \return 0 if successful, -1 if there is no such camera */
+		int getSkewStats(int camera, SkewStats& stats);
+		
+		//! Reset the statistics of all cameras.
+		void resetStats();
+		
+	private:
+		void handleFrame(Member* member, IOBuffer* io_buf);
+		
+		void flush();
+	};
+}
+
+#endif // _WIN32
+#endif // CAPTUREGROUP_H_
@@ -34,11 +34,22 @@ namespace avcap
 	 * with the VidCapManager of the CaptureDevice. The VidCapManager will call handleCaptureEvent() 
 	 * always a new frame has been captured. If the buffer isn't used  
 	 * anymore the IOBuffer::release() method must be called in order to enable the
-	 * VidCapManager to reuse or release the buffer. */
+	 * VidCapManager to reuse or release the buffer. If batched delivery is enabled 
+	 * (see CaptureManager::setBatchSize()), all frames captured since the last wakeup are passed 
+	 * to handleCaptureBatch() at once. */
 
 	class AVCAP_Export CaptureHandler
 	{
 	public:
+		//! Events reported by the device, see handleDeviceEvent().
+		enum DeviceEvent
+		{
+			EVENT_SOURCE_CHANGE = 0,	//!< The input signal has changed, e.g. the resolution of an HDMI source.
+			EVENT_EOS,					//!< The last frame of the stream has been captured.
+			EVENT_FRAME_SYNC,			//!< A frame has started, sent before its data is available.
+			EVENT_CONTROL				//!< A control has been changed, e.g. by another application.
+		};
+		
 		//! Consturctor
 		inline CaptureHandler() 
 			{}
@@ -52,6 +63,25 @@ namespace avcap
 		 * called. 
 		 * \param io_buf The buffer containing the captured frame. */
 		virtual void handleCaptureEvent(class IOBuffer* io_buf) = 0;
+		
+		//! This method is called with several frames if batched delivery is enabled.
+		/*! The frames are ordered by their capture time and each of them must be released.
+		 * The default implementation calls handleCaptureEvent() for each frame.
+		 * \param io_bufs : the buffers containing the captured frames
+		 * \param count : the number of buffers */
+		virtual void handleCaptureBatch(class IOBuffer** io_bufs, int count)
+			{ for(int i = 0; i < count; i++) handleCaptureEvent(io_bufs[i]); }
+		
+		//! This method is called if the device reports an event.
+		/*! It is called from the capture thread like handleCaptureEvent(). After an EVENT_SOURCE_CHANGE 
+		 * that changed the resolution, no further frames are delivered and capturing is restarted with 
+		 * buffers for the new format, once all frames held by the handlers and the application have 
+		 * been released. The default implementation ignores the event.
+		 * \param event : the type of the event
+		 * \param value : the changes reported for EVENT_SOURCE_CHANGE, the sequence number of the frame 
+		 * for EVENT_FRAME_SYNC or the control id for EVENT_CONTROL */
+		virtual void handleDeviceEvent(DeviceEvent event, unsigned int value)
+			{}
 	};
 }
 
@@ -24,6 +24,8 @@
 #ifndef CAPTUREMANAGER_H_
 #define CAPTUREMANAGER_H_
 
+#include <stddef.h>
+
 #if !defined(_MSC_VER) && !defined(USE_PREBUILD_LIBS)
 # include "avcap-config.h"
 #endif
@@ -34,22 +36,26 @@ namespace avcap
 {
 	class CaptureHandler;
 	class IOBuffer;
+	class FrameQueue;
+	class DispatchPool;
+	class DispatchStrand;
 	
 	//! Abstract interface to access capture related tasks of a CaptureDevice.
 	
 	/*! An implementation of this class is provided by the API-specific CaptureDevice. 
-	 * The CaptureManager can be used by applications to register a CaptureHandler and
-	 * to start/stop the capture. There is only one CaptureHandler at the same time.
-	 * To distribute the captured data to more than one interested sink is the responsibility 
-	 * of the application. */
+	 * The CaptureManager can be used by applications to register CaptureHandlers and
+	 * to start/stop the capture. Up to MAX_HANDLERS handlers can be registered at the same time.
+	 * All of them get the same IOBuffer without copying it. The buffer is reference counted
+	 * and given back to the driver after each handler has called IOBuffer::release(). */
 	
 	class AVCAP_Export CaptureManager
 	{
 	public:
 		enum
 		{
-			MAX_BUFFERS = 32,	//!< The maximum number of IOBuffers.
-			DEFAULT_BUFFERS = 16	//!< The default number of used IOBuffers.
+			MAX_BUFFERS = 256,	//!< The maximum number of IOBuffers, most managers and drivers allow fewer.
+			DEFAULT_BUFFERS = 16,	//!< The default number of used IOBuffers.
+			MAX_HANDLERS = 8	//!< The maximum number of registered CaptureHandlers.
 		};
 		
 			
@@ -63,17 +69,56 @@ namespace avcap
 		};
 #endif
 
+		//! Flags to control the allocation of IOBuffers that are provided by the library.
+		enum AllocFlags
+		{
+			ALLOC_DEFAULT = 0,			//!< Use normal pages.
+			ALLOC_HUGEPAGES = 0x01,		//!< Back the buffers with 2 MB hugepages, if possible.
+			ALLOC_PREFAULT = 0x02		//!< Touch all pages of the buffers before capturing starts.
+		};
+		
+		//! What happens, if a frame is captured while the queue of nextFrame() is full.
+		enum OverloadPolicy
+		{
+			OVERLOAD_KEEP_NEWEST = 0,	//!< Release the oldest queued frame, with a depth of 1 only the latest frame is kept.
+			OVERLOAD_DROP_NEWEST,		//!< Keep the queued frames and release the new one.
+			OVERLOAD_BLOCK				//!< Let the capture thread wait until the application has taken a frame.
+		};
+		
+		//! Scheduling policies of the capture thread.
+		enum SchedPolicy
+		{
+			SCHED_POLICY_OTHER = 0,		//!< The default time-sharing policy.
+			SCHED_POLICY_FIFO,			//!< Real-time, first in first out.
+			SCHED_POLICY_RR				//!< Real-time, round robin.
+		};
+		
+		//! The threads the capture handlers are called from.
+		enum DispatchMode
+		{
+			DISPATCH_DIRECT = 0,		//!< Call the handlers from the capture thread.
+			DISPATCH_ORDERED,			//!< Call them from a shared thread pool, one frame after another.
+			DISPATCH_UNORDERED			//!< Call them from a shared thread pool, several frames concurrently.
+		};
+
 	private:
-		CaptureHandler*	mCaptureHandler;
+		CaptureHandler* volatile	mCaptureHandlers[MAX_HANDLERS];
+		FrameQueue*					mFrameQueue;
+		OverloadPolicy				mOverloadPolicy;
+		unsigned long				mDeliveredFrames;
+		unsigned long				mDriverDrops;
+		long						mLastSequence;
+		DispatchMode				mDispatchMode;
+		DispatchPool*				mDispatchPool;
+		DispatchStrand*				mDispatchStrand;
+		volatile int				mPosting;
 		
 	public:
 		//! Constructor
-		inline CaptureManager() : mCaptureHandler(0)
-			{}
+		CaptureManager();
 		
 		//! Destructor
-		virtual inline ~CaptureManager()
-			{}
+		virtual ~CaptureManager();
 		
 		//! Do basic initialization after startup.
 		virtual int init() = 0;
@@ -87,27 +132,183 @@ namespace avcap
 		//! Stop capturing data.
 		virtual int stopCapture() = 0;
 		
+		//! Pause capturing, but keep the buffers allocated.
+		/*! The driver stops streaming, but the buffers stay mapped, so resumeCapture() 
+		 * doesn't need to allocate them again. Frames held by the application remain valid 
+		 * and may be released while paused. stopCapture() may be called instead of resumeCapture(). 
+		 * The default implementation returns -1.
+		 * \return 0 if successful, -1 if not capturing or not supported */
+		virtual inline int pauseCapture()
+			{ return -1; }
+		
+		//! Continue capturing after pauseCapture().
+		/*! If the format has been changed in the meantime, the buffers are allocated 
+		 * again like by startCapture(). The default implementation returns -1.
+		 * \return 0 if successful, -1 on failure */
+		virtual inline int resumeCapture()
+			{ return -1; }
+		
+		//! Test whether capturing is paused.
+		/*! \return true, if pauseCapture() has been called and capturing hasn't been resumed or stopped */
+		virtual inline bool isPaused()
+			{ return false; }
+		
+		//! Get the time from starting or resuming the capture until the first frame has been received.
+		/*! \return the time in nanoseconds, -1 if no frame has been received yet or it isn't measured */
+		virtual inline long long getTimeToFirstFrame()
+			{ return -1; }
+		
+		//! Select the device events passed to CaptureHandler::handleDeviceEvent().
+		/*! By default all events except CaptureHandler::EVENT_FRAME_SYNC, which occurs for every frame, 
+		 * are reported if the driver supports them. Must be called before startCapture(). 
+		 * The default implementation returns -1.
+		 * \param mask : an or'ed combination of (1 << CaptureHandler::DeviceEvent)
+		 * \return 0 if successful, -1 on failure */
+		virtual inline int setDeviceEvents(int mask)
+			{ return -1; }
+		
 		//! Register a capture handler.
-		/*! Only one capture handler can be registered at the same time.
+		/*! Replaces all capture handlers registered before by \p handler.
 		 * The handlers CaptureHandler::handleCaptureEvent() method will be called,
 		 * if new data has been captured. The ownership of the handler remains at the caller.
 		 * He is responsible for removing and deleting the handler. 
 		 * \param handler The capture handler implementation.*/
-		virtual inline void registerCaptureHandler(CaptureHandler *handler) 
-			{ mCaptureHandler = handler; }
+		virtual void registerCaptureHandler(CaptureHandler *handler);
 
-		//! Remove the current capture handler.
-		/*! If a capture handler was registered before, then this handler will not be 
+		//! Remove all capture handlers.
+		/*! The handlers registered before will not be 
 		 * notified anymore if data has been captured. */ 
-		virtual inline void removeCaptureHandler()
-			{ mCaptureHandler = 0; }
+		virtual void removeCaptureHandler();
+		
+		//! Add a capture handler to the registered ones.
+		/*! Each handler gets every captured IOBuffer and has to release it. 
+		 * The handlers are called one after another from the capture thread. 
+		 * \param handler The capture handler implementation.
+		 * \return 0 on success, -1 if the handler is already registered or MAX_HANDLERS are registered */
+		virtual int addCaptureHandler(CaptureHandler *handler);
+		
+		//! Remove a single capture handler.
+		/*! A delivery to the handler that is in progress while the handler is removed is completed. 
+		 * If the handlers are called from a thread pool, the method waits until the pool has passed 
+		 * all frames delivered before to the handler, so it can be deleted afterwards. Called from 
+		 * a handler on the pool, it returns at once.
+		 * \param handler The capture handler to remove.
+		 * \return 0 on success, -1 if the handler isn't registered */
+		virtual int removeCaptureHandler(CaptureHandler *handler);
 		
 		//! Get the current CaptureHandler.
-		/*! Return the capture handler currently registered with registerCaptureHandler()
+		/*! Return the first registered capture handler
 		 * or 0, if no handler was registered before.
 		 * \return pointer to the capture handler */ 
-		virtual inline CaptureHandler* getCaptureHandler()
-			{ return mCaptureHandler; }
+		virtual CaptureHandler* getCaptureHandler();
+		
+		//! Get the number of registered capture handlers.
+		/*! \return the number of handlers */
+		int getNumCaptureHandlers();
+		
+		//! Pass a captured buffer to all registered capture handlers.
+		/*! The reference count of the buffer is set to the number of handlers before they are 
+		 * called. This method should not be used by applications.
+		 * \param io_buf The buffer containing the captured frame.
+		 * \return the number of handlers called. If it is 0, the caller still owns the buffer. */
+		int deliver(IOBuffer* io_buf);
+		
+		//! Pass several captured buffers to all registered capture handlers at once.
+		/*! Calls CaptureHandler::handleCaptureBatch() of each handler. The reference count 
+		 * of each buffer is set to the number of handlers before. This method should not be 
+		 * used by applications.
+		 * \param io_bufs : the buffers containing the captured frames, ordered by capture time
+		 * \param count : the number of buffers
+		 * \return the number of handlers called. If it is 0, the caller still owns the buffers. */
+		int deliverBatch(IOBuffer** io_bufs, int count);
+		
+		//! Pass an event of the device to all registered capture handlers.
+		/*! Calls CaptureHandler::handleDeviceEvent() of each handler. This method should not be 
+		 * used by applications.
+		 * \param event : one of CaptureHandler::DeviceEvent
+		 * \param value : the event specific value
+		 * \return the number of handlers called */
+		int deliverEvent(int event, unsigned int value);
+		
+		//! Wait for the next captured frame.
+		/*! This is an alternative to a CaptureHandler for applications that process the frames
+		 * in threads of their own. The first call registers an internal queue as capture handler, 
+		 * which stores the frames until they are taken by this method. Each returned frame must 
+		 * be released by IOBuffer::release(). If the application holds the maximum number of frames 
+		 * (see setFrameQueueLimits()), the method waits until one of them is released.
+		 * The method isn't available on Windows.
+		 * \param timeout_ms : the time to wait in milliseconds or -1 to wait forever
+		 * \return the oldest queued frame or 0, if the timeout expired or capturing has been stopped */
+		IOBuffer* nextFrame(int timeout_ms = -1);
+		
+		//! Take the next captured frame without waiting.
+		/*! \return the oldest queued frame or 0, if none is available */
+		IOBuffer* tryNextFrame();
+		
+		//! Set the limits of the frame queue used by nextFrame().
+		/*! \param depth : the number of queued frames, if the queue is full the oldest frame is dropped
+		 * \param max_held : the number of frames the application may hold at the same time
+		 * \return 0 on success, -1 if not supported */
+		int setFrameQueueLimits(int depth, int max_held);
+		
+		//! Stop queuing frames for nextFrame().
+		/*! The queued frames are released. */
+		void closeFrameQueue();
+		
+		//! Select what happens, if the application doesn't take the frames fast enough.
+		/*! The policy applies to the queue of nextFrame(). Use OVERLOAD_KEEP_NEWEST with a queue 
+		 * depth of 1 for live views, that always show the latest frame, and OVERLOAD_BLOCK for 
+		 * recorders, that must not lose frames in the library. Blocking the capture thread lets the driver 
+		 * run out of buffers, so the frames may be dropped by the driver instead, which shows up 
+		 * in getDriverDrops(). With a shared capture thread, OVERLOAD_BLOCK stalls all devices of 
+		 * the group while one queue is full, unless the frames are dispatched by a pool 
+		 * (see setDispatchMode()). The method isn't available on Windows.
+		 * \param policy : the new policy
+		 * \return 0 on success, -1 if not supported */
+		int setOverloadPolicy(OverloadPolicy policy);
+		
+		//! Get the current overload policy.
+		/*! \return the policy */
+		inline OverloadPolicy getOverloadPolicy() const
+			{ return mOverloadPolicy; }
+		
+		//! Select the threads the capture handlers are called from.
+		/*! By default the handlers are called from the capture thread, so a slow handler delays 
+		 * the next frame. The other modes pass the frames to a thread pool shared by all devices, 
+		 * the capture thread only exchanges the buffers with the driver. DISPATCH_ORDERED keeps the 
+		 * order of the frames of this device, with DISPATCH_UNORDERED the handlers of several frames 
+		 * may run at the same time, so they must be thread-safe. Handlers must not stop the capture 
+		 * in a pool mode. Must be called before startCapture(). The method isn't available on Windows.
+		 * \param mode : the new mode
+		 * \param threads : the number of threads, if the pool is created, 0 for one per CPU. If the pool 
+		 * is already used by another device, it must be 0 or the number of threads of the pool.
+		 * \return 0 on success, -1 if not supported or the running pool has another number of threads */
+		int setDispatchMode(DispatchMode mode, int threads = 0);
+		
+		//! Get the current dispatch mode.
+		/*! \return the mode */
+		inline DispatchMode getDispatchMode() const
+			{ return mDispatchMode; }
+		
+		//! Get the number of frames delivered to the capture handlers.
+		/*! \return the number of frames since the last call of resetFrameCounters() */
+		inline unsigned long getDeliveredFrames() const
+			{ return mDeliveredFrames; }
+		
+		//! Get the number of frames dropped by the driver.
+		/*! The number is computed from the gaps in the sequence numbers of the delivered frames, 
+		 * so it is only exact, if the driver numbers the frames it captures.
+		 * \return the number of frames since the last call of resetFrameCounters() */
+		inline unsigned long getDriverDrops() const
+			{ return mDriverDrops; }
+		
+		//! Get the number of frames dropped by the library.
+		/*! These are the frames released by the queue of nextFrame() according to the OverloadPolicy.
+		 * \return the number of frames since the last call of resetFrameCounters() */
+		unsigned long getLibraryDrops();
+		
+		//! Reset the frame counters.
+		void resetFrameCounters();
 		
 		//! Returns the number of IOBuffers currently available.
 		/*! The CaptureManager usually waits to capture the next frame until an IOBuffer is available.
@@ -115,7 +316,184 @@ namespace avcap
 		 * \return the number of IOBuffers. */
 		virtual int getNumIOBuffers() = 0;
 		
+#ifdef AVCAP_LINUX
+		//! Select the IO-method used to exchange the data with the driver.
+		/*! The method is chosen automatically when the device is opened. Call this
+		 * before startCapture() to force another method, e.g. IO_METHOD_USERPTR.
+		 * The default implementation returns -1.
+		 * \param method : the new IO-method
+		 * \return 0, if the device supports the method, -1 else */
+		virtual inline int setIOMethod(IOMethod method)
+			{ return -1; }
+#endif
+
+		//! Set the flags used to allocate the IOBuffers that are provided by the library.
+		/*! This affects only buffers that aren't allocated by the driver, i.e. the read and user pointer
+		 * methods under Linux. Must be called before startCapture(). The default implementation returns -1.
+		 * \param flags : an or'ed combination of AllocFlags
+		 * \return 0 if successful, -1 on failure */
+		virtual inline int setAllocFlags(int flags)
+			{ return -1; }
+
+		//! Let the driver capture into memory provided by the application.
+		/*! The captured frames land directly in the given buffers, e.g. the input buffers of 
+		 * an encoder, so no copy is necessary. The memory remains owned by the application and 
+		 * must stay valid until stopCapture() has returned and all IOBuffers have been released. 
+		 * Buffers should be page-aligned. Must be called before startCapture(). 
+		 * Pass 0 as \p ptrs to let the library allocate the buffers again.
+		 * The default implementation returns -1.
+		 * \param ptrs : array of \p count buffer addresses
+		 * \param size : the size of each buffer, must hold at least one image
+		 * \param count : the number of buffers
+		 * \return 0 if successful, -1 on failure */
+		virtual inline int setUserBuffers(void* const* ptrs, size_t size, int count)
+			{ return -1; }
+
+		//! Export the capture buffers as dma-bufs.
+		/*! If enabled, each IOBuffer provides a dma-buf file descriptor (see IOBuffer::getDmaBufFd()),
+		 * so frames can be passed to other devices or processes without the CPU touching the pixels.
+		 * The buffers are still returned to the driver by IOBuffer::release(). Must be called before 
+		 * startCapture(). The default implementation returns -1.
+		 * \param enable : true to export the buffers
+		 * \return 0 if successful, -1 if not supported */
+		virtual inline int setDmaBufExport(bool enable)
+			{ return -1; }
+
+		//! Let the device share its capture thread with other devices.
+		/*! By default each capturing device has its own thread. All devices with the same
+		 * \p group are served by a single thread instead, which saves threads and context switches
+		 * on hosts with many cameras. The capture handlers of a group are called one after another,
+		 * so they should return quickly. A frame queue with OVERLOAD_BLOCK blocks the whole group. 
+		 * Must be called before startCapture().
+		 * The default implementation returns -1.
+		 * \param group : the group of devices sharing a thread or -1 for a thread of its own
+		 * \return 0 if successful, -1 on failure, e.g. if the group exceeds the number of shared threads */
+		virtual inline int setSharedCaptureThread(int group)
+			{ return -1; }
+
+		//! Set the scheduling policy and priority of the capture thread.
+		/*! Real-time scheduling keeps other threads from delaying the capture thread. It usually 
+		 * requires CAP_SYS_NICE or an RLIMIT_RTPRIO, if it can't be applied, the thread keeps 
+		 * the default policy. The settings take effect immediately or when capturing is started. 
+		 * Devices sharing a capture thread should use the same settings. 
+		 * The default implementation returns -1.
+		 * \param policy : the scheduling policy
+		 * \param priority : the static priority, e.g. 1 to 99 for the real-time policies under Linux
+		 * \return 0 if successful, -1 on failure */
+		virtual inline int setCaptureThreadPriority(SchedPolicy policy, int priority)
+			{ return -1; }
+
+		//! Bind the capture thread to some CPUs.
+		/*! The settings take effect immediately or when capturing is started.
+		 * The default implementation returns -1.
+		 * \param cpus : array of \p count CPU numbers or 0 to allow all CPUs
+		 * \param count : the number of CPUs
+		 * \return 0 if successful, -1 on failure */
+		virtual inline int setCaptureThreadAffinity(const int* cpus, int count)
+			{ return -1; }
+
+		//! Allocate the IOBuffers provided by the library on a NUMA node.
+		/*! Should be the node of the CPUs the capture thread and the handlers run on, to avoid 
+		 * memory traffic between the sockets. Like setAllocFlags(), this doesn't affect buffers 
+		 * allocated by the driver. Must be called before startCapture(). 
+		 * The default implementation returns -1.
+		 * \param node : the NUMA node or -1 for the default policy
+		 * \return 0 if successful, -1 on failure */
+		virtual inline int setNumaNode(int node)
+			{ return -1; }
+
+		//! Deliver all frames that are ready after a wakeup of the capture thread at once.
+		/*! If \p max_frames is greater than 1, the capture thread takes up to that many frames 
+		 * from the driver without waiting and passes them to CaptureHandler::handleCaptureBatch(). 
+		 * This saves wakeups and handler calls at high frame rates or when frames have piled up. 
+		 * Must be called before startCapture(). The default implementation returns -1.
+		 * \param max_frames : the maximum number of frames per batch, 1 to deliver each frame on its own
+		 * \return 0 if successful, -1 on failure */
+		virtual inline int setBatchSize(int max_frames)
+			{ return -1; }
+		
+		//! Get the maximum number of frames delivered at once.
+		/*! \return the batch size, 1 if batched delivery is disabled */
+		virtual inline int getBatchSize()
+			{ return 1; }
+		
+		//! Let the number of IOBuffers adapt to the application.
+		/*! The manager measures how long the handlers and the application hold a buffer and how 
+		 * often the driver runs out of buffers. While capturing it adds buffers if they become short 
+		 * and takes buffers out of use if they are held shortly, so the count stays between 
+		 * \p min_bufs and \p max_bufs. The count reached is kept for the next startCapture(). 
+		 * Must be called before startCapture(). The default implementation returns -1.
+		 * \param min_bufs : the minimum number of buffers, at least 2
+		 * \param max_bufs : the maximum number of buffers, at most MAX_BUFFERS. If both are 0, 
+		 * the number of buffers given on construction is used all the time. 
+		 * \return 0 if successful, -1 on failure */
+		virtual inline int setBufferRange(int min_bufs, int max_bufs)
+			{ return -1; }
+		
+		//! Get the number of IOBuffers passed to the driver in turn.
+		/*! \return the number of buffers or -1, if the manager doesn't know it */
+		virtual inline int getBufferCount()
+			{ return -1; }
+		
+		//! Copy frames, that are held too long, so that the driver gets their buffers back.
+		/*! A buffer held by the application can't be filled by the driver. If a buffer is held 
+		 * longer than \p max_hold or the driver has less than \p min_queued buffers left, the frame 
+		 * is copied to memory of the library and the driver continues with the original buffer. 
+		 * For a short queue, only frames held for a few frame intervals are copied, the oldest first. 
+		 * The IOBuffer and its data pointers stay valid until release() is called, even after 
+		 * stopCapture(), so a slow consumer costs a copy instead of dropped frames. Data written to the buffer by the 
+		 * application while it is copied may be lost. Must be called before startCapture(). 
+		 * The default implementation returns -1.
+		 * \param max_hold : the time in nanoseconds a frame may be held, -1 for no limit
+		 * \param min_queued : copy held frames if fewer buffers are queued, 0 to ignore the queue
+		 * \return 0 if successful, -1 on failure */
+		virtual inline int setCopyOnHold(long long max_hold, int min_queued = 1)
+			{ return -1; }
+		
+		//! Copy each frame from the driver buffer to cached memory before it is delivered.
+		/*! Some drivers provide uncached or write-combined buffers, which are very slow to read. 
+		 * The copy is done by StreamCopy and the driver buffer is given back at once, so the 
+		 * handlers work on cacheable memory of the library. If all copies are held by the application, 
+		 * the driver buffer is delivered itself. Must be called before startCapture(). 
+		 * The default implementation returns -1.
+		 * \param enable : true to copy the frames
+		 * \return 0 if successful, -1 on failure */
+		virtual inline int setCopyOut(bool enable)
+			{ return -1; }
+
+	protected:
+		//! Release the frames queued for nextFrame() and stop queuing.
+		/*! Capture managers must call this before they wait for the capture thread to stop, 
+		 * so a thread blocked by OVERLOAD_BLOCK continues. Frames delivered afterwards are 
+		 * released immediately, the buffers can be deleted safely once the thread has stopped. */
+		void flushFrames();
+		
+		//! Wait until the handler calls passed to the thread pool have returned.
+		/*! flushFrames() calls this, too. Capture managers must call it after their capture thread 
+		 * has stopped, before they delete the buffers. */
+		void waitDispatched();
+		
+		//! Queue the frames for nextFrame() again.
+		/*! Capture managers must call this when capturing is started. */
+		void openFrames();
+		
 	private:
+		//! Give a buffer back, after its last reference has been released.
+		void recycle(IOBuffer* io_buf);
+		
+		//! Update the frame counters with a captured buffer.
+		void countFrame(IOBuffer* io_buf);
+		
+		//! Copy the registered handlers, postedHandlers() must be called after they have been dispatched.
+		/*! \return the number of handlers */
+		int getHandlers(CaptureHandler** handlers);
+		
+		//! The handlers taken by getHandlers() have been called or passed to the pool.
+		void postedHandlers();
+		
+		//! Wait until the pool doesn't call a removed handler anymore.
+		void waitHandler(CaptureHandler* handler);
+		
 		//! Dequeue the next buffer.
 		/*! \return the next buffer with captured data. */
 		virtual IOBuffer* dequeue() = 0;
@@ -26,6 +26,7 @@
 
 #include <list>
 #include <string>
+#include <utility>
 
 #include "singleton.h"
 
@@ -33,12 +34,37 @@
 # include "avcap-config.h"
 #endif
 
+#ifdef AVCAP_LINUX
+# include <pthread.h>
+#endif
+
 #include "avcap-export.h"
 
 namespace avcap
 {
 class DeviceDescriptor;
+class DeviceListener;
 class CaptureDevice;
+struct V4L2_Probe;
+
+	//! Criteria to select the devices the DeviceCollector queries.
+	/*! Empty strings and a capability mask of 0 accept all devices. The filter is currently only applied
+	 * to the V4L devices under Linux. */
+	struct AVCAP_Export DeviceFilter {
+		std::string		driver;			//!< Only devices of this driver, e.g. "uvcvideo".
+		std::string		busInfo;		//!< Only devices whose bus info starts with this string, e.g. "usb-0000:00:14.0".
+		unsigned int	capabilities;	//!< Only devices with all of these V4L2 capability flags, e.g. V4L2_CAP_STREAMING.
+		bool			captureOnly;	//!< Skip nodes that can't capture video, e.g. UVC metadata nodes.
+		bool			lazy;			//!< Don't query in the constructor, but on the first call to queryDevices().
+		int				timeout;		//!< Milliseconds to wait for devices to answer, slower devices are skipped. 0 waits forever.
+		
+		DeviceFilter():
+			capabilities(0),
+			captureOnly(false),
+			lazy(false),
+			timeout(3000)
+			{}
+	};
 
 	//! This singleton queries the capture devices available on the system and provides a factory-method to create CaptureDevice-objects.
 	
@@ -50,7 +76,8 @@ class CaptureDevice;
 	 *  
 	 * <b>Linux:</b>
 	 * <UL> 
-	 * <LI>All /dev/video* nodes are tested by default. </LI>
+	 * <LI>All /dev/video* nodes listed in /sys/class/video4linux are tested in parallel by default. 
+	 * If sysfs isn't available, /dev/video0 to /dev/video63 are tested. Use setDefaultFilter() to skip devices.</LI>
 	 * <LI>If avcap has been compiled with HAS_AVC_SUPPORT defined, all IEEE 1394 AV/C-devices are tested. </LI>
 	 * <LI>IEEE1394 digital camera support is planned but currently not implemented. 
 	 * </UL>
@@ -63,6 +90,9 @@ class CaptureDevice;
 	 * <LI>All devices of the SequenceGrabber-Component device-list are tested.</LI>
 	 * </UL>
 	 * 
+	 * Under Linux, startMonitor() keeps the list up to date, when devices are plugged in or removed. 
+	 * While the monitor runs, use a DeviceCollector::Reader to iterate the list.
+	 * 
 	 * Access the singleton instance via DEVICE_COLLECTOR::instance().
 	 **/
 	
@@ -71,9 +101,63 @@ class CaptureDevice;
 	public:
 		//! List type of the DeviceDescriptor object list.
 		typedef std::list<DeviceDescriptor*> DeviceList;
+		
+		enum
+		{
+			MAX_LISTENERS = 8	//!< The maximum number of registered DeviceListeners.
+		};
+		
+		//! Read access to the device list, while the hotplug monitor may change it.
+		/*! The list and its descriptors remain valid for the lifetime of the reader, even if the monitor 
+		 * removes a device meanwhile. Creating a reader never blocks, but the monitor waits for the readers 
+		 * before it deletes a removed device. A reader kept for long therefore delays all further hotplug 
+		 * events and listener calls, so create one for each pass over the list. */
+		class AVCAP_Export Reader
+		{
+			const DeviceCollector&	mCollector;
+			int						mEpoch;
+			const DeviceList*		mList;
+			
+		public:
+			//! Constructor
+			Reader(const DeviceCollector& collector);
+			
+			//! Destructor
+			~Reader();
+			
+			//! The device list at the time the reader was created.
+			inline const DeviceList& getDeviceList() const
+				{ return *mList; }
+		};
 	
 	private:
-		DeviceList mDeviceList;
+		DeviceList	mDeviceList;
+		
+		// the list published to readers and the number of readers in the current and the previous epoch
+		const DeviceList* volatile	mCurrent;
+		volatile int				mEpoch;
+		mutable volatile int		mReaders[2];
+		
+		// replaced lists and their epoch, freed when their readers have left
+		std::list<std::pair<int, const DeviceList*> >	mOldLists;
+		
+		DeviceListener* volatile	mListeners[MAX_LISTENERS];
+		DeviceListener* volatile	mNotified;
+		
+#ifdef AVCAP_LINUX
+		pthread_mutex_t		mUpdateLock;
+		pthread_t*			mMonitorThread;
+		int					mMonitorFd;
+		bool				mMonitorInotify;
+		int					mStopFd;
+		DeviceFilter		mMonitorFilter;
+		DeviceList			mRetired;
+		
+		// probes with nodes, that haven't answered in time
+		std::list<V4L2_Probe*>	mProbes;
+#endif
+		
+		static DeviceFilter sDefaultFilter;
 	
 	public:
 		//! Constructor
@@ -83,7 +167,9 @@ class CaptureDevice;
 		virtual ~DeviceCollector();
 	
 		//! Returns the STL-list of DeviceDescriptor objects describing available capture devices.
-		/*! \return The descriptor list.*/
+		/*! The list is changed by queryDevices() and the hotplug monitor. While the monitor runs, 
+		 * use a Reader instead, which keeps the list and its descriptors valid while iterating.
+		 * \return The descriptor list.*/
 		inline const DeviceList& getDeviceList() const 
 			{ return (const DeviceList&) mDeviceList; }
 	
@@ -93,19 +179,74 @@ class CaptureDevice;
 		 * \param name : the name of a device node (e.g. /dev/video0) 
 		 * \return true, if it is a V4L1-device, false else*/
 		bool testDevice(const std::string& name);
+		
+		//! Query the devices which pass the filter and add them to the device list.
+		/*! Devices already in the list are kept. Under Linux, the device nodes are probed in parallel and 
+		 * a node, that doesn't answer within the timeout of the filter, is skipped. Later queries don't 
+		 * probe it again while it hangs, but take its answer once it has arrived. 
+		 * \param filter : selects the devices 
+		 * \return the number of devices added to the list */
+		int queryDevices(const DeviceFilter& filter);
+		
+		//! Set the filter applied when the singleton is created.
+		/*! It must be called before the first call to DEVICE_COLLECTOR::instance() to have an effect.
+		 * Set DeviceFilter::lazy to create an empty list and query the devices later with queryDevices().
+		 * \param filter : the filter */
+		static void setDefaultFilter(const DeviceFilter& filter);
+		
+		//! Linux only! Start a thread, that adds and removes devices, when they are plugged in or removed.
+		/*! The monitor listens to the uevents of the kernel and udev and falls back to watching /dev, 
+		 * if netlink isn't available. Only V4L2 devices are monitored.
+		 * \param filter : selects the devices, that are added
+		 * \return 0, if successful, -1 else, e.g. the monitor is already running */
+		int startMonitor(const DeviceFilter& filter = DeviceFilter());
+		
+		//! Stop the hotplug monitor.
+		void stopMonitor();
+		
+		//! Register a listener, which is called, when the monitor adds or removes a device.
+		/*! \param listener : the listener, which is owned by the application
+		 * \return 0, if successful, -1 if already registered or MAX_LISTENERS are registered */
+		int addDeviceListener(DeviceListener* listener);
+		
+		//! Remove a registered listener.
+		/*! If the monitor is just calling the listener, the method waits until the call has returned, 
+		 * so the listener can be deleted afterwards. Called from within a listener method, it returns at once.
+		 * \param listener : the listener
+		 * \return 0, if successful, -1 if it isn't registered */
+		int removeDeviceListener(DeviceListener* listener);
 	
 	private:
+		bool hasDevice(const std::string& name) const;
+		
+		int publish();
+		
+		void freeOldLists();
+		
+		void notifyListeners(DeviceDescriptor* dd, bool added);
 	
 #ifdef AVCAP_LINUX
 		void query_V4L1_Devices();
 		
-		void query_V4L2_Devices();
+		void query_V4L2_Devices(const DeviceFilter& filter);
 		
 		void query_ieee1394_Devices();
 		
 		int test_V4L1_Device(const std::string& name);
 		
 		int test_V4L2_Device(const std::string& name);
+		
+		static void monitor(void* collector);
+		
+		void handleHotplugEvents();
+		
+		void addDevice(const std::string& name);
+		
+		void removeDevice(const std::string& name);
+		
+		void waitForReaders(int epoch);
+		
+		void resyncDevices();
 #endif
 
 #ifdef AVCAP_OSX
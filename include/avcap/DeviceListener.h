@@ -0,0 +1,68 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+#ifndef DEVICELISTENER_H_
+#define DEVICELISTENER_H_
+
+#include "avcap-export.h"
+
+namespace avcap
+{
+class DeviceDescriptor;
+
+	//! Abstract base class for applications that want to know when capture devices are plugged in or removed.
+
+	/*! Register a listener with DeviceCollector::addDeviceListener() and start the hotplug monitor 
+	 * with DeviceCollector::startMonitor(). The methods are called from the thread of the monitor, 
+	 * after the device list has been updated. */
+
+	class AVCAP_Export DeviceListener
+	{
+	public:
+		//! Constructor
+		inline DeviceListener() 
+			{}
+			
+		//! Destructor
+		virtual inline ~DeviceListener() 
+			{}
+		
+		//! This method is called, if a device has been plugged in.
+		/*! The default implementation does nothing.
+		 * \param dd : the descriptor of the device, which is in the device list now */
+		virtual void handleDeviceAdded(DeviceDescriptor* dd)
+			{}
+		
+		//! This method is called, if a device has been removed.
+		/*! The descriptor has already been removed from the device list and is deleted after the 
+		 * method returns, unless the device is still open. In that case it is deleted with the 
+		 * DeviceCollector. Either way, the application must not open it again.
+		 * The default implementation does nothing.
+		 * \param dd : the descriptor of the removed device */
+		virtual void handleDeviceRemoved(DeviceDescriptor* dd)
+			{}
+	};
+}
+
+#endif // DEVICELISTENER_H_
@@ -0,0 +1,159 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+#ifndef DISPATCHPOOL_H_
+#define DISPATCHPOOL_H_
+
+#ifndef _WIN32
+
+#include <pthread.h>
+#include <deque>
+#include <vector>
+
+#include "avcap-export.h"
+
+namespace avcap
+{
+	//! A unit of work executed by a DispatchPool.
+	
+	class AVCAP_Export DispatchTask
+	{
+	public:
+		virtual ~DispatchTask()
+			{}
+		
+		//! Called from a thread of the pool.
+		virtual void run() = 0;
+		
+		//! Return true, if the task refers to \p object, see DispatchStrand::wait().
+		virtual bool uses(const void* object) const
+			{ return false; }
+	};
+	
+	//! A shared pool of threads that runs the capture handlers of many devices.
+	
+	/*! Each thread has a queue of its own. Tasks posted by a thread of the pool are put into
+	 * its own queue, all others are distributed round-robin. Idle threads steal tasks from the 
+	 * queues of the others, so a single slow handler doesn't hold back the tasks queued behind it.
+	 * The pool is shared by all capture managers and is stopped, when it isn't used anymore. */
+	
+	class AVCAP_Export DispatchPool
+	{
+	private:
+		struct Worker
+		{
+			DispatchPool*				pool;
+			int							index;
+			pthread_t					thread;
+			pthread_mutex_t				lock;
+			std::deque<DispatchTask*>	tasks;
+		};
+		
+		typedef std::vector<Worker*> WorkerList_t;
+		
+		WorkerList_t		mWorkers;
+		pthread_mutex_t		mLock;
+		pthread_cond_t		mCond;
+		volatile int		mQueued;
+		volatile int		mFinish;
+		unsigned int		mNext;
+		int					mRefs;
+		
+		static DispatchPool*	sShared;
+		static pthread_mutex_t	sSharedLock;
+		
+	public:
+		//! Get the shared pool and start it on first use.
+		/*! The size of a running pool can't be changed, it is only given by the first user.
+		 * \param threads : the number of threads of a new pool, 0 for one per CPU or any size, if the pool is running
+		 * \return the pool or 0 on failure, e.g. the running pool has another number of threads */
+		static DispatchPool* acquire(int threads);
+		
+		//! Stop using the shared pool, the last user stops its threads.
+		static void release(DispatchPool* pool);
+		
+		//! Queue a task, that is run by one of the threads.
+		/*! The ownership of the task remains at the caller. */
+		void post(DispatchTask* task);
+		
+		//! Get the number of threads.
+		int getNumThreads();
+		
+	private:
+		DispatchPool();
+		
+		~DispatchPool();
+		
+		int start(int threads);
+		
+		void stop();
+		
+		DispatchTask* take(Worker* worker);
+		
+		static void* run(void* arg);
+	};
+	
+	//! Passes the tasks of a single device to a DispatchPool.
+	
+	/*! If the strand is ordered, at most one of its tasks runs at the same time and the tasks 
+	 * are run in the order they have been posted. Otherwise they may run concurrently on different threads. */
+	
+	class AVCAP_Export DispatchStrand : public DispatchTask
+	{
+	private:
+		DispatchPool*				mPool;
+		bool						mOrdered;
+		pthread_mutex_t				mLock;
+		pthread_cond_t				mIdleCond;
+		std::deque<DispatchTask*>	mTasks;
+		std::vector<DispatchTask*>	mRunning;
+		bool						mScheduled;
+		int							mPending;
+		int							mWaiters;
+		
+	public:
+		DispatchStrand(DispatchPool* pool, bool ordered);
+		
+		virtual ~DispatchStrand();
+		
+		//! Queue a task, the strand takes the ownership and deletes it after it has run.
+		void post(DispatchTask* task);
+		
+		//! Wait until all posted tasks have been run.
+		/*! Must not be called from a task of the strand itself. */
+		void wait();
+		
+		//! Wait until no posted task uses \p object anymore.
+		/*! Tasks posted afterwards aren't waited for. Called from a task of the strand itself, 
+		 * the method returns at once, since the tasks queued behind it may never run otherwise.
+		 * \param object : the object passed to DispatchTask::uses() */
+		void wait(const void* object);
+		
+		//! Run the next task, called by the pool.
+		void run();
+	};
+}
+
+#endif // _WIN32
+#endif // DISPATCHPOOL_H_
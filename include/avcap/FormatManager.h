@@ -140,6 +140,18 @@ class DeviceDescriptor;
 			{}
 	};
 
+	//! A rectangle within the image area of a device, in pixels.
+	struct AVCAP_Export ImageRect {
+		int left, top, width, height;
+		
+		ImageRect(int l = 0, int t = 0, int w = 0, int h = 0):
+			left(l),
+			top(t),
+			width(w),
+			height(h)
+			{}
+	};
+
 	//! Description of a video format.
 	class AVCAP_Export Format
 	{
@@ -289,6 +301,28 @@ class DeviceDescriptor;
 		 *! \return the frames per second */
 		virtual int getFramerate();
 
+		//! Capture only a region of the image area of the device.
+		/*! If the sensor or the bridge can crop, only the region is transferred, which saves 
+		 * bandwidth and memory. The resolution is set to the size of the region, call setResolution() 
+		 * afterwards to scale it, if the device supports scaling. The region is kept and set again when 
+		 * capturing is started. It can't be changed while capturing.
+		 * The default implementation returns -1
+		 * \param roi : the region, a width of 0 resets it to the default area of the device
+		 * \return 0, if successful, -1 else */
+		virtual int setRegionOfInterest(const ImageRect& roi);
+		
+		//! Get the region of the image area that is captured.
+		/*! The default implementation returns -1
+		 * \param roi : receives the region as adjusted by the driver
+		 * \return 0, if successful, -1 else */
+		virtual int getRegionOfInterest(ImageRect& roi);
+		
+		//! Get the area, that can be captured by setRegionOfInterest().
+		/*! The default implementation returns -1
+		 * \param bounds : receives the area
+		 * \return 0, if successful, -1 else */
+		virtual int getCropBounds(ImageRect& bounds);
+
 		//! Get the STL-list of avaliable video standards described by VideoStandard objects.
 		/*! \return standards list*/
 		virtual inline const VideoStandardList& getVideoStandardList() const
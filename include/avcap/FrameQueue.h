@@ -0,0 +1,118 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+#ifndef FRAMEQUEUE_H_
+#define FRAMEQUEUE_H_
+
+#ifndef _WIN32
+
+#include <pthread.h>
+#include <deque>
+
+#include "CaptureHandler.h"
+#include "CaptureManager.h"
+#include "avcap-export.h"
+
+namespace avcap
+{
+	class IOBuffer;
+	
+	//! A bounded queue of captured frames, that are pulled by the application.
+	
+	/*! The queue is registered as CaptureHandler and stores the delivered buffers
+	 * until they are taken by CaptureManager::nextFrame(). What happens if the queue is full
+	 * depends on the CaptureManager::OverloadPolicy, by default the oldest frame is released, 
+	 * so the application always gets the freshest frames. The number of frames the application 
+	 * holds at the same time is limited, too. */
+	
+	class AVCAP_Export FrameQueue : public CaptureHandler
+	{
+	public:
+		enum
+		{
+			DEFAULT_DEPTH = 4,		//!< The default number of queued frames.
+			DEFAULT_MAX_HELD = 4	//!< The default number of frames the application may hold.
+		};
+		
+	private:
+		typedef std::deque<IOBuffer*> FrameList_t;
+		
+		pthread_mutex_t	mLock;
+		pthread_cond_t	mCond;
+		pthread_cond_t	mSpaceCond;
+		FrameList_t		mFrames;
+		int				mDepth;
+		int				mMaxHeld;
+		int				mHeld;
+		bool			mClosed;
+		
+		CaptureManager::OverloadPolicy	mPolicy;
+		unsigned long					mDropped;
+		
+	public:
+		FrameQueue(int depth = DEFAULT_DEPTH, int max_held = DEFAULT_MAX_HELD);
+		
+		virtual ~FrameQueue();
+		
+		//! Set the limits of the queue.
+		/*! \param depth : the maximum number of queued frames
+		 * \param max_held : the maximum number of frames the application may hold */
+		void setLimits(int depth, int max_held);
+		
+		//! Set the policy applied, if a frame arrives while the queue is full.
+		void setPolicy(CaptureManager::OverloadPolicy policy);
+		
+		//! Get the number of frames dropped by the queue.
+		/*! \return the number of frames released without being taken by the application */
+		unsigned long getDropped();
+		
+		//! Reset the number of dropped frames.
+		void resetDropped();
+		
+		//! Store a captured frame, called from the capture thread.
+		void handleCaptureEvent(IOBuffer* io_buf);
+		
+		//! Take the oldest frame from the queue.
+		/*! \param timeout_ms : the time to wait in milliseconds, 0 to return immediately, -1 to wait forever
+		 * \return the frame or 0, if none became available in time or the queue has been closed */
+		IOBuffer* pop(int timeout_ms);
+		
+		//! Called when a frame taken by pop() has been released.
+		void frameReleased();
+		
+		//! Release all queued frames.
+		void flush();
+		
+		//! Release all queued frames and refuse new ones until open() is called.
+		/*! Wakes up the capture thread, if it waits for space in the queue, and 
+		 * the application, if it waits for a frame. */
+		void close();
+		
+		//! Accept frames again after close().
+		void open();
+	};
+}
+
+#endif // _WIN32
+#endif // FRAMEQUEUE_H_
@@ -0,0 +1,283 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+#ifndef FRAMESOURCE_H_
+#define FRAMESOURCE_H_
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+
+#include <coroutine>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "CaptureHandler.h"
+#include "CaptureManager.h"
+#include "IOBuffer.h"
+
+namespace avcap
+{
+	//! An awaitable source of captured frames for C++20 coroutines.
+	
+	/*! The source registers itself as capture handler of a CaptureManager. A coroutine waits for 
+	 * the next frame with \c co_await \c source.next(). If a coroutine is waiting, a new frame is passed 
+	 * to it directly and the coroutine is resumed from the capture thread, or by the executor set with 
+	 * setExecutor(), e.g. the event loop of the application, so one thread can serve many cameras. 
+	 * Frames that arrive while nobody waits are queued, if the queue is full the oldest one is released.
+	 * Each returned frame must be released by IOBuffer::release(). 
+	 * The class is header-only and available if the compiler supports coroutines. */
+	
+	class FrameSource : public CaptureHandler
+	{
+	public:
+		typedef std::function<void (std::coroutine_handle<>)> Executor;
+		typedef std::chrono::steady_clock Clock;
+		
+		//! The awaitable returned by next().
+		class NextAwaiter
+		{
+			friend class FrameSource;
+			
+			FrameSource*				mSource;
+			Clock::time_point			mDeadline;
+			bool						mTimed;
+			IOBuffer*					mFrame;
+			std::coroutine_handle<>		mHandle;
+			
+		public:
+			NextAwaiter(FrameSource* source, Clock::time_point deadline, bool timed):
+				mSource(source), mDeadline(deadline), mTimed(timed), mFrame(0)
+				{}
+			
+			bool await_ready() const
+				{ return false; }
+			
+			bool await_suspend(std::coroutine_handle<> handle)
+				{ mHandle = handle; return mSource->wait(this); }
+			
+			//! \return the frame or 0, if the wait has been cancelled or timed out
+			IOBuffer* await_resume() const
+				{ return mFrame; }
+		};
+		
+	private:
+		CaptureManager*				mMgr;
+		size_t						mDepth;
+		Executor					mExecutor;
+		
+		std::mutex					mLock;
+		std::condition_variable		mTimerCond;
+		std::deque<IOBuffer*>		mFrames;
+		std::deque<NextAwaiter*>	mWaiters;
+		std::thread					mTimer;
+		bool						mClosing;
+		
+	public:
+		//! Constructor
+		/*! \param mgr : the capture manager the frames are taken from
+		 * \param depth : the maximum number of frames queued while no coroutine waits */
+		FrameSource(CaptureManager* mgr, size_t depth = 4):
+			mMgr(mgr), mDepth(depth > 0 ? depth : 1), mClosing(false)
+			{ mMgr->addCaptureHandler(this); }
+		
+		//! Destructor
+		/*! Waiting coroutines are resumed with 0, they must not use the source anymore. */
+		virtual ~FrameSource()
+		{
+			mMgr->removeCaptureHandler(this);
+			
+			{
+				std::lock_guard<std::mutex> lock(mLock);
+				mClosing = true;
+			}
+			
+			mTimerCond.notify_all();
+			if(mTimer.joinable())
+				mTimer.join();
+			
+			cancel();
+			
+			std::lock_guard<std::mutex> lock(mLock);
+			for(size_t i = 0; i < mFrames.size(); i++)
+				mFrames[i]->release();
+			mFrames.clear();
+		}
+		
+		//! Let an executor resume the waiting coroutines.
+		/*! By default they are resumed from the thread that delivers the frame, which avoids a thread hop.
+		 * \param executor : a function that resumes the handle, e.g. by posting it to an event loop */
+		void setExecutor(const Executor& executor)
+		{
+			std::lock_guard<std::mutex> lock(mLock);
+			mExecutor = executor;
+		}
+		
+		//! Wait for the next frame.
+		/*! \return an awaitable, that yields the oldest queued frame or the next captured one */
+		NextAwaiter next()
+			{ return NextAwaiter(this, Clock::time_point(), false); }
+		
+		//! Wait for the next frame at most for a given time.
+		/*! \param timeout : the maximum time to wait
+		 * \return an awaitable, that yields the frame or 0, if the timeout has expired */
+		template<class Rep, class Period>
+		NextAwaiter next(std::chrono::duration<Rep, Period> timeout)
+			{ return NextAwaiter(this, Clock::now() + std::chrono::duration_cast<Clock::duration>(timeout), true); }
+		
+		//! Resume all waiting coroutines with 0.
+		void cancel()
+		{
+			std::deque<NextAwaiter*> waiters;
+			Executor executor;
+			
+			{
+				std::lock_guard<std::mutex> lock(mLock);
+				waiters.swap(mWaiters);
+				executor = mExecutor;
+			}
+			
+			for(size_t i = 0; i < waiters.size(); i++)
+				resume(executor, waiters[i]);
+		}
+		
+		//! Pass a captured frame to a waiting coroutine or queue it, called from the capture thread.
+		void handleCaptureEvent(IOBuffer* io_buf)
+		{
+			IOBuffer* stale = 0;
+			NextAwaiter* waiter = 0;
+			Executor executor;
+			
+			{
+				std::lock_guard<std::mutex> lock(mLock);
+				
+				if(!mWaiters.empty()) {
+					waiter = mWaiters.front();
+					mWaiters.pop_front();
+					waiter->mFrame = io_buf;
+					executor = mExecutor;
+				} else {
+					if(mFrames.size() >= mDepth) {
+						stale = mFrames.front();
+						mFrames.pop_front();
+					}
+					
+					mFrames.push_back(io_buf);
+				}
+			}
+			
+			if(stale)
+				stale->release();
+			
+			if(waiter)
+				resume(executor, waiter);
+		}
+		
+	private:
+		bool wait(NextAwaiter* waiter)
+		{
+			// return false to continue without suspending
+			std::lock_guard<std::mutex> lock(mLock);
+			
+			if(!mFrames.empty()) {
+				waiter->mFrame = mFrames.front();
+				mFrames.pop_front();
+				return false;
+			}
+			
+			if(mClosing || (waiter->mTimed && waiter->mDeadline <= Clock::now()))
+				return false;
+			
+			mWaiters.push_back(waiter);
+			
+			// the timer thread is started on first use
+			if(waiter->mTimed) {
+				if(!mTimer.joinable())
+					mTimer = std::thread(&FrameSource::runTimer, this);
+				
+				mTimerCond.notify_one();
+			}
+			
+			return true;
+		}
+		
+		void resume(const Executor& executor, NextAwaiter* waiter)
+		{
+			std::coroutine_handle<> handle = waiter->mHandle;
+			
+			if(executor)
+				executor(handle);
+			else
+				handle.resume();
+		}
+		
+		void runTimer()
+		{
+			// resume the coroutines whose timeout has expired with 0
+			std::unique_lock<std::mutex> lock(mLock);
+			
+			while(!mClosing) {
+				Clock::time_point now = Clock::now();
+				Clock::time_point next = Clock::time_point::max();
+				std::deque<NextAwaiter*> expired;
+				
+				for(std::deque<NextAwaiter*>::iterator it = mWaiters.begin(); it != mWaiters.end(); ) {
+					NextAwaiter* waiter = *it;
+					
+					if(waiter->mTimed && waiter->mDeadline <= now) {
+						expired.push_back(waiter);
+						it = mWaiters.erase(it);
+					} else {
+						if(waiter->mTimed && waiter->mDeadline < next)
+							next = waiter->mDeadline;
+						it++;
+					}
+				}
+				
+				if(!expired.empty()) {
+					Executor executor = mExecutor;
+					lock.unlock();
+					
+					for(size_t i = 0; i < expired.size(); i++)
+						resume(executor, expired[i]);
+					
+					lock.lock();
+					continue;
+				}
+				
+				if(next == Clock::time_point::max())
+					mTimerCond.wait(lock);
+				else
+					mTimerCond.wait_until(lock, next);
+			}
+		}
+	};
+}
+
+#endif // __has_include(<coroutine>)
+#endif // __cpp_impl_coroutine
+#endif // FRAMESOURCE_H_
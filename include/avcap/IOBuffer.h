@@ -49,12 +49,19 @@ namespace avcap
 	/*! The class contains the captured data and provides additional information,
 	 * e.g. sequence number, valid bytes and a capture timestamp. The data in the buffer
 	 * may not correspond exactly to one frame, e.g. if the captured data is part 
-	 * of a stream (e.g. MPEG).
+	 * of a stream (e.g. MPEG). Planar formats (e.g. NV12 or YUV420) are described by 
+	 * a pointer, a stride and a size for each plane, so they can be processed in place. 
+	 * The planes of a multi-planar V4L2 buffer (e.g. NV12M) aren't contiguous, 
+	 * getPtr() returns the first plane only in this case.
 	 * */
 	 
 	class AVCAP_Export IOBuffer
 	{
 	public:
+		enum
+		{
+			MAX_PLANES = 8		//!< The maximum number of planes of a buffer.
+		};
 		
 		//! Use-state of the buffer
 		enum State
@@ -63,6 +70,15 @@ namespace avcap
 			STATE_UNUSED,		//!> currently unused
 		};
 		
+		//! The clock the timestamp of the buffer refers to.
+		enum TimestampClock
+		{
+			TIMESTAMP_UNKNOWN = 0,	//!< The clock isn't known.
+			TIMESTAMP_MONOTONIC,	//!< The monotonic system clock, i.e. CLOCK_MONOTONIC under Linux.
+			TIMESTAMP_REALTIME,		//!< The wall clock, i.e. gettimeofday().
+			TIMESTAMP_STREAM		//!< The time elapsed since the start of the stream.
+		};
+		
 	private:
 		CaptureManager *mMgr;
 		void*			mPtr;
@@ -71,7 +87,17 @@ namespace avcap
 		int				mState;
 		long 			mSequence;
 		size_t			mValid;
-		struct timeval 	mTimestamp;
+		long long		mTimestampNs;
+		TimestampClock	mClock;
+		int				mNumPlanes;
+		void*			mPlanePtr[MAX_PLANES];
+		size_t			mPlaneStride[MAX_PLANES];
+		size_t			mPlaneSize[MAX_PLANES];
+		int				mDmaBufFd[MAX_PLANES];
+		size_t			mPlaneOffset[MAX_PLANES];
+		IOBuffer*		mNext;
+		volatile int	mRefs;
+		bool			mPulled;
 		
 	public:
 		
@@ -100,12 +126,47 @@ namespace avcap
 			{ return mValid; }
 		
 		//! Returns a timestamp in milliseconds. 
-		/*! \return timestamp */
+		/*! The value wraps around, if \c unsigned \c long has 32 bits. Use getTimestampNs() instead.
+		 * \return timestamp */
 		unsigned long getTimestamp();
+		
+		//! Returns the timestamp in nanoseconds.
+		/*! The timestamp is taken by the driver when the frame was captured, or by the library 
+		 * when the data has been received, if the driver doesn't provide one. 
+		 * Compare timestamps of different devices only, if they refer to the same clock.
+		 * \return timestamp */
+		inline long long getTimestampNs() const
+			{ return mTimestampNs; }
+		
+		//! Returns the clock the timestamp refers to.
+		/*! \return the clock */
+		inline TimestampClock getTimestampClock() const
+			{ return mClock; }
 
 		//! Must be called by the application after the buffer isn't used anymore to to enable its reutilization.
+		/*! If more than one CaptureHandler is registered, each of them gets the same buffer and must release it.
+		 * The buffer is reused after the last reference has been released. */
 		void release();
 		
+		//! Add a reference to the buffer.
+		/*! This can be used to pass the buffer to further consumers without copying it. 
+		 * Each reference must be released by release(). */
+		void addRef();
+		
+		//! Mark the buffer as taken by CaptureManager::nextFrame().
+		/*! This method should not be used by applications. */
+		inline void setPulled(bool pulled)
+			{ mPulled = pulled; }
+		
+		//! Returns true, if the buffer has been taken by CaptureManager::nextFrame().
+		inline bool isPulled() const
+			{ return mPulled; }
+		
+		//! Set the number of references.
+		/*! This method should not be used by applications.
+		 * \param refs : the number of consumers that will call release() */
+		void setRefCount(int refs);
+		
 		//! Get the index of the buffer.
 		/*! \return the buffer index. */
 		inline int getIndex() const 
@@ -117,6 +178,14 @@ namespace avcap
 		inline void setState(State state) 
 			{ mState = state; }
 
+		//! Atomically change the state of the buffer.
+		/*! The state is only changed, if the buffer is in state \p from. 
+		 * This method should not be used by applications.
+		 * \param from : the expected current state
+		 * \param to : the new state
+		 * \return true, if the state has been changed */
+		bool changeState(State from, State to);
+
 		//! Get the buffer usage state.
 		/*! \return the current buffer state. */
 		inline State getState() const 
@@ -129,6 +198,92 @@ namespace avcap
 		 * \param ts : the timestamp the data was captured
 		 * \param seq : the sequence number of the captured data */
 		void setParams(const size_t valid, State state, struct timeval &ts, int seq);
+		
+		//! Set buffer parameters with a full precision timestamp.
+		/*! This method should not be used by applications. 
+		 * \param valid : number of valid bytes in buffer
+		 * \param state : the current buffer state
+		 * \param ns : the timestamp in nanoseconds
+		 * \param clock : the clock the timestamp refers to
+		 * \param seq : the sequence number of the captured data */
+		void setParams(const size_t valid, State state, long long ns, TimestampClock clock, int seq);
+		
+		//! Set the timestamp with full precision.
+		/*! This method should not be used by applications. 
+		 * \param ns : the timestamp in nanoseconds
+		 * \param clock : the clock the timestamp refers to */
+		void setTimestamp(long long ns, TimestampClock clock);
+		
+		//! Return the number of planes of the buffer.
+		/*! \return the number of planes */
+		inline int getNumPlanes() const
+			{ return mNumPlanes; }
+		
+		//! Get the data of a plane.
+		/*! \param plane : the index of the plane
+		 * \return the start of the plane or 0, if there is no such plane */
+		inline void* getPlanePtr(int plane = 0) const
+			{ return (plane >= 0 && plane < mNumPlanes) ? mPlanePtr[plane] : 0; }
+		
+		//! Get the number of bytes between the starts of two lines of a plane.
+		/*! \param plane : the index of the plane
+		 * \return the stride in bytes or 0, if not known */
+		inline size_t getPlaneStride(int plane = 0) const
+			{ return (plane >= 0 && plane < mNumPlanes) ? mPlaneStride[plane] : 0; }
+		
+		//! Get the size of a plane.
+		/*! \param plane : the index of the plane
+		 * \return the maximum number of bytes the plane can contain */
+		inline size_t getPlaneSize(int plane = 0) const
+			{ return (plane >= 0 && plane < mNumPlanes) ? mPlaneSize[plane] : 0; }
+		
+		//! Set the number of planes.
+		/*! This method should not be used by applications.
+		 * \param num : the number of planes, at most MAX_PLANES */
+		void setNumPlanes(int num);
+		
+		//! Describe a plane of the buffer.
+		/*! This method should not be used by applications.
+		 * \param plane : the index of the plane
+		 * \param ptr : the start of the plane
+		 * \param stride : the number of bytes per line
+		 * \param size : the size of the plane in bytes */
+		void setPlane(int plane, void* ptr, size_t stride, size_t size);
+		
+		//! Get the dma-buf file descriptor of a plane.
+		/*! The descriptor is only available, if the export of dma-bufs has been enabled with 
+		 * CaptureManager::setDmaBufExport() and the driver supports it. It can be passed to
+		 * other devices (e.g. a V4L2 mem2mem-device) or processes to access the frame without copying it. 
+		 * The descriptor is owned by the buffer and remains valid until the capture is stopped. 
+		 * The frame data it refers to is valid until release() is called, so importers must be done 
+		 * with it before the buffer is released. Use dup() to keep the descriptor longer.
+		 * \param plane : the index of the plane
+		 * \return the descriptor or -1, if not available */
+		inline int getDmaBufFd(int plane = 0) const
+			{ return (plane >= 0 && plane < mNumPlanes) ? mDmaBufFd[plane] : -1; }
+		
+		//! Get the offset of a plane's data inside its dma-buf.
+		/*! \param plane : the index of the plane
+		 * \return the offset in bytes */
+		inline size_t getPlaneOffset(int plane = 0) const
+			{ return (plane >= 0 && plane < mNumPlanes) ? mPlaneOffset[plane] : 0; }
+		
+		//! Set the dma-buf of a plane.
+		/*! This method should not be used by applications.
+		 * \param plane : the index of the plane
+		 * \param fd : the dma-buf file descriptor
+		 * \param offset : the offset of the plane's data inside the dma-buf */
+		void setDmaBuf(int plane, int fd, size_t offset);
+		
+		//! Get the next buffer in a queue of the capture manager.
+		/*! This method should not be used by applications. */
+		inline IOBuffer* getNext() const
+			{ return mNext; }
+		
+		//! Link the buffer into a queue of the capture manager.
+		/*! This method should not be used by applications. */
+		inline void setNext(IOBuffer* next)
+			{ mNext = next; }
 	};
 }
 
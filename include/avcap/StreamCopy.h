@@ -0,0 +1,66 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+
+#ifndef STREAMCOPY_H_
+#define STREAMCOPY_H_
+
+#include <stddef.h>
+
+#include "avcap-export.h"
+
+namespace avcap
+{
+	//! Copy of frames out of uncached memory.
+	
+	/*! Some drivers map their buffers uncached or write-combined. Each load from such memory 
+	 * goes to the bus, so an image processed in place is read very slowly. The streaming loads of 
+	 * SSE4.1 (MOVNTDQA) and AVX2 fetch a whole line of write-combined memory at once. StreamCopy 
+	 * uses them to move a frame into cached memory, the best variant supported by the CPU is 
+	 * chosen at runtime. Without them, or on other architectures, memcpy() is used. */
+	
+	class AVCAP_Export StreamCopy
+	{
+	public:
+		//! The instructions used by copy().
+		enum Method
+		{
+			METHOD_MEMCPY = 0,	//!< Plain memcpy().
+			METHOD_SSE41,		//!< 16 byte streaming loads.
+			METHOD_AVX2			//!< 32 byte streaming loads.
+		};
+		
+		//! Copy \p size bytes from \p src to \p dst.
+		/*! The regions must not overlap. */
+		static void copy(void* dst, const void* src, size_t size);
+		
+		//! The method chosen for this CPU.
+		static Method getMethod();
+		
+		//! The name of the method chosen for this CPU.
+		static const char* getMethodName();
+	};
+}
+
+#endif // STREAMCOPY_H_
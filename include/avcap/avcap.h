@@ -30,10 +30,14 @@
 #endif
 #include "avcap/DeviceCollector.h"
 #include "avcap/DeviceDescriptor.h"
+#include "avcap/DeviceListener.h"
 #include "avcap/CaptureDevice.h"
 #include "avcap/FormatManager.h"
 #include "avcap/CaptureHandler.h"
 #include "avcap/CaptureManager.h"
+#include "avcap/CaptureGroup.h"
+#include "avcap/StreamCopy.h"
+#include "avcap/FrameSource.h"
 #include "avcap/Control_avcap.h"
 #include "avcap/ControlManager.h"
 #include "avcap/Connector.h"
@@ -26,9 +26,10 @@
 #ifndef AVC_READER_H_
 #define AVC_READER_H_
 
-#include <list>
+#include <pthread.h>
 
 #include "ieee1394io.h"
+#include "BufferTable.h"
 
 namespace avcap
 {
@@ -40,14 +41,11 @@ class IOBuffer;
 	
 	class AVC_Reader : public iec61883Reader
 	{
-		typedef std::list<IOBuffer*>	BufferList_t;
-		
-		
 		AVC_VidCapManager* mVidCapMgr;
 		AVC_FormatManager*	mFormatMgr;
-		CaptureHandler*		mCaptureHandler;
 	
-		BufferList_t	mBuffers;
+		BufferTable		mBuffers;
+		pthread_mutex_t	mLock;
 		long			mSequence;
 		int				mAvailableBuffers;
 		
@@ -56,10 +54,6 @@ class IOBuffer;
 		
 		virtual ~AVC_Reader();
 	
-		void registerCaptureHandler(CaptureHandler *handler);
-	
-		void removeCaptureHandler();
-		
 		virtual void TriggerAction();
 		
 		void enqueue(IOBuffer* io_buf);
@@ -34,6 +34,7 @@
 #include <time.h>
 
 #include "CaptureManager.h"
+#include "ThreadParams.h"
 
 namespace avcap
 {
@@ -69,6 +70,7 @@ namespace avcap
 		IOBufList			mBuffers;
 		int					mNumBufs;
 		int 				mSequence;
+		ThreadParams		mThreadParams;
 
 	public:
 	
@@ -84,11 +86,11 @@ namespace avcap
 
 		int stopCapture();
 		
-		void registerCaptureHandler(CaptureHandler *handler); 
-
-		void removeCaptureHandler(); 
-		
 		virtual int getNumIOBuffers();
+		
+		int setCaptureThreadPriority(SchedPolicy policy, int priority);
+		
+		int setCaptureThreadAffinity(const int* cpus, int count);
 
 	private:
 		virtual IOBuffer* dequeue();
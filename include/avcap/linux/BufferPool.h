@@ -0,0 +1,95 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+#ifndef BUFFERPOOL_H_
+#define BUFFERPOOL_H_
+
+#include <sys/types.h>
+
+namespace avcap
+{
+	//! A pool of equally sized, page-aligned capture buffers.
+	
+	/*! The pool allocates all buffers as one contiguous anonymous mapping and slices it 
+	 * into page-aligned chunks. On request the mapping is backed by 2 MB hugepages, either 
+	 * from the hugetlbfs-pool or by transparent hugepages, and it may be prefaulted, so that 
+	 * neither page faults nor TLB-misses hit the first frames. The memory can be bound to
+	 * a NUMA node, so that it is local to the CPUs processing the frames.
+	 * The pool is used to provide the memory for the read and user pointer IO-methods. */
+	
+	class BufferPool
+	{
+	public:
+		enum
+		{
+			HUGEPAGE_SIZE = 2*1024*1024	//!< The size of a hugepage.
+		};
+		
+	private:
+		void*	mBase;
+		size_t	mLength;
+		size_t	mBufSize;
+		int		mCount;
+		bool	mHugePages;
+		
+	public:
+		BufferPool();
+		
+		virtual ~BufferPool();
+		
+		//! Allocate the pool.
+		/*! \param size : the minimal size of a buffer in bytes
+		 * \param count : the number of buffers
+		 * \param flags : an or'ed combination of the CaptureManager::AllocFlags
+		 * \param node : the NUMA node to take the memory from or -1 for the default policy
+		 * \return 0 on success, -1 else */
+		int allocate(size_t size, int count, int flags, int node = -1);
+		
+		//! Release the memory of the pool.
+		void free();
+		
+		//! Get the start of the i-th buffer.
+		/*! \return the buffer or 0, if the index is out of range */
+		void* getBuffer(int i) const;
+		
+		//! The number of usable bytes of each buffer, i.e. the requested size rounded up to a page.
+		inline size_t getBufferSize() const
+			{ return mBufSize; }
+		
+		//! The number of buffers in the pool.
+		inline int getCount() const
+			{ return mCount; }
+		
+		//! Return true, if the pool is backed by hugepages.
+		inline bool usesHugePages() const
+			{ return mHugePages; }
+			
+	private:
+		void bind(int node);
+		
+		void prefault();
+	};
+}
+
+#endif // BUFFERPOOL_H_
@@ -0,0 +1,86 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+#ifndef BUFFERTABLE_H_
+#define BUFFERTABLE_H_
+
+#include <vector>
+
+namespace avcap
+{
+	class IOBuffer;
+	
+	//! The IOBuffers of a capture manager, addressed by their index.
+	
+	/*! The buffers are stored in a flat table at the slot given by IOBuffer::getIndex(), 
+	 * so a buffer returned by the driver is found in constant time. Buffers that are free to be 
+	 * filled by the library itself, e.g. for the read()-method, are kept on a free-list, which 
+	 * avoids searching the table for an unused buffer on every frame. 
+	 * The table isn't synchronized, the owner has to lock the access. */
+	
+	class BufferTable
+	{
+		std::vector<IOBuffer*>	mBuffers;
+		std::vector<int>		mFree;
+		
+	public:
+		BufferTable();
+		
+		virtual ~BufferTable();
+		
+		//! Store a buffer at the slot of its index.
+		void insert(IOBuffer* buf);
+		
+		//! Find a buffer by its index.
+		/*! \return the buffer or 0, if there is no buffer with this index */
+		inline IOBuffer* find(int index) const
+			{ return (index >= 0 && index < (int) mBuffers.size()) ? mBuffers[index] : 0; }
+		
+		//! Remove a buffer from its slot, without deleting it.
+		void remove(int index);
+		
+		//! The number of slots, i.e. the highest index + 1.
+		inline int size() const
+			{ return mBuffers.size(); }
+		
+		//! Take a buffer from the free-list.
+		/*! \return the buffer or 0, if no buffer is free */
+		IOBuffer* popFree();
+		
+		//! Put a buffer on the free-list.
+		void pushFree(IOBuffer* buf);
+		
+		//! The number of buffers on the free-list.
+		inline int getFreeCount() const
+			{ return mFree.size(); }
+		
+		//! Count the buffers in state IOBuffer::STATE_USED.
+		int getUsedCount() const;
+		
+		//! Remove all buffers, without deleting them.
+		void clear();
+	};
+}
+
+#endif // BUFFERTABLE_H_
@@ -0,0 +1,166 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+#ifndef CAPTUREREACTOR_H_
+#define CAPTUREREACTOR_H_
+
+#include <pthread.h>
+#include <list>
+
+#include "ThreadParams.h"
+
+namespace avcap
+{
+	//! Interface of capture managers that are driven by a CaptureReactor.
+	
+	class ReactorClient
+	{
+	public:
+		virtual ~ReactorClient() 
+			{}
+		
+		//! The device handle to poll for captured data.
+		virtual int getPollHandle() = 0;
+		
+		//! An eventfd the client writes to, if the reactor should call handleReady() without device data.
+		virtual int getWakeupHandle() = 0;
+		
+		//! Return true, if the device handle should be polled currently.
+		/*! Drivers report an error while they don't own a buffer, so the handle 
+		 * must not be polled in this case. */
+		virtual bool wantsPoll() = 0;
+		
+		//! Called from the reactor thread, if the device is ready or the client has been woken up.
+		/*! \param device_ready : true, if the device handle signaled data
+		 * \return true, if something has been processed, false else */
+		virtual bool handleReady(bool device_ready) = 0;
+		
+		//! Return true, if the device handle should be polled for exceptional conditions.
+		/*! V4L2 drivers signal pending events this way. */
+		virtual bool wantsEvents() 
+			{ return false; }
+		
+		//! Called from the reactor thread, if the device signals an exceptional condition.
+		virtual void handleEvents() 
+			{}
+	};
+	
+	//! A capture thread that multiplexes the device handles of one or more capture managers.
+	
+	/*! The reactor waits in epoll_wait() on the device handles and the wakeup handles
+	 * of all attached clients and calls their handleReady()-method from its thread. 
+	 * Exceptional conditions of the device handles (EPOLLPRI) are passed to handleEvents(). 
+	 * A private reactor gives each capture manager its own thread. Shared reactors are 
+	 * identified by a group number and serve all managers of that group with a single 
+	 * thread, which avoids dozens of mostly idle threads on hosts with many cameras. */
+	
+	class CaptureReactor
+	{
+	public:
+		enum
+		{
+			MAX_SHARED = 16,	//!< The maximum number of shared reactors.
+			MAX_EVENTS = 64		//!< The maximum number of events handled per wakeup.
+		};
+		
+	private:
+		struct Entry;
+		
+		struct Source
+		{
+			Entry*	entry;
+			bool	device;
+		};
+		
+		struct Entry
+		{
+			ReactorClient*	client;
+			Source			deviceSource;
+			Source			wakeupSource;
+			unsigned int	watched;
+			bool			error;
+			bool			dead;
+		};
+		
+		typedef std::list<Entry*> EntryList;
+		
+		int					mGroup;
+		int					mRefs;
+		int					mEpollFd;
+		int					mStopFd;
+		pthread_t*			mThread;
+		cpu_set_t			mStartCpus;
+		bool				mHaveStartCpus;
+		pthread_mutex_t		mLock;
+		EntryList			mEntries;
+		volatile int		mFinish;
+		bool				mDeleteOnExit;
+		
+		static pthread_mutex_t	sSharedLock;
+		static CaptureReactor*	sShared[MAX_SHARED];
+		
+	public:
+		//! Get a reactor.
+		/*! \param group : the group of a shared reactor below MAX_SHARED or -1 for a private one
+		 * \return the running reactor or 0 on failure */
+		static CaptureReactor* acquire(int group);
+		
+		//! Give back a reactor obtained by acquire().
+		/*! The reactor thread is stopped, if the reactor isn't used anymore. */
+		static void release(CaptureReactor* reactor);
+		
+		//! Start to serve a client.
+		/*! \return 0 on success, -1 else */
+		int attach(ReactorClient* client);
+		
+		//! Stop to serve a client.
+		/*! When the method returns, the client's handleReady() isn't running and won't be called anymore, 
+		 * unless this method is called from within handleReady() itself. */
+		void detach(ReactorClient* client);
+		
+		//! Apply the scheduling parameters of a client to the reactor thread.
+		/*! The parameters of a shared reactor are set by the client that has called this method last. 
+		 * Default parameters are ignored, so they don't override the settings of other clients. Cleared 
+		 * CPUs restore the affinity the current reactor thread has been started with.
+		 * \return 0 on success, -1 if the parameters couldn't be applied */
+		int configure(const ThreadParams& params);
+		
+	private:
+		CaptureReactor(int group);
+		
+		~CaptureReactor();
+		
+		int start();
+		
+		bool stop();
+		
+		void watch(Entry* entry, unsigned int events);
+		
+		void purge();
+		
+		static void run(void* reactor);
+	};
+}
+
+#endif // CAPTUREREACTOR_H_
@@ -0,0 +1,57 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+#ifndef RELEASEQUEUE_H_
+#define RELEASEQUEUE_H_
+
+namespace avcap
+{
+	class IOBuffer;
+	
+	//! A lock-free queue of IOBuffers released by the application.
+	
+	/*! Any number of threads may push buffers concurrently without blocking or entering 
+	 * the kernel, only the capture thread takes them out again. The buffers are linked 
+	 * by IOBuffer::setNext(), so a buffer can be in one queue at a time only. */
+	
+	class ReleaseQueue
+	{
+		IOBuffer* volatile	mHead;
+		
+	public:
+		ReleaseQueue();
+		
+		virtual ~ReleaseQueue();
+		
+		//! Add a buffer to the queue. 
+		void push(IOBuffer* buf);
+		
+		//! Remove all buffers from the queue.
+		/*! \return the first buffer in the order they have been pushed or 0, if the 
+		 * queue is empty. The others follow by IOBuffer::getNext(). */
+		IOBuffer* takeAll();
+	};
+}
+
+#endif // RELEASEQUEUE_H_
@@ -0,0 +1,81 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+#ifndef THREADPARAMS_H_
+#define THREADPARAMS_H_
+
+#include <pthread.h>
+#include <vector>
+
+namespace avcap
+{
+	//! The scheduling policy, priority and CPU affinity of a capture thread.
+	
+	/*! The parameters are stored by the capture managers and applied to their capture 
+	 * thread, when it is started. Real-time policies usually require CAP_SYS_NICE or a
+	 * suitable RLIMIT_RTPRIO, if they can't be set, the thread keeps running with the 
+	 * default policy. */
+	
+	class ThreadParams
+	{
+	private:
+		int					mPolicy;
+		int					mPriority;
+		std::vector<int>	mCpus;
+		bool				mPolicySet;
+		bool				mAffinitySet;
+		
+	public:
+		ThreadParams();
+		
+		virtual ~ThreadParams();
+		
+		//! Set the scheduling policy and the priority.
+		/*! \param policy : one of the CaptureManager::SchedPolicy values
+		 * \param priority : the static priority, must be in the range of the policy
+		 * \return 0 on success, -1 if the policy or priority is invalid */
+		int setPriority(int policy, int priority);
+		
+		//! Set the CPUs the thread may run on.
+		/*! \param cpus : array of \p count CPU numbers or 0 to restore the affinity the thread has been started with
+		 * \param count : the number of CPUs
+		 * \return 0 on success, -1 if a CPU number is invalid */
+		int setAffinity(const int* cpus, int count);
+		
+		//! Return true, if neither setPriority() nor setAffinity() with CPUs has ever been called.
+		/*! Parameters that have been changed back to SCHED_POLICY_OTHER or to no CPUs aren't default, 
+		 * since they still have to be applied to leave the previous settings. */
+		bool isDefault() const;
+		
+		//! Apply the parameters to a thread.
+		/*! The policy is only changed, if it has been set, and the affinity only, if CPUs have been set 
+		 * or have been cleared again, so a placement chosen by the application, e.g. by taskset, is kept 
+		 * otherwise. Cleared CPUs restore \p start_cpus, if it is given.
+		 * \param thread : the thread
+		 * \param start_cpus : the affinity the thread has been started with or 0
+		 * \return 0 on success, -1 if a parameter couldn't be applied */
+		int apply(pthread_t thread, const cpu_set_t* start_cpus = 0) const;
+	};
+}
+
+#endif // THREADPARAMS_H_
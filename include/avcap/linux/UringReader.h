@@ -0,0 +1,129 @@
+/*
+ * (c) 2005, 2008 Nico Pranke <Nico.Pranke@googlemail.com>, Robin Luedtke <RobinLu@gmx.de> 
+ *
+ * This file is part of avcap.
+ *
+ * avcap is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * avcap is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with avcap.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* avcap is free for non-commercial use.
+ * To use it in commercial endeavors, please contact Nico Pranke <Nico.Pranke@googlemail.com>.
+ */
+
+
+
+#ifndef URINGREADER_H_
+#define URINGREADER_H_
+
+#include <sys/types.h>
+#include <vector>
+
+namespace avcap
+{
+	//! Asynchronous read() of a device by an io_uring.
+	
+	/*! The reader keeps several reads of a device in flight, each of them filling one buffer. 
+	 * The kernel completes them in the background and signals finished reads on an eventfd, 
+	 * which can be polled instead of the device. Completions are taken from the shared ring 
+	 * without a system call. The ring is set up by raw system calls, so liburing isn't needed. 
+	 * If the kernel or its configuration doesn't provide io_uring, open() fails and the caller 
+	 * should use plain read() instead. */
+	
+	class UringReader
+	{
+	public:
+		enum
+		{
+			CANCEL_TAG = -1		//!< The tag of completed cancel requests, never returned by complete().
+		};
+		
+	private:
+		int				mRingFd;
+		int				mEventFd;
+		int				mDeviceFd;
+		int				mInflight;
+		unsigned int	mEntries;
+		std::vector<int>	mPending;
+		
+		void*			mSqRing;
+		size_t			mSqRingSize;
+		void*			mCqRing;
+		size_t			mCqRingSize;
+		void*			mSqes;
+		size_t			mSqesSize;
+		
+		unsigned int*	mSqHead;
+		unsigned int*	mSqTail;
+		unsigned int*	mSqMask;
+		unsigned int*	mSqArray;
+		unsigned int*	mCqHead;
+		unsigned int*	mCqTail;
+		unsigned int*	mCqMask;
+		void*			mCqes;
+		
+	public:
+		UringReader();
+		
+		virtual ~UringReader();
+		
+		//! Create the ring for reading a device.
+		/*! \param fd : the descriptor of the device, which may be in non-blocking mode
+		 * \param entries : the maximum number of reads in flight
+		 * \return 0 on success, -1 if io_uring isn't available */
+		int open(int fd, int entries);
+		
+		//! Cancel the reads in flight, wait till the kernel doesn't touch their buffers anymore 
+		//! and destroy the ring.
+		void close();
+		
+		//! Return true, if the ring is set up.
+		inline bool isOpen() const
+			{ return mRingFd != -1; }
+		
+		//! The eventfd, that becomes readable when a read has completed.
+		inline int getEventHandle() const
+			{ return mEventFd; }
+		
+		//! The number of submitted reads, that haven't been taken by complete() yet.
+		inline int getInflight() const
+			{ return mInflight; }
+		
+		//! Start reading into a buffer.
+		/*! \param ptr : the buffer
+		 * \param size : the size of the buffer
+		 * \param tag : identifies the read in complete()
+		 * \return 0 on success, -1 else */
+		int submit(void* ptr, size_t size, int tag);
+		
+		//! Take a finished read without blocking.
+		/*! \param tag : receives the tag of the read
+		 * \param res : receives the result of the read, the number of bytes or a negative errno
+		 * \return 1 if a read has completed, 0 else */
+		int complete(int& tag, int& res);
+		
+		//! Reset the eventfd after all completions have been taken.
+		void clearEvent();
+		
+	private:
+		void* getSqe();
+		
+		int enter(unsigned int to_submit, unsigned int min_complete);
+		
+		bool isReadSupported();
+		
+		void unmap();
+	};
+}
+
+#endif // URINGREADER_H_
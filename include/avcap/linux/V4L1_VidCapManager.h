@@ -26,10 +26,12 @@
 #define V4L1_VIDCAPMANAGER_H_
 
 #include <sys/types.h>
-#include <list>
+#include <deque>
 #include <time.h>
 
 #include "CaptureManager.h"
+#include "CaptureReactor.h"
+#include "BufferTable.h"
 
 namespace avcap
 {
@@ -40,23 +42,31 @@ namespace avcap
 
 	//! The Video4Linux2-API video capture manager.
 
-	class V4L1_VidCapManager: public CaptureManager
+	class V4L1_VidCapManager: public CaptureManager, public ReactorClient
 	{
+	public:
+		enum
+		{
+			MAX_BUFFERS = 32	//!< The maximum number of IOBuffers, V4L1 drivers don't provide more.
+		};
+		
 	private:
-		typedef std::list<IOBuffer*> IOBufList_t;
-		typedef std::list<int>		 IndexList_t;
+		typedef std::deque<int>		 IndexList_t;
 				
 		V4L1_DeviceDescriptor	*mDeviceDescriptor;
 		V4L1_FormatManager		*mFormatMgr;
 		
-		IOBufList_t			mBuffers;
+		BufferTable			mBuffers;
 		IndexList_t			mCaptureIndices;
 		
 		int					mNumBufs;
 		int					mMethod;
 		int					mState;
 
-		pthread_t*			mThread;
+		CaptureReactor*		mReactor;
+		int					mReactorGroup;
+		ThreadParams		mThreadParams;
+		int					mWakeupFd;
 		int					mFinish;
 		pthread_mutex_t		mLock;
 		timeval				mStartTime;
@@ -86,6 +96,20 @@ namespace avcap
 		
 		int getNumIOBuffers();
 		
+		int setSharedCaptureThread(int group);
+		
+		int setCaptureThreadPriority(SchedPolicy policy, int priority);
+		
+		int setCaptureThreadAffinity(const int* cpus, int count);
+		
+		int getPollHandle();
+		
+		int getWakeupHandle();
+		
+		bool wantsPoll();
+		
+		bool handleReady(bool device_ready);
+		
 	private:
 		int start_read();
 
@@ -101,7 +125,9 @@ namespace avcap
 		
 		IOBuffer* findBuffer(int index);
 		
-		static void run(void* mgr);
+		void setTimestamp(IOBuffer* io_buf, size_t valid, int seq);
+		
+		void wakeup();
 		
 		void clearBuffers();
 		
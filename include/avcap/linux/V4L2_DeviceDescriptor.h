@@ -81,6 +81,10 @@ class V4L2_Device;
 
 		const std::string& getVersionString() const;
 
+		//! The V4L2 capability flags of the device node.
+		inline int getCapabilities() const
+			{ return mCapabilities; }
+
 		inline const DEV_HANDLE_T getHandle() const
 			{ return mHandle; }
 
@@ -88,6 +92,12 @@ class V4L2_Device;
 
 		bool isVideoCaptureDev() const;
 
+		//! Return true, if the device supports only the multi-planar API.
+		bool isMultiplanarDev() const;
+
+		//! The buffer type used for capturing, i.e. \c V4L2_BUF_TYPE_VIDEO_CAPTURE or \c V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE.
+		unsigned int getBufferType() const;
+
 		bool isVBIDev() const;
 
 		bool isTuner() const;
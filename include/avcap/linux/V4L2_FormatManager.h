@@ -34,6 +34,9 @@ namespace avcap
 	
 	class V4L2_FormatManager: public FormatManager
 	{
+	private:
+		unsigned int	mBufType;
+		ImageRect		mRoi;
 	
 	public:
 		V4L2_FormatManager(V4L2_DeviceDescriptor *dd);
@@ -68,6 +71,16 @@ namespace avcap
 		
 		int getFramerate();
 		
+		int setRegionOfInterest(const ImageRect& roi);
+		
+		int getRegionOfInterest(ImageRect& roi);
+		
+		int getCropBounds(ImageRect& bounds);
+		
+		//! Crop to the region of interest again, called before capturing starts.
+		/*! \return 0, if successful, no region is set or the driver can't crop, -1 else */
+		int applyCrop();
+		
 		void query();
 
 	private:
@@ -75,6 +88,8 @@ namespace avcap
 		
 		int getParams();
 		
+		int setCrop(ImageRect& rect);
+		
 		void queryVideoStandards();
 		
 		void queryResolutions(Format* f);
@@ -26,10 +26,22 @@
 #define V4L2_VIDCAPMANAGER_H_
 
 #include <sys/types.h>
-#include <list>
+#include <vector>
 #include <time.h>
+#include <linux/types.h>
 
 #include "CaptureManager.h"
+#include "BufferPool.h"
+#include "BufferTable.h"
+#include "ReleaseQueue.h"
+#include "CaptureReactor.h"
+#include "ThreadParams.h"
+#include "UringReader.h"
+#ifdef AVCAP_HAVE_V4L2
+#include <linux/videodev2.h>
+#else
+#include <linux/videodev.h>
+#endif
 
 namespace avcap
 {
@@ -44,48 +56,108 @@ namespace avcap
 	 * The manager creates a defined number 
 	 * of IOBuffers and permanently reuses them to store the captured data. 
 	 * Since the number of these buffers is finite, it is important that applications 
-	 * call IOBuffer::release() as soon as they don't need the data anymore. The
-	 * access to the internal buffer-list is synchronized, so \c release() can be called
-	 * from any thread at any time.
+	 * call IOBuffer::release() as soon as they don't need the data anymore. 
+	 * \c release() can be called from any thread at any time. It never blocks, the buffer is 
+	 * passed by a lock-free queue to the capture thread, which gives it back to the driver.
+	 * The captured data is received by a CaptureReactor, which sleeps in epoll_wait() until the 
+	 * driver has filled a buffer or a buffer is released while none was available. By default 
+	 * each manager gets its own reactor thread, setSharedCaptureThread() lets many devices share one.
+	 * If the driver doesn't support memory mapped buffers or the application provides its 
+	 * own memory via setUserBuffers(), the user pointer IO-method is used. The buffers of this 
+	 * and the read IO-method are taken from a page-aligned BufferPool, optionally backed by 
+	 * hugepages and bound to a NUMA node. If the kernel supports io_uring, the read IO-method keeps 
+	 * a read of every free buffer in flight, so that the capture thread never blocks in read(). 
+	 * With setBatchSize() the capture thread drains all ready buffers after a wakeup and delivers 
+	 * them to CaptureHandler::handleCaptureBatch().
+	 * setBufferRange() lets the buffer count follow the time the application holds the buffers: 
+	 * buffers are added by VIDIOC_CREATE_BUFS while capturing, retired buffers are removed by 
+	 * VIDIOC_REMOVE_BUFS or give their pool memory back. With setCopyOnHold() a mmaped frame held 
+	 * too long is moved to anonymous memory at the same address and the driver buffer is mapped again. 
+	 * Such a copy stays valid after stopCapture() until it is released or the manager is destroyed.
+	 * setCopyOut() copies each mmaped frame to a second pool by StreamCopy, for drivers with uncached buffers.
+	 * Events of the driver are passed to CaptureHandler::handleDeviceEvent(). If the resolution 
+	 * of the source changes, no further frames are delivered and capturing is restarted with buffers 
+	 * for the new format, as soon as the application has released the frames it holds.
 	 * Typical applications don't create objects of this class directly. They obtain
 	 * an instance from CaptureDevice. */
 	 
-	class V4L2_VidCapManager: public CaptureManager
+	class V4L2_VidCapManager: public CaptureManager, public ReactorClient
 	{
 	public:
 		enum
 		{
-			MAX_BUFFERS = 32,	//!< The maximum number of IOBuffers.
-			DEFAULT_BUFFERS = 16	//!< The default number of used IOBuffers.
-		};
-		
-		enum IOMethod
-		{
-			IO_METHOD_NOCAP = 0,
-	        IO_METHOD_READ,
-	        IO_METHOD_MMAP,
-	        IO_METHOD_USERPTR,
+			MAX_BUFFERS = 256,	//!< The maximum number of IOBuffers, the driver may allow fewer.
+			DEFAULT_BUFFERS = 16,	//!< The default number of used IOBuffers.
+			TUNE_FRAMES = 32,	//!< The number of frames between two adaptions of the buffer count.
+			SHRINK_VOTES = 4,	//!< The number of adaptions, that must agree before a buffer is retired.
+			MIN_QUEUED = 3,	//!< The number of buffers the driver should always have.
+			MAX_SPARES = 4,	//!< The number of copy buffers kept for reuse.
+			HOLD_FRAMES = 3	//!< The number of frame intervals a frame must be held, before it is copied for a short queue.
 		};
 
 	private:
-		typedef std::list<IOBuffer*> IOBufList;
-		
 		V4L2_DeviceDescriptor	*mDeviceDescriptor;
 		FormatManager		*mFormatMgr;
 
-		IOBufList			mBuffers;
+		BufferTable			mBuffers;
 		int					mNumBufs;
 		int					mMethod;
 		int					mState;
-		pthread_t*			mThread;
+		CaptureReactor*		mReactor;
+		int					mReactorGroup;
+		ThreadParams		mThreadParams;
+		unsigned int		mBufType;
+		int					mMemPlanes;
+		std::vector<size_t>	mPlaneStrides;
+		std::vector<size_t>	mPlaneSizes;
 		int 				mFinish;
 		pthread_mutex_t		mLock;
-		timeval				mStartTime;
 
 		int 				mSequence;
-		int					mDTNumerator;
-		int					mDTDenominator;
 		int					mAvailableBuffers;
+		ReleaseQueue		mReleased;
+		volatile int		mStarving;
+		volatile int		mReleasing;
+
+		BufferPool			mPool;
+		UringReader			mUring;
+		bool				mReadFailed;
+		int					mAllocFlags;
+		int					mNumaNode;
+		int					mBatchSize;
+		std::vector<void*>	mUserPtrs;
+		size_t				mUserPtrSize;
+		bool				mExportDmaBuf;
+		
+		int					mWakeupFd;
+		int					mFileFlags;
+		
+		bool				mQueued[MAX_BUFFERS];
+		bool				mRetired[MAX_BUFFERS];
+		bool				mParked[MAX_BUFFERS];
+		long long			mDequeueTime[MAX_BUFFERS];
+		int					mMinBufs;
+		int					mMaxBufs;
+		long long			mHoldTime;
+		long long			mFrameInterval;
+		long long			mLastFrame;
+		int					mQueueEmpty;
+		int					mTuneFrames;
+		int					mShrinkVotes;
+		long long			mMaxHold;
+		int					mMinQueued;
+		std::vector<IOBuffer*>	mDetached;
+		std::vector<std::pair<void*, size_t> >	mSpares;
+		bool				mCopyOut;
+		BufferPool			mCopyPool;
+		BufferTable			mCopies;
+		volatile bool		mPaused;
+		struct v4l2_format	mStreamFormat;
+		long long			mStartTime;
+		long long			mTimeToFirstFrame;
+		int					mEventMask;
+		bool				mSubscribed;
+		bool				mRestartPending;
 	
 	public:
 		V4L2_VidCapManager(V4L2_DeviceDescriptor* dd, FormatManager* fmt_mgr, int nbufs = DEFAULT_BUFFERS);
@@ -102,6 +174,56 @@ namespace avcap
 		
 		int getNumIOBuffers();
 
+		int setIOMethod(IOMethod method);
+
+		int setAllocFlags(int flags);
+
+		int setUserBuffers(void* const* ptrs, size_t size, int count);
+
+		int setDmaBufExport(bool enable);
+
+		int setSharedCaptureThread(int group);
+
+		int setCaptureThreadPriority(SchedPolicy policy, int priority);
+
+		int setCaptureThreadAffinity(const int* cpus, int count);
+
+		int setNumaNode(int node);
+
+		int setBatchSize(int max_frames);
+
+		int getBatchSize();
+
+		int setBufferRange(int min_bufs, int max_bufs);
+
+		int getBufferCount();
+
+		int setCopyOnHold(long long max_hold, int min_queued = 1);
+
+		int setCopyOut(bool enable);
+
+		int pauseCapture();
+
+		int resumeCapture();
+
+		bool isPaused();
+
+		long long getTimeToFirstFrame();
+
+		int setDeviceEvents(int mask);
+
+		int getPollHandle();
+		
+		int getWakeupHandle();
+		
+		bool wantsPoll();
+		
+		bool handleReady(bool device_ready);
+		
+		bool wantsEvents();
+		
+		void handleEvents();
+
 	private:
 		int start_read();
 		int start_mmap();
@@ -111,11 +233,56 @@ namespace avcap
 		int stop_mmap();
 		int stop_userptr();
 
+		bool isMemorySupported(int memory);
+		
+		IOBuffer* mapBuffer(int index);
+		IOBuffer* createUserBuffer(int index);
+		void unmapBuffer(IOBuffer* io_buf);
+		
+		int exportBuffer(IOBuffer* io_buf);
+		
+		int queryLayout();
+		void setLayout(IOBuffer* io_buf, void* const* ptrs, const size_t* lengths);
+
 		IOBuffer* dequeue();
 		int enqueue(IOBuffer* buf);
+		int requeue(IOBuffer* buf);
+		void reclaimBuffers();
+		bool handleBatch();
+		
+		void measureFrame(IOBuffer* io_buf);
+		void measureRelease(IOBuffer* io_buf);
+		void tuneBuffers();
+		int growBuffers(int count);
+		void shrinkBuffers(int count);
+		void parkBuffer(IOBuffer* io_buf);
+		
+		void copyHeldBuffers();
+		int detachBuffer(IOBuffer* io_buf);
+		void freeDetached(IOBuffer* io_buf);
+		
+		int createCopies();
+		IOBuffer* copyOut(IOBuffer* io_buf);
+		
+		int openUring();
+		void closeUring();
+		void submitReads();
+		IOBuffer* takeRead();
+		void setReadParams(IOBuffer* io_buf, int size);
+		
+		int startReactor();
+		void stopReactor();
+		
+		void subscribeEvents();
+		void unsubscribeEvents();
+		void checkRestart();
+		void restartCapture();
 		
 		IOBuffer* findBuffer(int index);
-		static void run(void* mgr);
+		
+		int createWakeup();
+		void destroyWakeup();
+		void wakeup();
 		
 		void clearBuffers();
 		int getUsedBufferCount();
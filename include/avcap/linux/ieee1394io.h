@@ -32,6 +32,8 @@ using std::string;
 #include <deque>
 using std::deque;
 
+#include "ThreadParams.h"
+
 namespace avcap
 {
 	
@@ -135,6 +137,13 @@ private:
 
 	CaptureHandler* m_captureHandler;
 	
+	/// the scheduling parameters of the receiver thread
+	ThreadParams m_threadParams;
+	
+	/// the affinity the receiver thread has been started with
+	cpu_set_t m_startCpus;
+	bool m_haveStartCpus;
+	
 public:
 	iec61883Reader( int port = 0, int channel = 63, int buffers = 5, 
 		BusResetHandler = 0, BusResetHandlerData = 0 );
@@ -146,6 +155,7 @@ public:
 	void StopReceive( void );
 	bool StartThread( void );
 	void StopThread( void );
+	bool SetThreadParams( const ThreadParams& params );
 	int Handler( int length, int complete, unsigned char *data );
 	void *Thread();
 	void ResetHandler( void );
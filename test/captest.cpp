@@ -12,9 +12,16 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <getopt.h>
+#include <vector>
 #include "avcap/avcap.h"
 
+#ifdef AVCAP_LINUX
+# include <list>
+# include "avcap/linux/BufferTable.h"
+#endif
+
 #include "TestCaptureHandler.h"
 
 #if defined _WIN32 || defined WIN32 || defined _WIN64
@@ -44,6 +51,8 @@ typedef struct _optvalues {
 	bool set_framerate;
 	bool set_input;
 	bool set_output;
+	bool bench_copy;
+	bool bench_buffers;
 } optvalues;
 
 int parse_options(int argc, char* argv[], optvalues& opts);
@@ -53,6 +62,8 @@ void capture_data(optvalues& opts);
 void set_control(optvalues& opts);
 void set_input(optvalues& opts);
 void set_output(optvalues& opts);
+void bench_copy(optvalues& opts);
+void bench_buffers(optvalues& opts);
 DeviceDescriptor* get_device_descriptor(int dev_index);
 
 void print_info(int num);
@@ -65,7 +76,7 @@ void print_connectors(CaptureDevice *dev);
 int main(int argc, char* argv[])
 {
 	// parse command line arguments and call the proper function
-	optvalues opts = {"capture.dat", "", "", 5, 0, 0, 0, 0, 0, false, false, false, false, false, false, false, false};
+	optvalues opts = {"capture.dat", "", "", 5, 0, 0, 0, 0, 0, false, false, false, false, false, false, false, false, false, false};
 	if(parse_options(argc, argv, opts) == 0 || opts.help) {
 		print_usage();
 		return 0;
@@ -97,6 +108,14 @@ int main(int argc, char* argv[])
 		capture_data(opts);
 	}
 
+	if(opts.bench_copy) {
+		bench_copy(opts);
+	}
+
+	if(opts.bench_buffers) {
+		bench_buffers(opts);
+	}
+
 	return 0;
 }
 
@@ -123,11 +142,13 @@ int parse_options(int argc, char* argv[], optvalues& opts)
              {"set-framerate", 1, 0, 'u'},
              {"set-input", 1, 0, 'j'},
              {"set-output", 1, 0, 'o'},
+             {"bench-copy", 0, 0, 'b'},
+             {"bench-buffers", 0, 0, 'e'},
              {"help", 0, 0, 'h'},
              {0, 0, 0, 0}
          };
 
-         c = getopt_long (argc, argv, "lihcd:t:f:l:r:m:s:u:j:o:",
+         c = getopt_long (argc, argv, "lihcbed:t:f:l:r:m:s:u:j:o:",
                   long_options, &option_index);
          if (c == -1)
              break;
@@ -211,6 +232,18 @@ int parse_options(int argc, char* argv[], optvalues& opts)
         	 opts_found++;
         	 break;
 
+         // compare the ways to read the frames
+         case 'b':
+        	 opts.bench_copy = true;
+        	 opts_found++;
+        	 break;
+
+         // compare the ways to find the buffers of the frames
+         case 'e':
+        	 opts.bench_buffers = true;
+        	 opts_found++;
+        	 break;
+
          // print usage
          case 'h':
          case '?':
@@ -246,6 +279,8 @@ void print_usage()
 	std::cout<<"  -j, --set-input <input>: set the video input connector.\n";
 	std::cout<<"  -o, --set-output <output>: set the video output connector.\n";
 	std::cout<<"  -u, --set-framerate <rate>: set the capture frame rate (not supported by all devices).\n";
+	std::cout<<"  -b, --bench-copy : compare reading the frames in place, after memcpy() and after a streaming copy.\n";
+	std::cout<<"  -e, --bench-buffers : compare finding the buffers of the frames in a list and in the indexed buffer table.\n";
 	std::cout<<"  -h, --help	: print this help and exit.\n";
 	std::cout<<"\n";
 	std::cout<<"Nico Pranke, TU BA Freiberg, 2008-2009, Nico.Pranke<at>googlemail.com\n";
@@ -700,3 +735,232 @@ void set_output(optvalues& opts)
 	dd->close();
 }
 
+static long long bench_time()
+{
+	// a monotonic time in nanoseconds
+#if defined _WIN32 || defined WIN32 || defined _WIN64
+	LARGE_INTEGER count, freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (long long) (count.QuadPart * (1000000000.0 / freq.QuadPart));
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+static unsigned long long bench_read(const void* data, size_t size)
+{
+	// read every word of the frame, like an image processing routine would do
+	const unsigned long long* p = (const unsigned long long*) data;
+	unsigned long long sum = 0;
+
+	for(size_t i = 0; i < size / sizeof(*p); i++)
+		sum += p[i];
+
+	return sum;
+}
+
+//! Measures the time to process a frame in place and after copying it to cached memory.
+
+class BenchCopyHandler: public CaptureHandler
+{
+public:
+	enum { DIRECT = 0, MEMCPY, STREAM, NUM_METHODS };
+
+private:
+	std::vector<char>	mCache;
+	long long			mTime[NUM_METHODS];
+	size_t				mBytes;
+	int					mFrames;
+	unsigned long long	mSum;
+
+public:
+	BenchCopyHandler(): mBytes(0), mFrames(0), mSum(0)
+		{ memset(mTime, 0, sizeof(mTime)); }
+
+	void handleCaptureEvent(IOBuffer* io_buf)
+	{
+		measure(io_buf->getPtr(), io_buf->getValidBytes());
+		io_buf->release();
+	}
+
+	void measure(const void* data, size_t size)
+	{
+		if(size == 0)
+			return;
+
+		if(mCache.size() < size)
+			mCache.resize(size);
+
+		// rotate the order, the first method finds the frame uncached, the others may not
+		for(int i = 0; i < NUM_METHODS; i++) {
+			int m = (mFrames + i) % NUM_METHODS;
+
+			long long t0 = bench_time();
+			run(m, data, size);
+			mTime[m] += bench_time() - t0;
+		}
+
+		mBytes += size;
+		mFrames++;
+	}
+
+	void run(int method, const void* data, size_t size)
+	{
+		switch(method)
+		{
+			case DIRECT:
+				mSum += bench_read(data, size);
+			break;
+
+			case MEMCPY:
+				memcpy(&mCache[0], data, size);
+				mSum += bench_read(&mCache[0], size);
+			break;
+
+			case STREAM:
+				StreamCopy::copy(&mCache[0], data, size);
+				mSum += bench_read(&mCache[0], size);
+			break;
+		}
+	}
+
+	int getFrames() const
+		{ return mFrames; }
+
+	void print() const
+	{
+		static const char* names[NUM_METHODS] = { "read in place", "memcpy + read", "streaming copy + read" };
+
+		std::cout<<"\n"<<mFrames<<" frames, "<<mBytes / (mFrames ? mFrames : 1)<<" bytes each (checksum "<<mSum<<")\n";
+
+		for(int m = 0; m < NUM_METHODS; m++) {
+			double us = mTime[m] / 1000.0 / (mFrames ? mFrames : 1);
+			double mbs = mTime[m] ? mBytes * 1000.0 / mTime[m] : 0.0;
+			std::cout<<"  "<<names[m]<<": "<<us<<" us per frame, "<<mbs<<" MB/s\n";
+		}
+	}
+};
+
+void bench_copy(optvalues& opts)
+{
+	// compare the cost of processing the frames in the driver buffers with processing a copy
+	std::cout<<"Streaming copy uses: "<<StreamCopy::getMethodName()<<"\n";
+
+	BenchCopyHandler handler;
+	DeviceDescriptor* dd = get_device_descriptor(opts.device);
+
+	if(dd) {
+		dd->open();
+		CaptureDevice* dev = dd->getDevice();
+
+		if(dev) {
+			dev->getVidCapMgr()->registerCaptureHandler(&handler);
+
+			std::cout<<"Measuring "<<opts.time<<" seconds of frames from device "<<opts.device<<".\n";
+
+			if(dev->getVidCapMgr()->startCapture() != -1) {
+				usleep(1000*1000*opts.time);
+				dev->getVidCapMgr()->stopCapture();
+			}
+
+			dev->getVidCapMgr()->removeCaptureHandler(&handler);
+		}
+
+		dd->close();
+	}
+
+	// without a device the numbers show the costs for cached memory
+	if(handler.getFrames() == 0) {
+		std::cout<<"No frames captured, measuring a frame in cached memory instead.\n";
+
+		std::vector<char> frame(1920 * 1080 * 2, 1);
+		for(int i = 0; i < 100; i++)
+			handler.measure(&frame[0], frame.size());
+	}
+
+	handler.print();
+}
+
+void bench_buffers(optvalues& opts)
+{
+#ifdef AVCAP_LINUX
+	// compare the indexed buffer table with scanning a list of the buffers, as done before
+	const int rounds = 1000000;
+	char mem[16];
+	unsigned long sum = 0;
+
+	std::cout<<"buffers  find (list / table)  free buffer (list / table)\n";
+
+	for(int n = 32; n <= 128; n *= 2) {
+		std::list<IOBuffer*> list;
+		BufferTable table;
+
+		for(int i = 0; i < n; i++) {
+			IOBuffer* buf = new IOBuffer(0, mem, sizeof(mem), i);
+			list.push_back(buf);
+			table.insert(buf);
+		}
+
+		// the driver returns the buffers round robin
+		long long t0 = bench_time();
+		for(int r = 0; r < rounds; r++) {
+			int index = r % n;
+			for(std::list<IOBuffer*>::iterator it = list.begin(); it != list.end(); it++)
+				if((*it)->getIndex() == index) {
+					sum += (unsigned long) *it;
+					break;
+				}
+		}
+		long long list_find = bench_time() - t0;
+
+		t0 = bench_time();
+		for(int r = 0; r < rounds; r++)
+			sum += (unsigned long) table.find(r % n);
+		long long table_find = bench_time() - t0;
+
+		// all buffers are in use except the one released last
+		for(std::list<IOBuffer*>::iterator it = list.begin(); it != list.end(); it++)
+			(*it)->setState(IOBuffer::STATE_USED);
+
+		t0 = bench_time();
+		for(int r = 0; r < rounds; r++) {
+			IOBuffer* released = table.find(r % n);
+			released->setState(IOBuffer::STATE_UNUSED);
+
+			for(std::list<IOBuffer*>::iterator it = list.begin(); it != list.end(); it++)
+				if((*it)->getState() == IOBuffer::STATE_UNUSED) {
+					(*it)->setState(IOBuffer::STATE_USED);
+					sum += (unsigned long) *it;
+					break;
+				}
+		}
+		long long list_free = bench_time() - t0;
+
+		t0 = bench_time();
+		for(int r = 0; r < rounds; r++) {
+			IOBuffer* released = table.find(r % n);
+			released->setState(IOBuffer::STATE_UNUSED);
+			table.pushFree(released);
+
+			IOBuffer* buf = table.popFree();
+			buf->setState(IOBuffer::STATE_USED);
+			sum += (unsigned long) buf;
+		}
+		long long table_free = bench_time() - t0;
+
+		std::cout<<"  "<<n<<"\t "<<list_find / (double) rounds<<" / "<<table_find / (double) rounds<<" ns\t\t"
+			<<list_free / (double) rounds<<" / "<<table_free / (double) rounds<<" ns\n";
+
+		table.clear();
+		for(std::list<IOBuffer*>::iterator it = list.begin(); it != list.end(); it++)
+			delete *it;
+	}
+
+	std::cout<<"(checksum "<<sum<<")\n";
+#else
+	std::cout<<"The buffer table is only used on Linux.\n";
+#endif
+}